@@ -0,0 +1,104 @@
+/* cpu.c - Per-CPU descriptor tables and data */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * Each CPU gets its own GDT, TSS and cpu_data.  The GDT carries a data
+ * segment based at the CPU's cpu_data which is kept in %gs, so cpu_id() is a
+ * single load on any CPU.  The TSS only provides the ring 0 stack, which the
+ * scheduler points at the running task's stack.
+ */
+#include <fmios/fmios.h>
+#include <fmios/smp.h>
+#include <asm/desc.h>
+
+#include <string.h>
+
+extern char stack[];
+
+struct cpu_data cpu_data[NR_CPUS];
+
+static struct gdt_entry cpu_gdt[NR_CPUS][GDT_ENTRIES] __attribute__((aligned(8)));
+static struct tss cpu_tss[NR_CPUS];
+
+/* entry.S knows where this lives */
+typedef char cpu_data_sysenter_check[
+	__builtin_offsetof(struct cpu_data, sysenter_kernel) ==
+	CPU_SYSENTER_KERNEL ? 1 : -1];
+
+/**
+ * @cpu the CPU we are running on
+ * @stack top of the stack the CPU is running on
+ *
+ * Load the CPU's own GDT, segments and TSS.
+ */
+void cpu_init(int cpu, unsigned long stack)
+{
+	struct gdt_entry *gdt = cpu_gdt[cpu];
+	struct tss *tss = &cpu_tss[cpu];
+	struct gdt_ptr ptr;
+
+	cpu_data[cpu].self = &cpu_data[cpu];
+	cpu_data[cpu].cpu = cpu;
+	cpu_data[cpu].stack = stack;
+	cpu_data[cpu].tss = tss;
+
+	memset(tss, 0, sizeof(*tss));
+	tss->esp0 = stack;
+	tss->ss0 = GDT_KERNEL_DS;
+	tss->iomap = sizeof(*tss);
+
+	gdt_set_entry(&gdt[GDT_NULL / 8], 0, 0, 0, 0);
+	gdt_set_entry(&gdt[GDT_KERNEL_CS / 8], 0, 0xfffff, DESC_CODE, DESC_FLAT);
+	gdt_set_entry(&gdt[GDT_KERNEL_DS / 8], 0, 0xfffff, DESC_DATA, DESC_FLAT);
+	gdt_set_entry(&gdt[GDT_USER_CS / 8], 0, 0xfffff, DESC_USER_CODE,
+			DESC_FLAT);
+	gdt_set_entry(&gdt[GDT_USER_DS / 8], 0, 0xfffff, DESC_USER_DATA,
+			DESC_FLAT);
+	gdt_set_entry(&gdt[GDT_PERCPU / 8], (uint32_t)&cpu_data[cpu],
+			sizeof(struct cpu_data) - 1, DESC_DATA, 0x4);
+	gdt_set_entry(&gdt[GDT_TSS / 8], (uint32_t)tss, sizeof(*tss) - 1,
+			DESC_TSS, 0);
+
+	ptr.limit = sizeof(cpu_gdt[cpu]) - 1;
+	ptr.base = (uint32_t)gdt;
+
+	__asm__ __volatile__(
+		"lgdt %0\n\t"
+		"ljmp %1, $1f\n"
+		"1:\n\t"
+		"movw %w2, %%ds\n\t"
+		"movw %w2, %%es\n\t"
+		"movw %w2, %%ss\n\t"
+		"movw %w2, %%fs\n\t"
+		"movw %w3, %%gs\n\t"
+		"ltr %w4\n\t"
+		: /* No output */
+		: "m" (ptr), "i" (GDT_KERNEL_CS), "r" (GDT_KERNEL_DS),
+		  "r" (GDT_PERCPU), "r" (GDT_TSS)
+		: "memory");
+}
+
+/* Called from boot.S so that cpu_id() works before anything else runs */
+void cpu_early_init(void)
+{
+	cpu_init(0, (unsigned long)stack + STACK_SIZE);
+}
@@ -0,0 +1,49 @@
+#ifndef _ASM_APIC_H
+#define _ASM_APIC_H
+
+#define APIC_DEFAULT_BASE	0xfee00000
+#define APIC_SIZE		0x1000
+
+/* Local APIC registers */
+#define APIC_ID			0x020
+#define APIC_VERSION		0x030
+#define APIC_EOI		0x0b0
+#define APIC_SVR		0x0f0
+#define APIC_ESR		0x280
+#define APIC_ICR_LOW		0x300
+#define APIC_ICR_HIGH		0x310
+
+#define APIC_SVR_ENABLE		0x100
+#define APIC_SPURIOUS_VECTOR	0xff
+
+/* Interrupt command register */
+#define APIC_ICR_INIT		0x00500
+#define APIC_ICR_STARTUP	0x00600
+#define APIC_ICR_BUSY		0x01000
+#define APIC_ICR_ASSERT		0x04000
+#define APIC_ICR_LEVEL		0x08000
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+extern unsigned long apic_base;
+
+static inline uint32_t apic_read(int reg)
+{
+	return *(volatile uint32_t *)(apic_base + reg);
+}
+
+static inline void apic_write(int reg, uint32_t val)
+{
+	*(volatile uint32_t *)(apic_base + reg) = val;
+}
+
+static inline uint32_t apic_id(void)
+{
+	return apic_read(APIC_ID) >> 24;
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_APIC_H */
@@ -0,0 +1,193 @@
+#ifndef _ASM_ATOMIC_H
+#define _ASM_ATOMIC_H
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+/*
+ * The x86 primitives behind <fmios/atomic.h>, one inline function per
+ * operation and width.  Every locked instruction is a full barrier on x86,
+ * so the memory order only ever matters to the compiler, and plain loads and
+ * stores already have acquire and release semantics.  64-bit operations go
+ * through cmpxchg8b, the kernel is never built position independent so %ebx
+ * is free for it.
+ */
+
+#define arch_barrier()	__asm__ __volatile__("" : : : "memory")
+
+/* A full barrier without needing SSE2 for mfence */
+static inline void arch_mb(void)
+{
+	__asm__ __volatile__("lock; addl $0, (%%esp)" : : : "memory", "cc");
+}
+
+#define ARCH_ATOMIC_OPS(bits, type, suffix, reg)			\
+/* Naturally aligned accesses up to 4 bytes are atomic by themselves */	\
+static inline type arch_load##bits(volatile type *ptr)			\
+{									\
+	return *ptr;							\
+}									\
+									\
+static inline void arch_store##bits(volatile type *ptr, type val)	\
+{									\
+	*ptr = val;							\
+}									\
+									\
+static inline type arch_xchg##bits(volatile type *ptr, type val)	\
+{									\
+	/* xchg with memory is always locked */				\
+	__asm__ __volatile__(						\
+		"xchg" suffix " %0, %1\n\t"				\
+		: "+" reg (val), "+m" (*ptr)				\
+		: /* No input */					\
+		: "memory");						\
+	return val;							\
+}									\
+									\
+static inline type arch_cmpxchg##bits(volatile type *ptr, type old,	\
+		type val)						\
+{									\
+	type prev;							\
+									\
+	__asm__ __volatile__(						\
+		"lock; cmpxchg" suffix " %2, %1\n\t"			\
+		: "=a" (prev), "+m" (*ptr)				\
+		: reg (val), "0" (old)					\
+		: "memory", "cc");					\
+	return prev;							\
+}									\
+									\
+static inline type arch_xadd##bits(volatile type *ptr, type val)	\
+{									\
+	__asm__ __volatile__(						\
+		"lock; xadd" suffix " %0, %1\n\t"			\
+		: "+" reg (val), "+m" (*ptr)				\
+		: /* No input */					\
+		: "memory", "cc");					\
+	return val;							\
+}									\
+									\
+static inline void arch_add##bits(volatile type *ptr, type val)		\
+{									\
+	__asm__ __volatile__(						\
+		"lock; add" suffix " %1, %0\n\t"			\
+		: "+m" (*ptr)						\
+		: "i" reg (val)						\
+		: "memory", "cc");					\
+}									\
+									\
+static inline void arch_or##bits(volatile type *ptr, type val)		\
+{									\
+	__asm__ __volatile__(						\
+		"lock; or" suffix " %1, %0\n\t"				\
+		: "+m" (*ptr)						\
+		: "i" reg (val)						\
+		: "memory", "cc");					\
+}									\
+									\
+static inline void arch_and##bits(volatile type *ptr, type val)		\
+{									\
+	__asm__ __volatile__(						\
+		"lock; and" suffix " %1, %0\n\t"			\
+		: "+m" (*ptr)						\
+		: "i" reg (val)						\
+		: "memory", "cc");					\
+}									\
+									\
+/* @return non-zero if *ptr is 0 afterwards */				\
+static inline int arch_sub_and_test##bits(volatile type *ptr, type val)	\
+{									\
+	uint8_t zero;							\
+									\
+	__asm__ __volatile__(						\
+		"lock; sub" suffix " %2, %0\n\t"			\
+		"sete %1\n\t"						\
+		: "+m" (*ptr), "=qm" (zero)				\
+		: "i" reg (val)						\
+		: "memory", "cc");					\
+	return zero;							\
+}
+
+ARCH_ATOMIC_OPS(8, uint8_t, "b", "q")
+ARCH_ATOMIC_OPS(16, uint16_t, "w", "r")
+ARCH_ATOMIC_OPS(32, uint32_t, "l", "r")
+
+#undef ARCH_ATOMIC_OPS
+
+static inline uint64_t arch_cmpxchg64(volatile uint64_t *ptr, uint64_t old,
+		uint64_t val)
+{
+	uint64_t prev;
+
+	__asm__ __volatile__(
+		"lock; cmpxchg8b %1\n\t"
+		: "=A" (prev), "+m" (*ptr)
+		: "b" ((uint32_t)val), "c" ((uint32_t)(val >> 32)), "0" (old)
+		: "memory", "cc");
+	return prev;
+}
+
+/* cmpxchg8b with the same old and new value is the only atomic 8 byte load
+ * without SSE, it never changes memory */
+static inline uint64_t arch_load64(volatile uint64_t *ptr)
+{
+	return arch_cmpxchg64(ptr, 0, 0);
+}
+
+static inline uint64_t arch_xchg64(volatile uint64_t *ptr, uint64_t val)
+{
+	uint64_t old = arch_load64(ptr), prev;
+
+	while ((prev = arch_cmpxchg64(ptr, old, val)) != old) {
+		old = prev;
+	}
+	return old;
+}
+
+static inline uint64_t arch_xadd64(volatile uint64_t *ptr, uint64_t val)
+{
+	uint64_t old = arch_load64(ptr), prev;
+
+	while ((prev = arch_cmpxchg64(ptr, old, old + val)) != old) {
+		old = prev;
+	}
+	return old;
+}
+
+static inline void arch_add64(volatile uint64_t *ptr, uint64_t val)
+{
+	arch_xadd64(ptr, val);
+}
+
+static inline void arch_or64(volatile uint64_t *ptr, uint64_t val)
+{
+	uint64_t old = arch_load64(ptr), prev;
+
+	while ((prev = arch_cmpxchg64(ptr, old, old | val)) != old) {
+		old = prev;
+	}
+}
+
+static inline void arch_and64(volatile uint64_t *ptr, uint64_t val)
+{
+	uint64_t old = arch_load64(ptr), prev;
+
+	while ((prev = arch_cmpxchg64(ptr, old, old & val)) != old) {
+		old = prev;
+	}
+}
+
+static inline int arch_sub_and_test64(volatile uint64_t *ptr, uint64_t val)
+{
+	return arch_xadd64(ptr, -val) == val;
+}
+
+static inline void arch_store64(volatile uint64_t *ptr, uint64_t val)
+{
+	arch_xchg64(ptr, val);
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_ATOMIC_H */
@@ -0,0 +1,28 @@
+#ifndef _ASM_BITOPS_H
+#define _ASM_BITOPS_H
+
+#ifndef __ASSEMBLY__
+
+/*
+ * __ffs()
+ *	Index of the least significant set bit, undefined if word is 0
+ */
+static inline unsigned long __ffs(unsigned long word)
+{
+	__asm__("bsf %1, %0" : "=r" (word) : "rm" (word));
+	return word;
+}
+
+/*
+ * __fls()
+ *	Index of the most significant set bit, undefined if word is 0
+ */
+static inline unsigned long __fls(unsigned long word)
+{
+	__asm__("bsr %1, %0" : "=r" (word) : "rm" (word));
+	return word;
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_BITOPS_H */
@@ -3,5 +3,6 @@
 
 #define PAGE_SIZE	0x1000
 #define STACK_SIZE	PAGE_SIZE
+#define NR_CPUS		32
 
 #endif /* _ASM_CONFIG_H */
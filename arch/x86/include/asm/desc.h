@@ -0,0 +1,80 @@
+#ifndef _ASM_DESC_H
+#define _ASM_DESC_H
+
+/* Layout of each CPU's GDT, sysenter/sysexit need the first four in order */
+#define GDT_NULL		0x00
+#define GDT_KERNEL_CS		0x08
+#define GDT_KERNEL_DS		0x10
+#define GDT_USER_CS		0x18
+#define GDT_USER_DS		0x20
+#define GDT_PERCPU		0x28	/* loaded into %gs, based at cpu_data */
+#define GDT_TSS			0x30
+#define GDT_ENTRIES		7
+
+/* Access bytes */
+#define DESC_CODE		0x9a	/* present, DPL 0, execute/read */
+#define DESC_DATA		0x92	/* present, DPL 0, read/write */
+#define DESC_USER_CODE		0xfa	/* present, DPL 3, execute/read */
+#define DESC_USER_DATA		0xf2	/* present, DPL 3, read/write */
+#define DESC_TSS		0x89	/* present, DPL 0, available 32-bit TSS */
+
+/* Flags nibble */
+#define DESC_FLAT		0xc	/* 4KiB granularity, 32-bit */
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+/* Operand of lgdt/sgdt and lidt/sidt */
+struct gdt_ptr {
+	uint16_t	limit;
+	uint32_t	base;
+} __attribute__((packed));
+
+struct gdt_entry {
+	uint16_t	limit_low;
+	uint16_t	base_low;
+	uint8_t		base_mid;
+	uint8_t		access;
+	uint8_t		limit_flags;	/* limit 19:16 and the flags */
+	uint8_t		base_high;
+} __attribute__((packed));
+
+struct tss {
+	uint16_t	link, __link;
+	uint32_t	esp0;
+	uint16_t	ss0, __ss0;
+	uint32_t	esp1;
+	uint16_t	ss1, __ss1;
+	uint32_t	esp2;
+	uint16_t	ss2, __ss2;
+	uint32_t	cr3;
+	uint32_t	eip;
+	uint32_t	eflags;
+	uint32_t	eax, ecx, edx, ebx;
+	uint32_t	esp, ebp, esi, edi;
+	uint16_t	es, __es;
+	uint16_t	cs, __cs;
+	uint16_t	ss, __ss;
+	uint16_t	ds, __ds;
+	uint16_t	fs, __fs;
+	uint16_t	gs, __gs;
+	uint16_t	ldt, __ldt;
+	uint16_t	trap;
+	uint16_t	iomap;
+} __attribute__((packed));
+
+static inline void gdt_set_entry(struct gdt_entry *entry, uint32_t base,
+		uint32_t limit, uint8_t access, uint8_t flags)
+{
+	entry->limit_low = limit & 0xffff;
+	entry->base_low = base & 0xffff;
+	entry->base_mid = (base >> 16) & 0xff;
+	entry->access = access;
+	entry->limit_flags = ((limit >> 16) & 0x0f) | (flags << 4);
+	entry->base_high = base >> 24;
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_DESC_H */
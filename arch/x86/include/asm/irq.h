@@ -0,0 +1,65 @@
+#ifndef _ASM_IRQ_H
+#define _ASM_IRQ_H
+
+/* The 8259s are moved clear of the exception vectors */
+#define NR_IRQS			16
+#define IRQ_VECTOR_BASE		0x20
+#define IRQ_ENTRY_SIZE		8	/* bytes per stub in irq_entries */
+
+#ifndef __ASSEMBLY__
+
+/*
+ * irq_save()
+ *	Disable interrupts on the local CPU, returning the previous EFLAGS
+ */
+static inline unsigned long irq_save(void)
+{
+	unsigned long flags;
+
+	__asm__ __volatile__(
+		"pushf\n\t"
+		"pop %0\n\t"
+		"cli\n\t"
+		: "=r" (flags)
+		: /* No input */
+		: "memory");
+	return flags;
+}
+
+/*
+ * irq_restore()
+ *	Restore the interrupt state saved by irq_save()
+ */
+static inline void irq_restore(unsigned long flags)
+{
+	__asm__ __volatile__(
+		"push %0\n\t"
+		"popf\n\t"
+		: /* No output */
+		: "r" (flags)
+		: "memory", "cc");
+}
+
+/*
+ * irq_window()
+ *	Let any pending interrupts in, for code which otherwise runs with
+ *	them disabled.  The interrupt state is left as it was.
+ */
+static inline void irq_window(void)
+{
+	__asm__ __volatile__(
+		"pushf\n\t"
+		"sti\n\t"
+		"nop\n\t"
+		"popf\n\t"
+		: /* No output */
+		: /* No input */
+		: "memory", "cc");
+}
+
+void irq_init(void);
+int irq_register(int irq, void (*handler)(void *), void *arg);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_IRQ_H */
@@ -2,5 +2,24 @@
 #define _ASM_PAGE_H
 
 #define PAGE_SIZE	0x1000
+#define PAGE_SHIFT	12
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
+
+/* Page table and page directory entry bits, common to the 2-level and PAE
+ * formats */
+#define PTE_PRESENT	0x001
+#define PTE_WRITE	0x002
+#define PTE_USER	0x004
+#define PTE_PWT		0x008
+#define PTE_PCD		0x010
+#define PTE_ACCESSED	0x020
+#define PTE_DIRTY	0x040
+#define PTE_LARGE	0x080	/* directory entries only */
+#define PTE_GLOBAL	0x100
+#define PTE_RETIRED	0x200	/* software, see paging_retire_page() */
+
+/* Pages covered by a single large page */
+#define PSE_LARGE_PAGES	1024	/* 4MiB */
+#define PAE_LARGE_PAGES	512	/* 2MiB */
 
 #endif
@@ -0,0 +1,124 @@
+#ifndef _ASM_PROCESSOR_H
+#define _ASM_PROCESSOR_H
+
+/* CR0/CR4 bits */
+#define X86_CR0_PE		(1 << 0)
+#define X86_CR0_WP		(1 << 16)
+#define X86_CR0_PG		0x80000000
+#define X86_CR4_PSE		(1 << 4)
+#define X86_CR4_PAE		(1 << 5)
+#define X86_CR4_PGE		(1 << 7)
+
+/* CPUID leaf 1 EDX feature bits */
+#define X86_FEATURE_PSE		(1 << 3)
+#define X86_FEATURE_PAE		(1 << 6)
+#define X86_FEATURE_APIC	(1 << 9)
+#define X86_FEATURE_SEP		(1 << 11)
+#define X86_FEATURE_PGE		(1 << 13)
+
+/* Model specific registers */
+#define MSR_SYSENTER_CS		0x174
+#define MSR_SYSENTER_ESP	0x175
+#define MSR_SYSENTER_EIP	0x176
+
+/* EFLAGS bits */
+#define X86_EFLAGS_ID		(1 << 21)
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+/*
+ * cpu_relax()
+ *	Hint to the CPU that we are spinning on a memory location
+ */
+static inline void cpu_relax(void)
+{
+	__asm__ __volatile__("pause" : : : "memory");
+}
+
+/* @return non-zero if the CPU implements the cpuid instruction */
+static inline int cpu_has_cpuid(void)
+{
+	unsigned long before, after;
+
+	__asm__ __volatile__(
+		"pushfl\n\t"
+		"pushfl\n\t"
+		"popl %0\n\t"
+		"movl %0, %1\n\t"
+		"xorl %2, %1\n\t"
+		"pushl %1\n\t"
+		"popfl\n\t"
+		"pushfl\n\t"
+		"popl %1\n\t"
+		"popfl"
+		: "=&r" (before), "=&r" (after)
+		: "i" (X86_EFLAGS_ID));
+
+	return (before ^ after) & X86_EFLAGS_ID;
+}
+
+static inline void cpuid(uint32_t op, uint32_t *eax, uint32_t *ebx,
+		uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ __volatile__("cpuid"
+		: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "a" (op), "c" (0));
+}
+
+#define read_cr(reg)						\
+static inline unsigned long read_##reg(void)			\
+{								\
+	unsigned long val;					\
+	__asm__ __volatile__("mov %%" #reg ", %0" : "=r" (val));	\
+	return val;						\
+}
+#define write_cr(reg)						\
+static inline void write_##reg(unsigned long val)		\
+{								\
+	__asm__ __volatile__("mov %0, %%" #reg : : "r" (val) : "memory"); \
+}
+
+read_cr(cr0)
+write_cr(cr0)
+read_cr(cr2)
+read_cr(cr3)
+write_cr(cr3)
+read_cr(cr4)
+write_cr(cr4)
+
+#undef read_cr
+#undef write_cr
+
+/* @return the time stamp counter */
+static inline uint64_t rdtsc(void)
+{
+	uint64_t tsc;
+
+	__asm__ __volatile__("rdtsc" : "=A" (tsc));
+	return tsc;
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint64_t val;
+
+	__asm__ __volatile__("rdmsr" : "=A" (val) : "c" (msr));
+	return val;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+	__asm__ __volatile__("wrmsr" : : "c" (msr), "A" (val) : "memory");
+}
+
+/* Drop any TLB entry for the page containing addr */
+static inline void invlpg(unsigned long addr)
+{
+	__asm__ __volatile__("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_PROCESSOR_H */
@@ -0,0 +1,47 @@
+#ifndef _ASM_SCHED_H
+#define _ASM_SCHED_H
+
+#include <asm/desc.h>
+#include <asm/smp.h>
+
+#ifndef __ASSEMBLY__
+
+/* Saves the callee saved registers on the current stack, stores the stack
+ * pointer in *prev_sp and resumes whatever was saved on next_sp */
+void switch_context(unsigned long *prev_sp, unsigned long next_sp);
+
+/*
+ * arch_task_stack()
+ *	Build the frame switch_context() expects at the top of a new stack so
+ *	the first switch to it "returns" into start, which must never return.
+ */
+static inline unsigned long arch_task_stack(unsigned long top,
+		void (*start)(void))
+{
+	unsigned long *sp = (unsigned long *)top;
+
+	*--sp = 0;			/* return address for start() */
+	*--sp = (unsigned long)start;
+	*--sp = 0;			/* %ebp */
+	*--sp = 0;			/* %ebx */
+	*--sp = 0;			/* %esi */
+	*--sp = 0;			/* %edi */
+
+	return (unsigned long)sp;
+}
+
+/*
+ * arch_task_switch()
+ *	Point ring 3 entries at the top of the next task's kernel stack, or at
+ *	the CPU's own stack when top is 0.
+ */
+static inline void arch_task_switch(unsigned long top)
+{
+	struct cpu_data *cpu = this_cpu();
+
+	cpu->tss->esp0 = top ? top : cpu->stack;
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_SCHED_H */
@@ -0,0 +1,58 @@
+#ifndef _ASM_SMP_H
+#define _ASM_SMP_H
+
+#include <asm/config.h>
+
+/* Offset of cpu_data.sysenter_kernel, for entry.S */
+#define CPU_SYSENTER_KERNEL	20
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+struct tss;
+
+/**
+ * Data private to one CPU.  Each CPU's %gs is based at its own entry so that
+ * it can be found without knowing which CPU we are on.
+ */
+struct cpu_data {
+	struct cpu_data	*self;
+	int		cpu;
+	uint32_t	apic_id;
+	unsigned long	stack;		/* top of the boot/idle stack */
+	struct tss	*tss;
+	int		sysenter_kernel; /* sysenter returns to ring 0 */
+} __attribute__((aligned(64)));
+
+extern struct cpu_data cpu_data[NR_CPUS];
+
+void cpu_init(int cpu, unsigned long stack);
+void cpu_early_init(void);
+
+/* Volatile so that it is read again after a task migrates */
+static inline int cpu_id(void)
+{
+	int cpu;
+
+	__asm__ __volatile__(
+		"movl %%gs:%c1, %0\n\t"
+		: "=r" (cpu)
+		: "i" (__builtin_offsetof(struct cpu_data, cpu)));
+	return cpu;
+}
+
+static inline struct cpu_data * this_cpu(void)
+{
+	struct cpu_data *self;
+
+	__asm__ __volatile__(
+		"movl %%gs:%c1, %0\n\t"
+		: "=r" (self)
+		: "i" (__builtin_offsetof(struct cpu_data, self)));
+	return self;
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_SMP_H */
@@ -0,0 +1,14 @@
+#ifndef _ASM_SYSCALL_H
+#define _ASM_SYSCALL_H
+
+/* Syscalls take their number in %eax and arguments in %ebx, %esi, %edi and
+ * %ebp, and return in %eax.  %ecx and %edx are lost, sysenter needs them for
+ * the return stack and address. */
+
+#ifndef __ASSEMBLY__
+
+void syscall_cpu_init(void);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_SYSCALL_H */
@@ -0,0 +1,51 @@
+#ifndef _ASM_TRAPS_H
+#define _ASM_TRAPS_H
+
+#define IDT_ENTRIES		256
+
+/* Exception vectors */
+#define TRAP_PAGE_FAULT		14
+#define TRAP_SYSCALL		0x80
+
+/* Page fault error code bits */
+#define PF_PRESENT		0x01	/* protection fault, not a missing page */
+#define PF_WRITE		0x02
+#define PF_USER			0x04
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+#include <asm/desc.h>
+
+struct idt_entry {
+	uint16_t	offset_low;
+	uint16_t	selector;
+	uint8_t		zero;
+	uint8_t		type;
+	uint16_t	offset_high;
+} __attribute__((packed));
+
+/* The frame built by the exception entry stubs in entry.S */
+struct trap_regs {
+	uint32_t	edi;
+	uint32_t	esi;
+	uint32_t	ebp;
+	uint32_t	esp;
+	uint32_t	ebx;
+	uint32_t	edx;
+	uint32_t	ecx;
+	uint32_t	eax;
+	uint32_t	error;
+	uint32_t	eip;
+	uint32_t	cs;
+	uint32_t	eflags;
+};
+
+void traps_init(void);
+void traps_cpu_init(void);
+void trap_set_gate(int vector, void (*handler)(void));
+void trap_set_user_gate(int vector, void (*handler)(void));
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_TRAPS_H */
@@ -0,0 +1,172 @@
+/* irq.c - 8259 interrupt controller and device interrupt dispatch */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Device interrupts come in through the pair of 8259s, moved up to
+ * IRQ_VECTOR_BASE and with every line masked until a handler is registered
+ * for it.  The local APIC is left in the virtual wire mode the firmware set
+ * up, so they are all delivered to the boot CPU.
+ *
+ * The kernel otherwise runs with interrupts disabled, so handlers only run
+ * while a CPU is in user space or inside an irq_window().  They are called
+ * with interrupts disabled and must be short.
+ */
+#include <fmios/fmios.h>
+#include <fmios/spinlock.h>
+#include <fmios/io.h>
+#include <asm/apic.h>
+#include <asm/irq.h>
+#include <asm/traps.h>
+
+#define PIC_MASTER_CMD		0x20
+#define PIC_MASTER_DATA		0x21
+#define PIC_SLAVE_CMD		0xa0
+#define PIC_SLAVE_DATA		0xa1
+
+#define PIC_ICW1_INIT		0x11	/* edge triggered, cascaded, ICW4 */
+#define PIC_ICW4_8086		0x01
+#define PIC_OCW3_READ_ISR	0x0b
+#define PIC_EOI			0x20
+#define PIC_CASCADE		2	/* the slave hangs off this line */
+
+struct irq_action {
+	void		(*handler)(void *);
+	void		*arg;
+};
+
+extern char irq_entries[];
+extern void irq_spurious_entry(void);
+
+static struct irq_action irq_action[NR_IRQS];
+static spinlock_t irq_lock = SPINLOCK_INIT("irq");	/* protects irq_mask */
+static uint16_t irq_mask = 0xffff & ~(1 << PIC_CASCADE);
+static int irq_ready = 0;
+
+static void irq_set_mask(void)
+{
+	outb(PIC_MASTER_DATA, irq_mask & 0xff);
+	outb(PIC_SLAVE_DATA, irq_mask >> 8);
+}
+
+/* Remap both 8259s and hook up every line, leaving them masked */
+void irq_init(void)
+{
+	unsigned long flags;
+	int irq;
+
+	outb(PIC_MASTER_CMD, PIC_ICW1_INIT);
+	outb(PIC_SLAVE_CMD, PIC_ICW1_INIT);
+	outb(PIC_MASTER_DATA, IRQ_VECTOR_BASE);
+	outb(PIC_SLAVE_DATA, IRQ_VECTOR_BASE + 8);
+	outb(PIC_MASTER_DATA, 1 << PIC_CASCADE);
+	outb(PIC_SLAVE_DATA, PIC_CASCADE);
+	outb(PIC_MASTER_DATA, PIC_ICW4_8086);
+	outb(PIC_SLAVE_DATA, PIC_ICW4_8086);
+
+	for (irq = 0; irq < NR_IRQS; irq++) {
+		trap_set_gate(IRQ_VECTOR_BASE + irq, (void (*)(void))
+				&irq_entries[irq * IRQ_ENTRY_SIZE]);
+	}
+	trap_set_gate(APIC_SPURIOUS_VECTOR, irq_spurious_entry);
+
+	/* Anything registered before now can be unmasked */
+	flags = irq_save();
+	spin_lock(&irq_lock);
+	irq_ready = 1;
+	irq_set_mask();
+	spin_unlock(&irq_lock);
+	irq_restore(flags);
+}
+
+/**
+ * @irq 8259 line, 0 through NR_IRQS - 1
+ * @handler called with arg each time the line interrupts
+ * @return 1 on success, 0 if the line is invalid or already taken
+ *
+ * May be called before irq_init(), the line is then unmasked once the
+ * controllers are set up.
+ */
+int irq_register(int irq, void (*handler)(void *), void *arg)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	if (irq < 0 || irq >= NR_IRQS || irq == PIC_CASCADE || !handler) {
+		printk("error: irq_register() of invalid irq %d\n", irq);
+		return 0;
+	}
+
+	flags = irq_save();
+	spin_lock(&irq_lock);
+	if (!irq_action[irq].handler) {
+		irq_action[irq].arg = arg;
+		irq_action[irq].handler = handler;
+		irq_mask &= ~(1 << irq);
+		if (irq_ready) {
+			irq_set_mask();
+		}
+		ret = 1;
+	}
+	spin_unlock(&irq_lock);
+	irq_restore(flags);
+
+	if (!ret) {
+		printk("error: irq %d is already registered\n", irq);
+	}
+	return ret;
+}
+
+/* A line dropped before the 8259 could say which shows up as its lowest
+ * priority one, 7 or 15, without the in-service bit set */
+static int irq_spurious(int irq)
+{
+	int cmd = irq < 8 ? PIC_MASTER_CMD : PIC_SLAVE_CMD;
+
+	if ((irq & 7) != 7) {
+		return 0;
+	}
+
+	outb(cmd, PIC_OCW3_READ_ISR);
+	return !(inb(cmd) & 0x80);
+}
+
+/* Called from irq_common in entry.S */
+void do_irq(int irq)
+{
+	struct irq_action *action = &irq_action[irq];
+
+	if (irq_spurious(irq)) {
+		/* The master did take the cascade for a slave spurious */
+		if (irq >= 8) {
+			outb(PIC_MASTER_CMD, PIC_EOI);
+		}
+		return;
+	}
+
+	if (action->handler) {
+		action->handler(action->arg);
+	}
+
+	if (irq >= 8) {
+		outb(PIC_SLAVE_CMD, PIC_EOI);
+	}
+	outb(PIC_MASTER_CMD, PIC_EOI);
+}
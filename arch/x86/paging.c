@@ -0,0 +1,739 @@
+/* paging.c - x86 page table setup */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * Identity maps memory described by the pmap and switches on paging.  Large
+ * pages are used wherever a naturally aligned 4MiB (PSE) or 2MiB (PAE) chunk
+ * of the range being mapped allows, so the direct map needs far fewer TLB
+ * entries and page tables.  Everything else falls back to 4KiB pages.
+ *
+ * PSE is preferred as the 2-level format gets the bigger pages, PAE is only
+ * used on CPUs which have it but lack PSE.  Page 0 is left unmapped so that
+ * NULL dereferences fault.
+ *
+ * Large pages are not written out up front.  The chunks which would get one
+ * are only marked in paging_lazy and paging_fault() installs the directory
+ * entry on first touch, which needs no memory and so is safe from any context
+ * including the page allocator itself.  Anything the fault path depends on,
+ * the kernel image, the GDT and the directories, is populated before paging
+ * is switched on.
+ *
+ * The longest stretch of address space left untouched by the direct map is
+ * handed to mmap() through paging_window(), and paging_map_page() and
+ * paging_unmap_page() maintain 4KiB mappings within it.
+ *
+ * Taking a mapping away only flushes the local TLB.  Anything another CPU
+ * could still reach through its TLB goes through paging_retire_page() and
+ * paging_tlb_shootdown() instead, and is only unmapped for good once every
+ * CPU has been through paging_tlb_sync(), which RCU runs ahead of each
+ * quiescent state.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/malloc.h>
+#include <fmios/paging.h>
+#include <fmios/page.h>
+#include <fmios/smp.h>
+#include <fmios/io.h>
+#include <asm/page.h>
+#include <asm/processor.h>
+#include <asm/traps.h>
+
+#include <string.h>
+
+#include <multiboot.h>
+
+extern unsigned long kernel_start;
+extern unsigned long kernel_end;
+
+#define PAGING_2LEVEL	0
+#define PAGING_PAE	1
+
+/* 2-level directories index 4MiB per entry, PAE directories 2MiB with four
+ * of them hanging off the PDPT */
+#define PD_ENTRIES	1024
+#define PAE_ENTRIES	512
+
+/* Enough chunks to cover 4GiB at the smaller PAE large page size */
+#define PAGING_CHUNKS	(PAE_ENTRIES * 4)
+
+/* The local and I/O APICs sit just below 4GiB and are rarely in the memory
+ * map, so the mmap window stops short of them */
+#define PAGING_WINDOW_END	PAGE_NUM(0xfe000000)
+
+static int paging_mode = PAGING_2LEVEL;
+static unsigned long paging_large = 0;	/* pages per large page, 0 for none */
+static uint32_t paging_global = 0;
+
+static uint32_t *paging_pd = NULL;
+static uint64_t *paging_pdpt = NULL;
+
+/* Chunks of the direct map whose large page is installed on first touch */
+static uint32_t paging_lazy[PAGING_CHUNKS / 32];
+
+/* Pages given over to mmap() */
+static unsigned long paging_window_start = 0;
+static unsigned long paging_window_end = 0;
+
+static struct paging_stats paging_counters;
+
+/* Bumped by paging_tlb_shootdown(), each CPU flushes once it falls behind */
+static volatile uint32_t paging_tlb_gen = 0;
+static uint32_t paging_tlb_seen[NR_CPUS];
+
+static void * paging_table_alloc(void)
+{
+	unsigned long page = page_alloc(1);
+
+	if (!page) {
+		printk("error: out of memory for page tables\n");
+		return NULL;
+	}
+
+	memset(PAGE_ADDR(page), 0, PAGE_SIZE);
+	paging_counters.tables++;
+	return PAGE_ADDR(page);
+}
+
+/* @return non-zero if the whole chunk already has, or will get, a large page */
+static inline int paging_chunk_covered(uint32_t chunk, uint64_t pde)
+{
+	return (pde & PTE_LARGE) ||
+		(paging_lazy[chunk / 32] & (1U << (chunk % 32)));
+}
+
+/* @return the directory entry covering page, NULL if there is none yet */
+static void * paging_pde(uint32_t page)
+{
+	uint64_t *pd;
+
+	if (paging_mode == PAGING_PAE) {
+		uint64_t pdpte = paging_pdpt[page / (PAE_ENTRIES * PAE_ENTRIES)];
+
+		if (!(pdpte & PTE_PRESENT)) {
+			return NULL;
+		}
+		pd = (uint64_t *)(uint32_t)(pdpte & PAGE_MASK);
+		return &pd[(page / PAE_ENTRIES) % PAE_ENTRIES];
+	}
+
+	return &paging_pd[page / PD_ENTRIES];
+}
+
+/**
+ * @addr faulting address
+ * @return 1 if the fault was on a deferred large page which is now mapped
+ */
+int paging_fault(unsigned long addr)
+{
+	uint32_t page = PAGE_NUM(addr);
+	uint32_t chunk, bit;
+	void *pde;
+
+	if (!paging_large) {
+		return 0;
+	}
+
+	chunk = page / paging_large;
+	bit = 1U << (chunk % 32);
+	if (!(paging_lazy[chunk / 32] & bit)) {
+		return 0;
+	}
+
+	/* Not present entries are never cached, so there is nothing to flush */
+	pde = paging_pde(page);
+	page = chunk * paging_large;
+	if (paging_mode == PAGING_PAE) {
+		*(uint64_t *)pde = ((uint64_t)page << PAGE_SHIFT) |
+			PTE_PRESENT | PTE_WRITE | PTE_LARGE | paging_global;
+	} else {
+		*(uint32_t *)pde = (page << PAGE_SHIFT) | PTE_PRESENT |
+			PTE_WRITE | PTE_LARGE | paging_global;
+	}
+
+	paging_lazy[chunk / 32] &= ~bit;
+	paging_counters.lazy_pages--;
+	paging_counters.large_pages++;
+	return 1;
+}
+
+static int paging_map_2level(uint32_t page, uint32_t last)
+{
+	while (page <= last) {
+		uint32_t *pde = &paging_pd[page / PD_ENTRIES];
+		uint32_t *pt;
+
+		if (paging_chunk_covered(page / PD_ENTRIES, *pde)) {
+			page = (page | (PD_ENTRIES - 1)) + 1;
+			continue;
+		}
+
+		if (paging_large && !(page % PD_ENTRIES) &&
+		    last - page >= PD_ENTRIES - 1 && !(*pde & PTE_PRESENT)) {
+			paging_lazy[page / PD_ENTRIES / 32] |=
+				1U << ((page / PD_ENTRIES) % 32);
+			paging_counters.lazy_pages++;
+			page += PD_ENTRIES;
+			continue;
+		}
+
+		if (!(*pde & PTE_PRESENT)) {
+			pt = paging_table_alloc();
+			if (!pt) {
+				return 0;
+			}
+			*pde = (uint32_t)pt | PTE_PRESENT | PTE_WRITE;
+		}
+
+		pt = (uint32_t *)(*pde & PAGE_MASK);
+		if (!(pt[page % PD_ENTRIES] & PTE_PRESENT)) {
+			pt[page % PD_ENTRIES] = (page << PAGE_SHIFT) |
+				PTE_PRESENT | PTE_WRITE | paging_global;
+			paging_counters.small_pages++;
+		}
+		page++;
+	}
+
+	return 1;
+}
+
+static int paging_map_pae(uint32_t page, uint32_t last)
+{
+	while (page <= last) {
+		uint64_t *pdpte = &paging_pdpt[page / (PAE_ENTRIES * PAE_ENTRIES)];
+		uint64_t *pd, *pde, *pt;
+
+		/* PDPT entries take no permission bits in legacy PAE mode */
+		if (!(*pdpte & PTE_PRESENT)) {
+			pd = paging_table_alloc();
+			if (!pd) {
+				return 0;
+			}
+			*pdpte = (uint32_t)pd | PTE_PRESENT;
+		}
+
+		pd = (uint64_t *)(uint32_t)(*pdpte & PAGE_MASK);
+		pde = &pd[(page / PAE_ENTRIES) % PAE_ENTRIES];
+
+		if (paging_chunk_covered(page / PAE_ENTRIES, *pde)) {
+			page = (page | (PAE_ENTRIES - 1)) + 1;
+			continue;
+		}
+
+		if (paging_large && !(page % PAE_ENTRIES) &&
+		    last - page >= PAE_ENTRIES - 1 && !(*pde & PTE_PRESENT)) {
+			paging_lazy[page / PAE_ENTRIES / 32] |=
+				1U << ((page / PAE_ENTRIES) % 32);
+			paging_counters.lazy_pages++;
+			page += PAE_ENTRIES;
+			continue;
+		}
+
+		if (!(*pde & PTE_PRESENT)) {
+			pt = paging_table_alloc();
+			if (!pt) {
+				return 0;
+			}
+			*pde = (uint32_t)pt | PTE_PRESENT | PTE_WRITE;
+		}
+
+		pt = (uint64_t *)(uint32_t)(*pde & PAGE_MASK);
+		if (!(pt[page % PAE_ENTRIES] & PTE_PRESENT)) {
+			pt[page % PAE_ENTRIES] = ((uint64_t)page << PAGE_SHIFT) |
+				PTE_PRESENT | PTE_WRITE | paging_global;
+			paging_counters.small_pages++;
+		}
+		page++;
+	}
+
+	return 1;
+}
+
+/* Identity map the pages first through last, inclusive */
+static int paging_map(uint32_t first, uint32_t last)
+{
+	if (!first) {
+		first++;
+	}
+	if (first > last) {
+		return 1;
+	}
+
+#ifdef CONFIG_ENABLE_DEBUG
+	printk("paging_map: start=0x%x, end=0x%x\n", first, last);
+#endif
+
+	if (paging_mode == PAGING_PAE) {
+		return paging_map_pae(first, last);
+	}
+	return paging_map_2level(first, last);
+}
+
+static void paging_detect(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (!cpu_has_cpuid()) {
+		return;
+	}
+
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax < 1) {
+		return;
+	}
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+
+	if (edx & X86_FEATURE_PSE) {
+		paging_large = PD_ENTRIES;
+	} else if (edx & X86_FEATURE_PAE) {
+		paging_mode = PAGING_PAE;
+		paging_large = PAE_ENTRIES;
+	}
+
+	if (edx & X86_FEATURE_PGE) {
+		paging_global = PTE_GLOBAL;
+	}
+}
+
+/* Install the deferred large page covering the given range now */
+static void paging_populate(unsigned long addr, unsigned long len)
+{
+	unsigned long page;
+
+	if (!paging_large || !len) {
+		return;
+	}
+
+	for (page = PAGE_NUM(addr) & ~(paging_large - 1);
+	     page <= PAGE_NUM(addr + len - 1); page += paging_large) {
+		paging_fault((unsigned long)PAGE_ADDR(page));
+	}
+}
+
+/* Find the longest run of chunks the direct map never touches */
+static void paging_window_find(void)
+{
+	unsigned long chunk_pages = paging_large ? paging_large : PD_ENTRIES;
+	unsigned long chunks = PAGING_WINDOW_END / chunk_pages;
+	unsigned long chunk, run = 0, best = 0, best_end = 0;
+
+	/* Chunk 0 always holds the legacy area */
+	for (chunk = 1; chunk < chunks; chunk++) {
+		uint64_t pde = 0;
+		void *entry = paging_pde(chunk * chunk_pages);
+
+		if (entry) {
+			pde = (paging_mode == PAGING_PAE) ?
+				*(uint64_t *)entry : *(uint32_t *)entry;
+		}
+
+		if ((pde & PTE_PRESENT) ||
+		    (paging_lazy[chunk / 32] & (1U << (chunk % 32)))) {
+			run = 0;
+			continue;
+		}
+
+		if (++run > best) {
+			best = run;
+			best_end = chunk + 1;
+		}
+	}
+
+	paging_window_start = (best_end - best) * chunk_pages;
+	paging_window_end = best_end * chunk_pages;
+}
+
+/**
+ * @start set to the first page of the mmap() window
+ * @end set to the page following the window
+ */
+void paging_window(unsigned long *start, unsigned long *end)
+{
+	*start = paging_window_start;
+	*end = paging_window_end;
+}
+
+/**
+ * @addr page aligned virtual address within the mmap() window
+ * @page physical page to map there
+ * @flags PAGING_WRITE, PAGING_USER and/or PAGING_NOCACHE
+ * @return 1 on success, 0 if no page table could be allocated
+ */
+int paging_map_page(unsigned long addr, unsigned long page, int flags)
+{
+	uint32_t pte = PTE_PRESENT;
+	void *pde;
+	void *pt;
+
+	if (flags & PAGING_WRITE) {
+		pte |= PTE_WRITE;
+	}
+	if (flags & PAGING_USER) {
+		pte |= PTE_USER;
+	}
+	if (flags & PAGING_NOCACHE) {
+		pte |= PTE_PCD | PTE_PWT;
+	}
+
+	/* A PAE directory is missing only if the window starts in a new GiB */
+	pde = paging_pde(PAGE_NUM(addr));
+	if (!pde) {
+		uint64_t *pdpte = &paging_pdpt[PAGE_NUM(addr) /
+			(PAE_ENTRIES * PAE_ENTRIES)];
+
+		pt = paging_table_alloc();
+		if (!pt) {
+			return 0;
+		}
+		*pdpte = (uint32_t)pt | PTE_PRESENT;
+		pde = paging_pde(PAGE_NUM(addr));
+
+		/* The CPU only reads the PDPT when CR3 is loaded */
+		write_cr3(read_cr3());
+	}
+
+	if (paging_mode == PAGING_PAE) {
+		uint64_t *entry = pde;
+
+		if (!(*entry & PTE_PRESENT)) {
+			pt = paging_table_alloc();
+			if (!pt) {
+				return 0;
+			}
+			*entry = (uint32_t)pt | PTE_PRESENT | PTE_WRITE | PTE_USER;
+		}
+		pt = (void *)(uint32_t)(*entry & PAGE_MASK);
+		((uint64_t *)pt)[PAGE_NUM(addr) % PAE_ENTRIES] =
+			((uint64_t)page << PAGE_SHIFT) | pte;
+	} else {
+		uint32_t *entry = pde;
+
+		if (!(*entry & PTE_PRESENT)) {
+			pt = paging_table_alloc();
+			if (!pt) {
+				return 0;
+			}
+			*entry = (uint32_t)pt | PTE_PRESENT | PTE_WRITE | PTE_USER;
+		}
+		pt = (void *)(*entry & PAGE_MASK);
+		((uint32_t *)pt)[PAGE_NUM(addr) % PD_ENTRIES] =
+			(page << PAGE_SHIFT) | pte;
+	}
+
+	return 1;
+}
+
+/**
+ * @addr page aligned virtual address within the mmap() window
+ * @return the physical page which was mapped, or retired, there, 0 if there
+ * was none
+ */
+unsigned long paging_unmap_page(unsigned long addr)
+{
+	unsigned long page = 0;
+	void *pde = paging_pde(PAGE_NUM(addr));
+
+	if (!pde) {
+		return 0;
+	}
+
+	if (paging_mode == PAGING_PAE) {
+		uint64_t *pt;
+
+		if (!(*(uint64_t *)pde & PTE_PRESENT)) {
+			return 0;
+		}
+		pt = (uint64_t *)(uint32_t)(*(uint64_t *)pde & PAGE_MASK);
+		pt += PAGE_NUM(addr) % PAE_ENTRIES;
+		if (*pt & (PTE_PRESENT | PTE_RETIRED)) {
+			page = (uint32_t)(*pt >> PAGE_SHIFT);
+		}
+		*pt = 0;
+	} else {
+		uint32_t *pt;
+
+		if (!(*(uint32_t *)pde & PTE_PRESENT)) {
+			return 0;
+		}
+		pt = (uint32_t *)(*(uint32_t *)pde & PAGE_MASK);
+		pt += PAGE_NUM(addr) % PD_ENTRIES;
+		if (*pt & (PTE_PRESENT | PTE_RETIRED)) {
+			page = *pt >> PAGE_SHIFT;
+		}
+		*pt = 0;
+	}
+
+	if (page) {
+		invlpg(addr);
+	}
+	return page;
+}
+
+/**
+ * Take a page away from every CPU but hold on to its frame, which
+ * paging_unmap_page() hands back once paging_tlb_shootdown() has been
+ * followed by a grace period.
+ *
+ * @addr page aligned virtual address within the mmap() window
+ * @return 1 if a page was mapped there
+ */
+int paging_retire_page(unsigned long addr)
+{
+	void *pde = paging_pde(PAGE_NUM(addr));
+
+	if (!pde) {
+		return 0;
+	}
+
+	if (paging_mode == PAGING_PAE) {
+		uint64_t *pt;
+
+		if (!(*(uint64_t *)pde & PTE_PRESENT)) {
+			return 0;
+		}
+		pt = (uint64_t *)(uint32_t)(*(uint64_t *)pde & PAGE_MASK);
+		pt += PAGE_NUM(addr) % PAE_ENTRIES;
+		if (!(*pt & PTE_PRESENT)) {
+			return 0;
+		}
+		*pt = (*pt & ~(uint64_t)PTE_PRESENT) | PTE_RETIRED;
+	} else {
+		uint32_t *pt;
+
+		if (!(*(uint32_t *)pde & PTE_PRESENT)) {
+			return 0;
+		}
+		pt = (uint32_t *)(*(uint32_t *)pde & PAGE_MASK);
+		pt += PAGE_NUM(addr) % PD_ENTRIES;
+		if (!(*pt & PTE_PRESENT)) {
+			return 0;
+		}
+		*pt = (*pt & ~PTE_PRESENT) | PTE_RETIRED;
+	}
+
+	invlpg(addr);
+	return 1;
+}
+
+/* Have every CPU flush its TLB before its next quiescent state */
+void paging_tlb_shootdown(void)
+{
+	atomic_inc(&paging_tlb_gen);
+}
+
+/* Flush the TLB if a shootdown happened since the last call on this CPU,
+ * called with interrupts disabled */
+void paging_tlb_sync(void)
+{
+	uint32_t gen = atomic_load(&paging_tlb_gen, ATOMIC_ACQUIRE);
+	int cpu = cpu_id();
+
+	if (paging_tlb_seen[cpu] != gen) {
+		paging_tlb_seen[cpu] = gen;
+		write_cr3(read_cr3());
+	}
+}
+
+/* @return non-zero if page is mapped, populating a deferred large page */
+static int paging_mapped(uint32_t page)
+{
+	void *pde = paging_pde(page);
+	uint64_t entry;
+
+	if (!pde) {
+		return 0;
+	}
+
+	if (paging_fault(page << PAGE_SHIFT)) {
+		return 1;
+	}
+
+	if (paging_mode == PAGING_PAE) {
+		entry = *(uint64_t *)pde;
+	} else {
+		entry = *(uint32_t *)pde;
+	}
+	if (!(entry & PTE_PRESENT)) {
+		return 0;
+	}
+	if (entry & PTE_LARGE) {
+		return 1;
+	}
+
+	if (paging_mode == PAGING_PAE) {
+		uint64_t *pt = (uint64_t *)(uint32_t)(entry & PAGE_MASK);
+		return pt[page % PAE_ENTRIES] & PTE_PRESENT;
+	}
+	return ((uint32_t *)(uint32_t)(entry & PAGE_MASK))[page % PD_ENTRIES] &
+		PTE_PRESENT;
+}
+
+/**
+ * @addr physical address of device memory or firmware tables
+ * @len length in bytes
+ * @return 1 once the range is identity mapped, 0 on failure
+ *
+ * Pages already in the direct map are left as they are, anything else is
+ * mapped uncached.
+ */
+int paging_map_io(unsigned long addr, unsigned long len)
+{
+	uint32_t page = PAGE_NUM(addr);
+	uint32_t last = PAGE_NUM(addr + len - 1);
+
+	if (!len) {
+		return 1;
+	}
+
+	for (; page <= last; page++) {
+		if (paging_mapped(page)) {
+			continue;
+		}
+		if (!paging_map_page(page << PAGE_SHIFT, page,
+				PAGING_WRITE | PAGING_NOCACHE)) {
+			printk("error: paging_map_io() out of page tables\n");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @pmap the memory map built by init_malloc()
+ * @return 1 once paging is enabled, 0 on failure
+ *
+ * Every pmap entry other than bad RAM is mapped, as is the legacy area below
+ * 1MiB and any framebuffer.  Neighbouring entries are mapped as one range so
+ * the splits made for the kernel and modules do not cost large pages.
+ */
+int init_paging(struct pmap_table *pmap)
+{
+	struct pmap_entry *entry = pmap->entry;
+	struct gdt_ptr gdt;
+	unsigned long cr4;
+	uint32_t start = 0, end = 0;
+	int mapping = 0;
+	int index;
+
+	paging_detect();
+	traps_init();
+
+	if (paging_mode == PAGING_PAE) {
+		paging_pdpt = paging_table_alloc();
+		if (!paging_pdpt) {
+			return 0;
+		}
+	} else {
+		paging_pd = paging_table_alloc();
+		if (!paging_pd) {
+			return 0;
+		}
+	}
+
+	for (index = 0; index < pmap->count; index++) {
+		if (entry[index].type == MULTIBOOT_MEMORY_BADRAM) {
+			continue;
+		}
+
+		if (mapping && entry[index].start == end + 1) {
+			end = entry[index].end;
+			continue;
+		}
+
+		if (mapping && !paging_map(start, end)) {
+			return 0;
+		}
+		start = entry[index].start;
+		end = entry[index].end;
+		mapping = 1;
+	}
+	if (mapping && !paging_map(start, end)) {
+		return 0;
+	}
+
+	/* Legacy video memory and the BIOS areas are often missing from the
+	 * memory map altogether */
+	if (!paging_map(0, PAGE_NUM(0x100000) - 1)) {
+		return 0;
+	}
+
+	if (mb_fb_type() && mb_fb_addr() < 0x100000000ULL) {
+		unsigned long addr = mb_fb_addr();
+		unsigned long len = mb_fb_pitch() * mb_fb_height();
+
+		if (len && !paging_map(PAGE_NUM(addr),
+					PAGE_NUM(addr + len - 1))) {
+			return 0;
+		}
+	}
+
+	paging_window_find();
+
+	/* Everything the fault path touches has to be there from the start */
+	paging_populate(kernel_start, kernel_end - kernel_start);
+	__asm__ __volatile__("sgdt %0" : "=m" (gdt));
+	paging_populate(gdt.base, gdt.limit + 1);
+	if (paging_mode == PAGING_PAE) {
+		paging_populate((unsigned long)paging_pdpt, PAGE_SIZE);
+		for (index = 0; index < 4; index++) {
+			if (paging_pdpt[index] & PTE_PRESENT) {
+				paging_populate(paging_pdpt[index] & PAGE_MASK,
+						PAGE_SIZE);
+			}
+		}
+	} else {
+		paging_populate((unsigned long)paging_pd, PAGE_SIZE);
+	}
+
+	cr4 = read_cr4();
+	if (paging_mode == PAGING_PAE) {
+		cr4 |= X86_CR4_PAE;
+		write_cr3((unsigned long)paging_pdpt);
+	} else {
+		if (paging_large) {
+			cr4 |= X86_CR4_PSE;
+		}
+		write_cr3((unsigned long)paging_pd);
+	}
+	if (paging_global) {
+		cr4 |= X86_CR4_PGE;
+	}
+	write_cr4(cr4);
+	write_cr0(read_cr0() | X86_CR0_PG | X86_CR0_WP);
+
+	paging_counters.large_size = paging_large * PAGE_SIZE;
+	printk("paging: %s, %d large (%dKiB, %d deferred) and %d small pages "
+			"in %d tables\n",
+			paging_mode == PAGING_PAE ? "PAE" : "2-level",
+			paging_counters.large_pages + paging_counters.lazy_pages,
+			paging_counters.large_size / 1024,
+			paging_counters.lazy_pages,
+			paging_counters.small_pages, paging_counters.tables);
+
+	return 1;
+}
+
+void paging_stats(struct paging_stats *stats)
+{
+	*stats = paging_counters;
+}
@@ -0,0 +1,536 @@
+/* smp.c - Application processor start up */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * The other CPUs are found in the ACPI MADT, or failing that the Intel MP
+ * configuration table, and started one at a time with INIT and startup IPIs.
+ * A startup IPI can only enter real mode at the start of a page below 1MiB,
+ * so smp_reserve() sets one aside while bootmem is still around and the code
+ * in trampoline.S is copied there.  Each CPU gets a stack of its own, which
+ * becomes its idle task, before it is sent the IPIs.
+ *
+ * Nothing is calibrated against a timer yet, so the delays lean on the ISA
+ * port 0x80 write taking about a microsecond and start up times are reported
+ * in TSC cycles.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/malloc.h>
+#include <fmios/page.h>
+#include <fmios/paging.h>
+#include <fmios/sched.h>
+#include <fmios/smp.h>
+#include <fmios/io.h>
+#include <asm/apic.h>
+#include <asm/io.h>
+#include <asm/processor.h>
+#include <asm/traps.h>
+
+#include <string.h>
+
+#include <multiboot.h>
+
+/* How long to wait for a CPU to check in, in microseconds */
+#define SMP_TIMEOUT		1000000
+
+/* smp_ap_state, how far the CPU being started has got */
+#define SMP_AP_WAITING		0	/* not reached smp_ap_entry() yet */
+#define SMP_AP_ENTERED		1	/* setting itself up */
+#define SMP_AP_READY		2	/* up and scheduling */
+#define SMP_AP_ABANDONED	3	/* timed out, must never start */
+
+/* 16-bit words in the BIOS data area */
+#define BDA_EBDA		0x07	/* segment of the extended BDA */
+#define BDA_BASE_KB		0x09	/* KiB of base memory */
+
+/* MADT entry types */
+#define MADT_LAPIC		0
+#define MADT_LAPIC_OVERRIDE	5
+#define MADT_LAPIC_ENABLED	0x01
+
+/* MP configuration table entry types and sizes */
+#define MP_PROCESSOR		0
+#define MP_PROCESSOR_SIZE	20
+#define MP_ENTRY_SIZE		8
+#define MP_PROCESSOR_ENABLED	0x01
+
+struct acpi_rsdp {
+	char		signature[8];
+	uint8_t		checksum;
+	char		oem[6];
+	uint8_t		revision;
+	uint32_t	rsdt;
+	uint32_t	length;		/* revision 2 onwards */
+	uint64_t	xsdt;
+	uint8_t		xchecksum;
+	uint8_t		reserved[3];
+} __attribute__((packed));
+
+struct acpi_header {
+	char		signature[4];
+	uint32_t	length;
+	uint8_t		revision;
+	uint8_t		checksum;
+	char		oem[6];
+	char		oem_table[8];
+	uint32_t	oem_revision;
+	uint32_t	creator;
+	uint32_t	creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt {
+	struct acpi_header	header;
+	uint32_t		apic_base;
+	uint32_t		flags;
+	uint8_t			entries[0];
+} __attribute__((packed));
+
+struct mp_floating {
+	char		signature[4];
+	uint32_t	config;
+	uint8_t		length;		/* in 16 byte units */
+	uint8_t		revision;
+	uint8_t		checksum;
+	uint8_t		features[5];
+} __attribute__((packed));
+
+struct mp_config {
+	char		signature[4];
+	uint16_t	length;
+	uint8_t		revision;
+	uint8_t		checksum;
+	char		oem[8];
+	char		product[12];
+	uint32_t	oem_table;
+	uint16_t	oem_length;
+	uint16_t	entries;
+	uint32_t	apic_base;
+	uint16_t	ext_length;
+	uint8_t		ext_checksum;
+	uint8_t		reserved;
+} __attribute__((packed));
+
+/* Parameter block at the end of trampoline.S */
+struct trampoline_params {
+	uint16_t	gdt_limit;
+	uint32_t	gdt_base;
+	uint32_t	entry32;
+	uint16_t	cs;
+	uint32_t	cr3;
+	uint32_t	cr4;
+	uint32_t	stack;
+	uint32_t	cpu;
+	uint32_t	entry;
+} __attribute__((packed));
+
+extern char trampoline_start[];
+extern char trampoline_32[];
+extern char trampoline_gdt[];
+extern char trampoline_params[];
+extern char trampoline_end[];
+
+unsigned long apic_base = APIC_DEFAULT_BASE;
+
+/* Volatile so the compiler does not treat it as a stray NULL dereference */
+static uint16_t * volatile smp_bda = (uint16_t *)0x400;
+
+static uint32_t smp_apic_ids[NR_CPUS];
+static int smp_apic_count = 0;
+static unsigned long smp_trampoline = 0;	/* page number */
+static int smp_cpu_count = 1;
+static int smp_ap_state = SMP_AP_WAITING;
+
+static void smp_udelay(unsigned long usec)
+{
+	while (usec--) {
+		outb(0x80, 0);
+	}
+}
+
+static int smp_checksum(const void *addr, unsigned long len)
+{
+	const uint8_t *byte = addr;
+	uint8_t sum = 0;
+
+	while (len--) {
+		sum += *byte++;
+	}
+	return sum == 0;
+}
+
+/* @return the first checksummed 16 byte aligned match for signature */
+static void * smp_scan(unsigned long addr, unsigned long len,
+		const char *signature, int siglen, int sumlen)
+{
+	unsigned long end = addr + len;
+
+	for (addr &= ~15UL; addr + sumlen <= end; addr += 16) {
+		if (!memcmp((void *)addr, signature, siglen) &&
+		    smp_checksum((void *)addr, sumlen)) {
+			return (void *)addr;
+		}
+	}
+	return NULL;
+}
+
+/* The extended BIOS data area, then the BIOS itself */
+static void * smp_scan_bios(const char *signature, int siglen, int sumlen)
+{
+	unsigned long ebda = smp_bda[BDA_EBDA] << 4;
+	unsigned long base = smp_bda[BDA_BASE_KB] * 1024;
+	void *found = NULL;
+
+	if (ebda) {
+		found = smp_scan(ebda, 1024, signature, siglen, sumlen);
+	}
+	if (!found && base) {
+		found = smp_scan(base - 1024, 1024, signature, siglen, sumlen);
+	}
+	if (!found) {
+		found = smp_scan(0xe0000, 0x20000, signature, siglen, sumlen);
+	}
+	return found;
+}
+
+static void smp_add_cpu(uint32_t apic)
+{
+	if (smp_apic_count == NR_CPUS) {
+		printk("smp: ignoring cpu with apic id %d\n", apic);
+		return;
+	}
+	smp_apic_ids[smp_apic_count++] = apic;
+}
+
+/* @return the mapped and checksummed table at addr, NULL if it is not one */
+static struct acpi_header * smp_acpi_table(unsigned long addr,
+		const char *signature)
+{
+	struct acpi_header *table = (struct acpi_header *)addr;
+
+	if (!addr || !paging_map_io(addr, sizeof(*table))) {
+		return NULL;
+	}
+	if (memcmp(table->signature, signature, 4)) {
+		return NULL;
+	}
+	if (!paging_map_io(addr, table->length) ||
+	    !smp_checksum(table, table->length)) {
+		return NULL;
+	}
+	return table;
+}
+
+static struct acpi_madt * smp_acpi_madt(void)
+{
+	struct acpi_rsdp *rsdp = mb_acpi_rsdp();
+	struct acpi_header *root;
+	struct acpi_header *table;
+	unsigned long count, index;
+	int xsdt = 0;
+
+	if (!rsdp) {
+		rsdp = smp_scan_bios("RSD PTR ", 8, 20);
+	}
+	if (!rsdp) {
+		return NULL;
+	}
+
+	if (rsdp->revision >= 2 && rsdp->xsdt && !(rsdp->xsdt >> 32)) {
+		root = smp_acpi_table((uint32_t)rsdp->xsdt, "XSDT");
+		xsdt = 1;
+	} else {
+		root = smp_acpi_table(rsdp->rsdt, "RSDT");
+	}
+	if (!root) {
+		return NULL;
+	}
+
+	count = (root->length - sizeof(*root)) / (xsdt ? 8 : 4);
+	for (index = 0; index < count; index++) {
+		uint64_t addr;
+
+		if (xsdt) {
+			addr = ((uint64_t *)(root + 1))[index];
+		} else {
+			addr = ((uint32_t *)(root + 1))[index];
+		}
+		if (addr >> 32) {
+			continue;
+		}
+
+		table = smp_acpi_table((uint32_t)addr, "APIC");
+		if (table) {
+			return (struct acpi_madt *)table;
+		}
+	}
+
+	return NULL;
+}
+
+static int smp_parse_madt(void)
+{
+	struct acpi_madt *madt = smp_acpi_madt();
+	uint8_t *entry, *end;
+
+	if (!madt) {
+		return 0;
+	}
+
+	apic_base = madt->apic_base;
+	end = (uint8_t *)madt + madt->header.length;
+	for (entry = madt->entries; entry + 2 <= end && entry[1] >= 2;
+			entry += entry[1]) {
+		switch (entry[0]) {
+		case MADT_LAPIC:
+			/* acpi processor id, apic id, 32bit flags */
+			if (entry[1] >= 8 &&
+			    (*(uint32_t *)&entry[4] & MADT_LAPIC_ENABLED)) {
+				smp_add_cpu(entry[3]);
+			}
+			break;
+		case MADT_LAPIC_OVERRIDE:
+			if (entry[1] >= 12 && !(*(uint64_t *)&entry[4] >> 32)) {
+				apic_base = *(uint32_t *)&entry[4];
+			}
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static int smp_parse_mp(void)
+{
+	struct mp_floating *mpf;
+	struct mp_config *config;
+	uint8_t *entry;
+	int index;
+
+	mpf = smp_scan_bios("_MP_", 4, sizeof(struct mp_floating));
+	if (!mpf) {
+		return 0;
+	}
+
+	if (mpf->features[0] || !mpf->config) {
+		printk("smp: default MP configurations are not supported\n");
+		return 0;
+	}
+
+	config = (struct mp_config *)mpf->config;
+	if (!paging_map_io(mpf->config, sizeof(*config)) ||
+	    memcmp(config->signature, "PCMP", 4) ||
+	    !paging_map_io(mpf->config, config->length) ||
+	    !smp_checksum(config, config->length)) {
+		printk("error: bad MP configuration table\n");
+		return 0;
+	}
+
+	apic_base = config->apic_base;
+	entry = (uint8_t *)(config + 1);
+	for (index = 0; index < config->entries; index++) {
+		if (entry[0] != MP_PROCESSOR) {
+			entry += MP_ENTRY_SIZE;
+			continue;
+		}
+		/* type, apic id, apic version, flags */
+		if (entry[3] & MP_PROCESSOR_ENABLED) {
+			smp_add_cpu(entry[1]);
+		}
+		entry += MP_PROCESSOR_SIZE;
+	}
+
+	return 1;
+}
+
+static void smp_send_ipi(uint32_t apic, uint32_t command)
+{
+	apic_write(APIC_ICR_HIGH, apic << 24);
+	apic_write(APIC_ICR_LOW, command);
+	while (apic_read(APIC_ICR_LOW) & APIC_ICR_BUSY) {
+		cpu_relax();
+	}
+}
+
+/* Where trampoline.S lands once paging is on, running on the new stack */
+static void smp_ap_entry(int cpu)
+{
+	/* Too late, the boot processor gave up on us and may already have
+	 * handed our CPU number to another.  Wait for the INIT it sends. */
+	if (atomic_cmpxchg(&smp_ap_state, SMP_AP_WAITING, SMP_AP_ENTERED,
+			ATOMIC_ACQUIRE) != SMP_AP_WAITING) {
+		for (;;) {
+			cpu_relax();
+		}
+	}
+
+	cpu_init(cpu, cpu_data[cpu].stack);
+	traps_cpu_init();
+	apic_write(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+	sched_cpu_init();
+
+	atomic_store(&smp_ap_state, SMP_AP_READY, ATOMIC_RELEASE);
+
+	sched_idle_forever();
+}
+
+/* @return 1 if the CPU checked in before the timeout */
+static int smp_start_cpu(int cpu, uint32_t apic)
+{
+	struct trampoline_params *params = (struct trampoline_params *)
+		((char *)PAGE_ADDR(smp_trampoline) +
+		 (trampoline_params - trampoline_start));
+	unsigned long stack;
+	uint64_t start, cycles;
+	long timeout;
+	int sipi;
+
+	stack = page_alloc(TASK_STACK_PAGES);
+	if (!stack) {
+		printk("error: no stack for cpu%d\n", cpu);
+		return 0;
+	}
+
+	/* Populate the direct map now, the CPU has no IDT until it is running */
+	memset(PAGE_ADDR(stack), 0, TASK_STACK_PAGES * PAGE_SIZE);
+
+	cpu_data[cpu].apic_id = apic;
+	cpu_data[cpu].stack = (unsigned long)PAGE_ADDR(stack) +
+		TASK_STACK_PAGES * PAGE_SIZE;
+	params->stack = cpu_data[cpu].stack;
+	params->cpu = cpu;
+	atomic_store(&smp_ap_state, SMP_AP_WAITING, ATOMIC_SEQ_CST);
+
+	start = rdtsc();
+	smp_send_ipi(apic, APIC_ICR_INIT | APIC_ICR_ASSERT | APIC_ICR_LEVEL);
+	smp_send_ipi(apic, APIC_ICR_INIT | APIC_ICR_LEVEL);
+	smp_udelay(10000);
+
+	for (sipi = 0; sipi < 2; sipi++) {
+		if (atomic_load(&smp_ap_state, ATOMIC_ACQUIRE) !=
+				SMP_AP_WAITING) {
+			break;
+		}
+		smp_send_ipi(apic, APIC_ICR_STARTUP | smp_trampoline);
+		smp_udelay(200);
+	}
+
+	for (timeout = SMP_TIMEOUT; timeout > 0; timeout -= 10) {
+		if (atomic_load(&smp_ap_state, ATOMIC_ACQUIRE) ==
+				SMP_AP_READY) {
+			break;
+		}
+		smp_udelay(10);
+	}
+
+	/* Once it has got as far as setting itself up there is no stopping
+	 * it, so see it through */
+	if (atomic_cmpxchg(&smp_ap_state, SMP_AP_WAITING, SMP_AP_ABANDONED,
+			ATOMIC_SEQ_CST) == SMP_AP_WAITING) {
+		/* A startup IPI may still be on its way and a late CPU would
+		 * run on this stack, so park it with INIT and leak the stack
+		 * rather than free it.  It never reaches the point of taking
+		 * this CPU number, so the next CPU is free to. */
+		smp_send_ipi(apic, APIC_ICR_INIT | APIC_ICR_ASSERT |
+				APIC_ICR_LEVEL);
+		smp_send_ipi(apic, APIC_ICR_INIT | APIC_ICR_LEVEL);
+		cpu_data[cpu].stack = 0;
+		printk("error: cpu%d (apic %d) did not start\n", cpu, apic);
+		return 0;
+	}
+	while (atomic_load(&smp_ap_state, ATOMIC_ACQUIRE) != SMP_AP_READY) {
+		cpu_relax();
+	}
+	cycles = rdtsc() - start;
+
+	printk("smp: cpu%d (apic %d) up in %u cycles\n", cpu, apic,
+			(uint32_t)cycles);
+	return 1;
+}
+
+/* Set aside the real mode entry page while bootmem can still hand it out */
+void smp_reserve(void)
+{
+	smp_trampoline = bootmem_alloc_low(1);
+	if (!smp_trampoline) {
+		printk("error: no low memory for the smp trampoline\n");
+	}
+}
+
+/**
+ * Find and start every other CPU.  Called once the scheduler is up on the
+ * boot processor, each CPU joins it as soon as it is running.
+ */
+void init_smp(void)
+{
+	struct trampoline_params *params;
+	uint32_t eax, ebx, ecx, edx;
+	unsigned long base;
+	int index;
+
+	if (!smp_trampoline || !cpu_has_cpuid()) {
+		return;
+	}
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & X86_FEATURE_APIC)) {
+		return;
+	}
+
+	if (!smp_parse_madt() && !smp_parse_mp()) {
+		printk("smp: no MADT or MP table, running on one cpu\n");
+		return;
+	}
+
+	if (!paging_map_io(apic_base, APIC_SIZE)) {
+		return;
+	}
+	cpu_data[0].apic_id = apic_id();
+	apic_write(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+	base = (unsigned long)PAGE_ADDR(smp_trampoline);
+	memcpy((void *)base, trampoline_start, trampoline_end - trampoline_start);
+	params = (struct trampoline_params *)
+		(base + (trampoline_params - trampoline_start));
+	params->gdt_base = base + (trampoline_gdt - trampoline_start);
+	params->entry32 = base + (trampoline_32 - trampoline_start);
+	params->cr3 = read_cr3();
+	params->cr4 = read_cr4();
+	params->entry = (uint32_t)smp_ap_entry;
+
+	for (index = 0; index < smp_apic_count; index++) {
+		if (smp_apic_ids[index] == cpu_data[0].apic_id) {
+			continue;
+		}
+		if (smp_cpu_count == NR_CPUS) {
+			break;
+		}
+		if (smp_start_cpu(smp_cpu_count, smp_apic_ids[index])) {
+			smp_cpu_count++;
+		}
+	}
+
+	printk("smp: %d of %d cpus up\n", smp_cpu_count, smp_apic_count);
+}
+
+int smp_cpus(void)
+{
+	return smp_cpu_count;
+}
@@ -0,0 +1,151 @@
+/* syscall.c - x86 syscall entry setup */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * Syscalls come in through either int $0x80 or sysenter, both land in
+ * syscall_dispatch().  sysenter skips the IDT and the stack switch through
+ * the TSS, which makes it the fast path wherever the CPU has it.
+ */
+#include <fmios/fmios.h>
+#include <fmios/malloc.h>
+#include <fmios/page.h>
+#include <fmios/smp.h>
+#include <fmios/syscall.h>
+#include <fmios/io.h>
+#include <asm/desc.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+#include <asm/syscall.h>
+#include <asm/traps.h>
+
+#include <string.h>
+
+extern void sysenter_entry(void);
+
+static int syscall_sysenter = 0;
+
+/* Point this CPU's sysenter at sysenter_entry, if it has one */
+void syscall_cpu_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (!cpu_has_cpuid()) {
+		return;
+	}
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & X86_FEATURE_SEP)) {
+		return;
+	}
+
+	/* The stub loads the real stack pointer from tss.esp0 */
+	wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CS);
+	wrmsr(MSR_SYSENTER_ESP, (uint32_t)&this_cpu()->tss->esp0);
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+	syscall_sysenter = 1;
+}
+
+static inline long syscall_int(unsigned long nr)
+{
+	long ret;
+
+	__asm__ __volatile__(
+		"int %2\n\t"
+		: "=a" (ret)
+		: "a" (nr), "i" (TRAP_SYSCALL)
+		: "ecx", "edx", "memory");
+	return ret;
+}
+
+/* Only for ring 0 callers with cpu_data.sysenter_kernel set */
+static inline long syscall_sysenter_kernel(unsigned long nr)
+{
+	long ret;
+
+	__asm__ __volatile__(
+		"movl %%esp, %%ecx\n\t"
+		"movl $1f, %%edx\n\t"
+		"sysenter\n"
+		"1:\n\t"
+		: "=a" (ret)
+		: "a" (nr)
+		: "ecx", "edx", "memory");
+	return ret;
+}
+
+/**
+ * @iterations null syscalls to time each way
+ *
+ * Time SYS_NULL round trips through int $0x80 and through sysenter.  There
+ * is no ring 3 yet, so both are made from ring 0: the int path skips the
+ * stack switch and sysenter comes back with a jump rather than sysexit.
+ */
+void syscall_bench(int iterations)
+{
+	struct cpu_data *cpu = this_cpu();
+	uint64_t start, int_cycles, fast_cycles = 0;
+	unsigned long flags, esp0, stack = 0;
+	int index;
+
+	if (iterations <= 0) {
+		return;
+	}
+
+	flags = irq_save();
+
+	start = rdtsc();
+	for (index = 0; index < iterations; index++) {
+		syscall_int(SYS_NULL);
+	}
+	int_cycles = rdtsc() - start;
+
+	/* sysenter would land on the stack we are running on */
+	if (syscall_sysenter) {
+		stack = page_alloc(1);
+	}
+	if (stack) {
+		memset(PAGE_ADDR(stack), 0, PAGE_SIZE);
+		esp0 = cpu->tss->esp0;
+		cpu->tss->esp0 = (unsigned long)PAGE_ADDR(stack) + PAGE_SIZE;
+		cpu->sysenter_kernel = 1;
+
+		start = rdtsc();
+		for (index = 0; index < iterations; index++) {
+			syscall_sysenter_kernel(SYS_NULL);
+		}
+		fast_cycles = rdtsc() - start;
+
+		cpu->sysenter_kernel = 0;
+		cpu->tss->esp0 = esp0;
+		page_free(stack, 1);
+	}
+
+	irq_restore(flags);
+
+	printk("syscall: int $0x%x %u cycles per null call\n", TRAP_SYSCALL,
+			(uint32_t)(int_cycles / iterations));
+	if (stack) {
+		printk("syscall: sysenter %u cycles per null call\n",
+				(uint32_t)(fast_cycles / iterations));
+	} else {
+		printk("syscall: no sysenter\n");
+	}
+}
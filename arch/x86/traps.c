@@ -0,0 +1,111 @@
+/* traps.c - x86 exception handling */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * The IDT and the C side of the exception handlers.  Only page faults are
+ * handled so far, anything else still takes the machine down.  The syscall
+ * vector lives here too and irq_init() adds the device interrupts, the entry
+ * stubs for both are in entry.S.
+ */
+#include <fmios/fmios.h>
+#include <fmios/console.h>
+#include <fmios/klog.h>
+#include <fmios/paging.h>
+#include <fmios/mmap.h>
+#include <fmios/io.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+#include <asm/syscall.h>
+#include <asm/traps.h>
+
+#define IDT_INTERRUPT_GATE	0x8e	/* present, DPL 0, 32-bit */
+#define IDT_USER_GATE		0xee	/* present, DPL 3, 32-bit */
+
+extern void page_fault_entry(void);
+extern void syscall_entry(void);
+extern void halt(void);
+
+static struct idt_entry idt[IDT_ENTRIES] __attribute__((aligned(8)));
+
+static void trap_set(int vector, void (*handler)(void), uint8_t type)
+{
+	unsigned long offset = (unsigned long)handler;
+
+	idt[vector].offset_low = offset & 0xffff;
+	idt[vector].selector = GDT_KERNEL_CS;
+	idt[vector].zero = 0;
+	idt[vector].type = type;
+	idt[vector].offset_high = offset >> 16;
+}
+
+void trap_set_gate(int vector, void (*handler)(void))
+{
+	trap_set(vector, handler, IDT_INTERRUPT_GATE);
+}
+
+/* A gate ring 3 may use with int */
+void trap_set_user_gate(int vector, void (*handler)(void))
+{
+	trap_set(vector, handler, IDT_USER_GATE);
+}
+
+void traps_init(void)
+{
+	trap_set_gate(TRAP_PAGE_FAULT, page_fault_entry);
+	trap_set_user_gate(TRAP_SYSCALL, syscall_entry);
+	irq_init();
+	traps_cpu_init();
+}
+
+/* Every CPU shares the one IDT */
+void traps_cpu_init(void)
+{
+	struct gdt_ptr ptr;
+
+	ptr.limit = sizeof(idt) - 1;
+	ptr.base = (uint32_t)idt;
+	__asm__ __volatile__("lidt %0" : : "m" (ptr));
+
+	syscall_cpu_init();
+}
+
+/* Called from page_fault_entry */
+void do_page_fault(struct trap_regs *regs)
+{
+	unsigned long addr = read_cr2();
+
+	if (!(regs->error & PF_PRESENT)) {
+		/* The direct map first, it never needs a lock */
+		if (paging_fault(addr)) {
+			return;
+		}
+		if (mmap_fault(addr, regs->error & PF_WRITE)) {
+			return;
+		}
+	}
+
+	printk("error: page fault at 0x%x, eip=0x%x, error=0x%x\n", addr,
+			regs->eip, regs->error);
+	klog_flush();
+	console_flush();
+	halt();
+}
@@ -0,0 +1,156 @@
+#ifndef _FMIOS_ATOMIC_H
+#define _FMIOS_ATOMIC_H
+
+#include <asm/atomic.h>
+
+#ifndef __ASSEMBLY__
+
+/*
+ * Atomic operations on naturally aligned 1, 2, 4 and 8 byte integers.  Each
+ * macro picks the architecture primitive for the width of *ptr at compile
+ * time and everything is inline, so a use costs exactly the instruction it
+ * needs.  Pointers work as well, being 4 bytes.  Any other width fails to
+ * build.
+ *
+ * The memory orders mean what they do for C11 atomics and have to be
+ * constants.  Read-modify-write operations are at least as strong as
+ * whatever order is asked for.
+ */
+#define ATOMIC_RELAXED	0
+#define ATOMIC_ACQUIRE	1
+#define ATOMIC_RELEASE	2
+#define ATOMIC_ACQ_REL	3
+#define ATOMIC_SEQ_CST	4
+
+extern void atomic_bad_size(void)
+	__attribute__((error("atomic operation on an unsupported size")));
+
+#define ATOMIC_SELECT(ptr, op, args8, args16, args32, args64)		\
+	__builtin_choose_expr(sizeof(*(ptr)) == 1,			\
+		arch_##op##8 args8,					\
+	__builtin_choose_expr(sizeof(*(ptr)) == 2,			\
+		arch_##op##16 args16,					\
+	__builtin_choose_expr(sizeof(*(ptr)) == 4,			\
+		arch_##op##32 args32,					\
+	__builtin_choose_expr(sizeof(*(ptr)) == 8,			\
+		arch_##op##64 args64,					\
+		atomic_bad_size()))))
+
+/* Values are cast to the width of *ptr, even in the branches not taken.
+ * Pointers go through uintptr_t first so that no branch ever casts one
+ * straight to an integer of another size. */
+#define ATOMIC_POINTER_CLASS	5	/* __builtin_classify_type() */
+#define ATOMIC_CAST(bits, a)						\
+	((uint##bits##_t)__builtin_choose_expr(				\
+		__builtin_classify_type(a) == ATOMIC_POINTER_CLASS,	\
+		(uintptr_t)(a), (a)))
+
+#define ATOMIC_CALL(ptr, op)						\
+	ATOMIC_SELECT(ptr, op,						\
+		((volatile uint8_t *)(ptr)),				\
+		((volatile uint16_t *)(ptr)),				\
+		((volatile uint32_t *)(ptr)),				\
+		((volatile uint64_t *)(ptr)))
+
+#define ATOMIC_CALL1(ptr, op, a)					\
+	ATOMIC_SELECT(ptr, op,						\
+		((volatile uint8_t *)(ptr), ATOMIC_CAST(8, a)),		\
+		((volatile uint16_t *)(ptr), ATOMIC_CAST(16, a)),	\
+		((volatile uint32_t *)(ptr), ATOMIC_CAST(32, a)),	\
+		((volatile uint64_t *)(ptr), ATOMIC_CAST(64, a)))
+
+#define ATOMIC_CALL2(ptr, op, a, b)					\
+	ATOMIC_SELECT(ptr, op,						\
+		((volatile uint8_t *)(ptr),				\
+			ATOMIC_CAST(8, a), ATOMIC_CAST(8, b)),		\
+		((volatile uint16_t *)(ptr),				\
+			ATOMIC_CAST(16, a), ATOMIC_CAST(16, b)),	\
+		((volatile uint32_t *)(ptr),				\
+			ATOMIC_CAST(32, a), ATOMIC_CAST(32, b)),	\
+		((volatile uint64_t *)(ptr),				\
+			ATOMIC_CAST(64, a), ATOMIC_CAST(64, b)))
+
+/* The unqualified integer type the primitives for *ptr work in */
+#define ATOMIC_TYPE(ptr)	__typeof__(ATOMIC_CALL(ptr, load))
+
+#define atomic_load(ptr, order)						\
+({									\
+	ATOMIC_TYPE(ptr) __val = ATOMIC_CALL(ptr, load);		\
+	if ((order) != ATOMIC_RELAXED) {				\
+		arch_barrier();						\
+	}								\
+	(__typeof__(*(ptr)))__val;					\
+})
+
+#define atomic_store(ptr, val, order)					\
+do {									\
+	if ((order) == ATOMIC_SEQ_CST) {				\
+		(void)ATOMIC_CALL1(ptr, xchg, (val));			\
+	} else {							\
+		if ((order) != ATOMIC_RELAXED) {			\
+			arch_barrier();					\
+		}							\
+		ATOMIC_CALL1(ptr, store, (val));			\
+	}								\
+} while (0)
+
+/* @return the previous value of *ptr */
+#define atomic_xchg(ptr, val, order)					\
+	((__typeof__(*(ptr)))ATOMIC_CALL1(ptr, xchg, (val)))
+
+/* @return the previous value of *ptr, the swap happened if it equals old */
+#define atomic_cmpxchg(ptr, old, val, order)				\
+	((__typeof__(*(ptr)))ATOMIC_CALL2(ptr, cmpxchg, (old), (val)))
+
+#define atomic_fetch_add(ptr, val, order)				\
+	((__typeof__(*(ptr)))ATOMIC_CALL1(ptr, xadd, (val)))
+
+/* Widen val to the type of *ptr before negating it, as the others do */
+#define atomic_fetch_sub(ptr, val, order)				\
+({									\
+	ATOMIC_TYPE(ptr) __sub = (val);					\
+	(__typeof__(*(ptr)))ATOMIC_CALL1(ptr, xadd, -__sub);		\
+})
+
+#define atomic_add_fetch(ptr, val, order)				\
+({									\
+	ATOMIC_TYPE(ptr) __add = (val);					\
+	(__typeof__(*(ptr)))(ATOMIC_CALL1(ptr, xadd, __add) + __add);	\
+})
+
+#define atomic_sub_fetch(ptr, val, order)				\
+({									\
+	ATOMIC_TYPE(ptr) __sub = (val);					\
+	(__typeof__(*(ptr)))(ATOMIC_CALL1(ptr, xadd, -__sub) - __sub);	\
+})
+
+/* These never need the old value and are always fully ordered */
+#define atomic_add(ptr, val)	ATOMIC_CALL1(ptr, add, (val))
+#define atomic_sub(ptr, val)					\
+({									\
+	ATOMIC_TYPE(ptr) __sub = (val);					\
+	ATOMIC_CALL1(ptr, add, -__sub);					\
+})
+#define atomic_inc(ptr)		ATOMIC_CALL1(ptr, add, 1)
+#define atomic_dec(ptr)		ATOMIC_CALL1(ptr, add, -1)
+#define atomic_or(ptr, val)	ATOMIC_CALL1(ptr, or, (val))
+#define atomic_and(ptr, val)	ATOMIC_CALL1(ptr, and, (val))
+
+/* @return non-zero if *ptr dropped to 0 */
+#define atomic_sub_and_test(ptr, val)					\
+	ATOMIC_CALL1(ptr, sub_and_test, (val))
+#define atomic_dec_and_test(ptr)					\
+	ATOMIC_CALL1(ptr, sub_and_test, 1)
+
+#define atomic_fence(order)						\
+do {									\
+	if ((order) == ATOMIC_SEQ_CST) {				\
+		arch_mb();						\
+	} else if ((order) != ATOMIC_RELAXED) {				\
+		arch_barrier();						\
+	}								\
+} while (0)
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_ATOMIC_H */
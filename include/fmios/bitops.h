@@ -0,0 +1,21 @@
+#ifndef _FMIOS_BITOPS_H
+#define _FMIOS_BITOPS_H
+
+#include <asm/bitops.h>
+
+#ifndef __ASSEMBLY__
+
+#define BITS_PER_LONG	(sizeof(unsigned long) * 8)
+
+/* @return index of the least significant set bit, or -1 if none are set */
+static inline int find_first_set_bit(unsigned long word)
+{
+	if (!word) {
+		return -1;
+	}
+	return __ffs(word);
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_BITOPS_H */
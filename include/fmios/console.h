@@ -0,0 +1,31 @@
+#ifndef _FMIOS_CONSOLE_H
+#define _FMIOS_CONSOLE_H
+
+#include <fmios/types.h>
+
+#ifndef __ASSEMBLY__
+
+/*
+ * Anything the kernel log can be written out to.  The log hands each
+ * console whole lines at a time, one caller at a time, so a driver can
+ * batch its device accesses over a line rather than paying for them on
+ * every byte.  A '\n' in buf means a new line; any translation the device
+ * needs is up to the driver.  A driver which only queues what it is given
+ * provides flush() to wait until it has all reached the device.
+ */
+struct console {
+	const char		*name;
+	void			(*write)(struct console *con, const char *buf,
+					size_t len);
+	void			(*flush)(struct console *con);
+	struct console		*next;
+};
+
+void console_register(struct console *con);
+void console_write(const char *buf, size_t len);
+void console_flush(void);
+void console_bench(unsigned long lines);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_CONSOLE_H */
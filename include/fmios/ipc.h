@@ -0,0 +1,67 @@
+#ifndef _FMIOS_IPC_H
+#define _FMIOS_IPC_H
+
+#include <fmios/types.h>
+
+#ifndef __ASSEMBLY__
+
+#define IPC_CACHELINE		64
+
+/* Words carried by ipc_call() and ipc_reply_wait() */
+#define IPC_MSG_WORDS		4
+
+/* task.ipc_state */
+#define IPC_IDLE		0
+#define IPC_WAITING		1	/* in ipc_reply_wait(), open for a call */
+#define IPC_CLAIMED		2	/* a caller is filling in the message */
+#define IPC_RECEIVED		3	/* the message is in place */
+#define IPC_CALLING		4	/* in ipc_call(), waiting for the reply */
+
+struct task;
+
+struct ipc_msg {
+	unsigned long		word[IPC_MSG_WORDS];
+};
+
+/* One end of a ring, only ever written by the side it belongs to */
+struct ipc_end {
+	volatile uint32_t	index;		/* next slot to fill or drain */
+	uint32_t		other;		/* last seen index of the far end */
+	volatile int		waiting;	/* asleep until the far end moves */
+	unsigned long		messages;
+	unsigned long		sleeps;
+	unsigned long		wakeups;	/* of the far end */
+} __attribute__((aligned(IPC_CACHELINE)));
+
+/* Header of the shared memory, the slots follow it */
+struct ipc_ring {
+	struct ipc_end		producer;
+	struct ipc_end		consumer;
+	uint32_t		slots;		/* a power of two */
+	uint32_t		slot_size;
+} __attribute__((aligned(IPC_CACHELINE)));
+
+struct ipc_channel {
+	struct ipc_ring		*ring;
+	char			*data;
+	size_t			len;		/* of the whole mapping */
+	struct task		*producer;	/* set when it waits */
+	struct task		*consumer;
+};
+
+struct ipc_channel * ipc_channel_create(uint32_t slots, uint32_t slot_size);
+void ipc_channel_destroy(struct ipc_channel *channel);
+void * ipc_send_slot(struct ipc_channel *channel);
+void ipc_send_commit(struct ipc_channel *channel);
+void * ipc_recv_slot(struct ipc_channel *channel);
+void ipc_recv_release(struct ipc_channel *channel);
+void ipc_bench(unsigned long messages);
+
+int ipc_call(struct task *to, struct ipc_msg *msg);
+struct task * ipc_reply_wait(struct task *caller, struct ipc_msg *msg);
+void ipc_reply(struct task *caller, struct ipc_msg *msg);
+void ipc_call_bench(unsigned long rounds);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_IPC_H */
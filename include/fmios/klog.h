@@ -0,0 +1,29 @@
+#ifndef _FMIOS_KLOG_H
+#define _FMIOS_KLOG_H
+
+#include <fmios/types.h>
+
+#ifndef __ASSEMBLY__
+
+/*
+ * The kernel log.  printk() formats into a line and klog_write() copies it
+ * into the ring of the CPU it runs on, never touching a lock or an I/O port.
+ * klog_flush() later hands whatever has been queued on every CPU to the
+ * consoles, in the order it was logged.  Each ring keeps the most recent
+ * KLOG_RING_SIZE bytes, consoles or not, so klog_read() can still dump them
+ * after the fact.
+ */
+
+#define KLOG_RING_SIZE	4096	/* bytes per CPU, a power of two */
+#define KLOG_LINE_MAX	128	/* longest single record */
+
+void klog_write(const char *text, size_t len);
+void klog_flush(void);
+void klog_defer(int defer);
+int klog_read(uint32_t *seq, char *buf, size_t len);
+void klog_dump(void);
+void klog_report(void);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_KLOG_H */
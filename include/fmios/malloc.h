@@ -1,6 +1,7 @@
 #ifndef __FMIOS_MEM_H
 #define __FMIOS_MEM_H
 
+#include <fmios/types.h>
 #include <stdint.h>
 
 /* This is /almost/ a 1:1 mapping from the Multiboot2 mmap_entry with the
@@ -19,4 +20,46 @@ struct pmap_table {
 	struct pmap_entry	entry[0];
 };
 
+/* A run of pages handed out by bootmem_alloc(), inclusive */
+struct bootmem_range {
+	uint32_t	start;
+	uint32_t	end;
+};
+
+void bootmem_init(void);
+unsigned long bootmem_alloc(size_t count, unsigned long align);
+unsigned long bootmem_alloc_low(size_t count);
+int bootmem_used_ranges(const struct bootmem_range **ranges);
+void bootmem_retire(void);
+
+/* Page allocator statistics as reported by page_stats() */
+struct page_stats {
+	unsigned long	free_pages;	/* total pages in the tree */
+	unsigned long	free_ranges;	/* contiguous runs in the tree */
+	unsigned long	largest_range;	/* pages in the largest run */
+	unsigned long	nodes;		/* tree nodes in use */
+	unsigned long	nodes_pages;	/* pages consumed by the node pool */
+	unsigned long	allocs;		/* tree allocations and cache refills */
+	unsigned long	frees;		/* tree frees and cache drains */
+};
+
+/* Per-CPU page cache statistics as reported by page_cache_stats() */
+struct page_cache_stats {
+	unsigned long	hits;		/* single page allocs served locally */
+	unsigned long	misses;		/* single page allocs needing a refill */
+	unsigned long	refills;
+	unsigned long	drains;
+	unsigned long	cached;		/* pages currently held by the cache */
+};
+
+/* Largest block page_alloc_order() can hand out, all of a 32bit space */
+#define PAGE_ORDER_MAX	20
+
+unsigned long page_alloc(size_t count);
+void page_free(unsigned long page, size_t count);
+unsigned long page_alloc_order(int order, unsigned long align);
+#define page_free_order(page, order)	page_free((page), 1UL << (order))
+void page_stats(struct page_stats *stats);
+void page_cache_stats(int cpu, struct page_cache_stats *stats);
+
 #endif /* __FMIOS_MEM_H */
@@ -0,0 +1,30 @@
+#ifndef _FMIOS_MMAP_H
+#define _FMIOS_MMAP_H
+
+#include <fmios/types.h>
+
+#ifndef __ASSEMBLY__
+
+#define PROT_NONE	0x00
+#define PROT_READ	0x01
+#define PROT_WRITE	0x02
+#define PROT_EXEC	0x04
+
+#define MAP_SHARED	0x01
+#define MAP_PRIVATE	0x02
+#define MAP_FIXED	0x10
+#define MAP_ANONYMOUS	0x20
+
+#define MAP_FAILED	((void *)-1)
+
+/* Mappings mmap() can track at once */
+#define MMAP_MAX	128
+
+void mmap_init(void);
+void * mmap(void *addr, size_t len, int prot, int flags, int fd, long offset);
+int munmap(void *addr, size_t len);
+int mmap_fault(unsigned long addr, int write);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_MMAP_H */
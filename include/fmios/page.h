@@ -6,6 +6,7 @@
 #define PAGE_NUM(addr)	(((unsigned long)addr) / PAGE_SIZE)
 /* FIXME this should just mask out the lower bits to find the page address */
 #define PAGE_OF(addr)	((((unsigned long)addr) / PAGE_SIZE) * PAGE_SIZE)
+#define PAGE_ADDR(page)	((void *)(((unsigned long)page) * PAGE_SIZE))
 
 #endif /* __ASSEMBLY__ */
 
@@ -0,0 +1,36 @@
+#ifndef _FMIOS_PAGING_H
+#define _FMIOS_PAGING_H
+
+#include <fmios/types.h>
+#include <fmios/malloc.h>
+
+#ifndef __ASSEMBLY__
+
+/* What init_paging() built, as reported by paging_stats() */
+struct paging_stats {
+	unsigned long	large_pages;
+	unsigned long	lazy_pages;	/* large pages not yet touched */
+	unsigned long	large_size;	/* bytes covered by each large page */
+	unsigned long	small_pages;
+	unsigned long	tables;		/* pages holding page tables */
+};
+
+/* paging_map_page() flags */
+#define PAGING_WRITE	0x01
+#define PAGING_USER	0x02
+#define PAGING_NOCACHE	0x04
+
+int init_paging(struct pmap_table *pmap);
+void paging_stats(struct paging_stats *stats);
+int paging_fault(unsigned long addr);
+void paging_window(unsigned long *start, unsigned long *end);
+int paging_map_page(unsigned long addr, unsigned long page, int flags);
+unsigned long paging_unmap_page(unsigned long addr);
+int paging_retire_page(unsigned long addr);
+void paging_tlb_shootdown(void);
+void paging_tlb_sync(void);
+int paging_map_io(unsigned long addr, unsigned long len);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_PAGING_H */
@@ -0,0 +1,45 @@
+#ifndef _FMIOS_PID_H
+#define _FMIOS_PID_H
+
+#include <fmios/types.h>
+#include <asm/config.h>
+
+#ifndef __ASSEMBLY__
+
+/* Pids run from PID_MIN to PID_MAX - 1, 0 is never handed out */
+#define PID_MIN			1
+#define PID_MAX			32768
+
+/* Pids each CPU keeps to hand out, and frees it collects before the LRU */
+#define PID_BATCH		16
+
+/* A freed pid is only reused once this many others were freed after it */
+#define PID_LRU_MIN		1024
+
+struct pid_cpu {
+	unsigned long	count;
+	int		pid[PID_BATCH];
+	unsigned long	freed_count;
+	int		freed[PID_BATCH];
+	unsigned long	allocs;
+	unsigned long	frees;
+	unsigned long	refills;	/* batches taken from the global pool */
+};
+
+/* Pid statistics as reported by pid_stats(), summed over the CPUs */
+struct pid_stats {
+	unsigned long	allocs;
+	unsigned long	frees;
+	unsigned long	refills;
+	unsigned long	fresh;		/* never used pids left */
+	unsigned long	lru;		/* freed pids waiting to be reused */
+};
+
+int pid_alloc(void);
+void pid_free(int pid);
+void pid_stats(struct pid_stats *stats);
+void pid_bench(unsigned long iterations);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_PID_H */
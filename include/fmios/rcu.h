@@ -0,0 +1,76 @@
+#ifndef _FMIOS_RCU_H
+#define _FMIOS_RCU_H
+
+#include <fmios/config.h>
+#include <fmios/types.h>
+#include <fmios/atomic.h>
+#include <fmios/smp.h>
+#include <asm/config.h>
+
+#ifndef __ASSEMBLY__
+
+/*
+ * Read-copy-update.  Readers of an RCU protected pointer bracket their use
+ * of it with rcu_read_lock()/rcu_read_unlock() and never sleep or yield in
+ * between.  Writers publish a new version with rcu_assign_pointer() and
+ * hand the old one to call_rcu(), or wait in synchronize_rcu(), to have it
+ * freed once every reader which could still see it is gone.
+ *
+ * Scheduling is cooperative, so a CPU passing through the scheduler can not
+ * be inside a read-side section and every context switch is a quiescent
+ * state.  Readers therefore cost nothing at all beyond a compiler barrier.
+ */
+
+/* Embedded in whatever call_rcu() is to free */
+struct rcu_head {
+	struct rcu_head		*next;
+	void			(*func)(struct rcu_head *);
+};
+
+struct rcu_cpu {
+	volatile uint32_t	seen;		/* last grace period quiescent in */
+	volatile int		online;
+	volatile int		idle;		/* quiescent until it schedules */
+	int			nesting;	/* read-side depth, debug only */
+	struct rcu_head		*next;		/* callbacks without a grace period */
+	struct rcu_head		**next_tail;
+	struct rcu_head		*wait;		/* callbacks waiting for wait_gp */
+	uint32_t		wait_gp;
+	unsigned long		queued;
+	unsigned long		invoked;
+} __attribute__((aligned(64)));
+
+extern struct rcu_cpu rcu_cpu[NR_CPUS];
+
+#ifdef CONFIG_ENABLE_DEBUG
+/* Track the depth so that rcu_qs() can catch a reader giving up the CPU */
+#define rcu_read_lock()		do {					\
+		rcu_cpu[cpu_id()].nesting++;				\
+		arch_barrier();						\
+	} while (0)
+#define rcu_read_unlock()	do {					\
+		arch_barrier();						\
+		rcu_cpu[cpu_id()].nesting--;				\
+	} while (0)
+#else
+#define rcu_read_lock()		arch_barrier()
+#define rcu_read_unlock()	arch_barrier()
+#endif /* CONFIG_ENABLE_DEBUG */
+
+/* Loads of anything reached through the pointer stay ordered after it */
+#define rcu_dereference(p)	atomic_load(&(p), ATOMIC_ACQUIRE)
+
+/* The new version is fully initialised before it can be seen */
+#define rcu_assign_pointer(p, v) atomic_store(&(p), (v), ATOMIC_RELEASE)
+
+void rcu_cpu_init(void);
+void rcu_qs(void);
+void rcu_idle(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+void synchronize_rcu(void);
+void rcu_report(void);
+void rcu_bench(unsigned long iterations);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_RCU_H */
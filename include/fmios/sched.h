@@ -0,0 +1,107 @@
+#ifndef _FMIOS_SCHED_H
+#define _FMIOS_SCHED_H
+
+#include <fmios/types.h>
+#include <fmios/ipc.h>
+#include <fmios/spinlock.h>
+#include <asm/config.h>
+
+#ifndef __ASSEMBLY__
+
+/* Priority 0 is the most urgent, one bit of the run queue bitmap each */
+#define SCHED_PRIORITIES	32
+#define SCHED_PRIO_DEFAULT	16
+#define SCHED_PRIO_IDLE		(SCHED_PRIORITIES - 1)
+
+#define TASK_STACK_PAGES	(STACK_SIZE / PAGE_SIZE)
+
+/* Task states */
+#define TASK_RUNNING		0	/* on the CPU or on a run queue */
+#define TASK_SLEEPING		1	/* waiting for wake() */
+#define TASK_DEAD		2	/* waiting to be freed */
+
+/* Tasks each per-priority ring holds before spilling to the overflow list */
+#define SCHED_RING_SIZE		16
+
+struct task {
+	unsigned long	sp;		/* saved while switched out */
+	struct task	*next;		/* overflow list link */
+	int		priority;
+	int		state;
+	int		cpu;		/* CPU last queued or run on */
+	volatile int	on_cpu;		/* context not yet saved */
+	spinlock_t	lock;		/* orders sched_sleep() against wake() */
+	int		wakeup;		/* wake() came while still running */
+	uint64_t	woken;		/* tsc at wake(), 0 once it has run */
+	unsigned long	stack;		/* first page of the stack, 0 for idle */
+	unsigned long	flags;		/* interrupt state to start with */
+	void		(*entry)(void *);
+	void		*arg;
+	const char	*name;
+	int		pid;		/* 0 for the idle tasks */
+
+	/* Synchronous IPC, see ipc_call() */
+	volatile int	ipc_state;
+	struct task	*ipc_partner;	/* the caller being served */
+	struct ipc_msg	ipc_msg;	/* message registers */
+};
+
+/* Per-CPU scheduler statistics as reported by sched_stats(), times in tsc
+ * cycles */
+struct sched_stats {
+	unsigned long	switches;
+	uint64_t	switch_cycles;	/* from leaving one task to the next */
+	unsigned long	wakeups;	/* woken tasks which have run */
+	uint64_t	wakeup_cycles;	/* from wake() until the task runs */
+	uint64_t	wakeup_max;
+	unsigned long	steals;		/* tasks taken from another CPU */
+	unsigned long	migrations;	/* tasks arriving from another CPU */
+	uint64_t	idle_cycles;
+	unsigned long	queued;		/* tasks waiting to run right now */
+	unsigned long	handoffs;	/* sched_switch_to() switches */
+};
+
+/* Single producer, multiple consumer ring.  Only the owning CPU adds tasks
+ * while it and any thief take them from the top with a compare and swap. */
+struct sched_ring {
+	volatile uint32_t	top;
+	volatile uint32_t	bottom;
+	struct task		*slot[SCHED_RING_SIZE];
+};
+
+/* Only the owning CPU touches a run queue other than through the rings, and
+ * always with interrupts disabled */
+struct runqueue {
+	uint32_t		bitmap;		/* priorities with tasks queued */
+	struct sched_ring	ring[SCHED_PRIORITIES];
+	struct task		*overflow[SCHED_PRIORITIES];
+	struct task		*overflow_tail[SCHED_PRIORITIES];
+	volatile int		queued;
+	struct task		*current;
+	struct task		*idle;		/* NULL until the CPU schedules */
+	struct task		*prev;		/* task being switched away from */
+	uint64_t		switch_start;
+	uint64_t		idle_start;
+	struct sched_stats	stats;
+};
+
+void sched_init(void);
+void sched_cpu_init(void);
+void sched_idle(void);
+void sched_idle_forever(void);
+struct task * task_create(const char *name, void (*entry)(void *), void *arg,
+		int priority);
+void task_exit(void);
+struct task * current_task(void);
+void yield(void);
+void sched_sleep(void);
+void wake(struct task *task);
+int sched_switch_to(struct task *next);
+void sched_stats(int cpu, struct sched_stats *stats);
+void sched_report(void);
+int sched_task_count(void);
+void sched_bench(unsigned long rounds);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_SCHED_H */
@@ -35,8 +35,16 @@
 
 #ifndef __ASSEMBLY__
 
-int serial_putc(int c);
-void serial_init(uint32_t iobase, uint32_t baud, uint8_t flags, uint16_t divisor);
+/* One UART, COM1 through COM4 are ports 0 through 3 */
+struct serial_port;
+
+struct serial_port * serial_init(uint32_t iobase, uint32_t baud,
+		uint8_t flags, uint16_t divisor, int irq, int console);
+struct serial_port * serial_get(int index);
+int serial_putc(struct serial_port *port, int c);
+int serial_write(struct serial_port *port, const char *buf, size_t len);
+int serial_read(struct serial_port *port, char *buf, size_t len);
+void serial_report(void);
 
 #endif
 
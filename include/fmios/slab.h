@@ -0,0 +1,63 @@
+#ifndef _FMIOS_SLAB_H
+#define _FMIOS_SLAB_H
+
+#include <fmios/types.h>
+#include <fmios/spinlock.h>
+#include <asm/config.h>
+
+#ifndef __ASSEMBLY__
+
+/* Objects held by each CPU in front of the slabs */
+#define KMEM_CPU_SIZE	16
+
+struct kmem_slab;
+
+struct kmem_cpu {
+	unsigned long	count;
+	void		*obj[KMEM_CPU_SIZE];
+	unsigned long	hits;
+	unsigned long	misses;
+};
+
+struct kmem_cache {
+	const char		*name;
+	size_t			size;		/* object size including padding */
+	size_t			align;
+	int			order;		/* each slab is 2^order pages */
+	unsigned long		objects;	/* objects per slab */
+	void			(*ctor)(void *);
+
+	spinlock_t		lock;		/* protects everything below */
+	struct kmem_slab	*partial;	/* slabs with free objects */
+	unsigned long		slabs;
+	unsigned long		free_slabs;	/* completely unused slabs */
+	unsigned long		inuse;		/* objects outside the slabs */
+	struct kmem_cache	*next;
+
+	struct kmem_cpu		cpu[NR_CPUS];
+};
+
+/* Per-cache statistics as reported by kmem_cache_stats() */
+struct kmem_cache_stats {
+	unsigned long	slabs;
+	unsigned long	objects;	/* total objects in all slabs */
+	unsigned long	inuse;		/* objects handed out to callers */
+	unsigned long	cached;		/* free objects held by the CPUs */
+	unsigned long	hits;		/* allocs served by a CPU cache */
+	unsigned long	misses;		/* allocs which went to the slabs */
+};
+
+void kmem_init(void);
+struct kmem_cache * kmem_cache_create(const char *name, size_t size,
+		size_t align, void (*ctor)(void *));
+void * kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+void kmem_cache_stats(struct kmem_cache *cache, struct kmem_cache_stats *stats);
+void kmem_report(void);
+
+void * kmalloc(size_t size);
+void kfree(void *ptr);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_SLAB_H */
@@ -0,0 +1,18 @@
+#ifndef _FMIOS_SMP_H
+#define _FMIOS_SMP_H
+
+#include <asm/config.h>
+#include <asm/smp.h>
+
+#ifndef __ASSEMBLY__
+
+/* Platform hooks, called before init_malloc() and after sched_init() */
+void smp_reserve(void);
+void init_smp(void);
+
+/* Number of CPUs which are up, 1 until init_smp() starts the others */
+int smp_cpus(void);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_SMP_H */
@@ -0,0 +1,176 @@
+#ifndef _FMIOS_SPINLOCK_H
+#define _FMIOS_SPINLOCK_H
+
+#include <fmios/config.h>
+#include <fmios/atomic.h>
+#include <asm/processor.h>
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+/*
+ * Two kinds of queued lock.  spinlock_t is a ticket lock: cheap and first
+ * come first served, but every waiter spins on the same cache line.
+ * mcs_lock_t hands each waiter its own node to spin on and passes the lock
+ * straight from one node to the next, so a contended lock costs one cache
+ * line transfer per hand off however many CPUs are waiting.  Use it for
+ * locks every CPU fights over.
+ *
+ * Configured with --enable-lockstat every lock also counts acquisitions,
+ * how many of those had to wait, the total spins and the longest hold in
+ * cycles.  Locks given a name are listed by lock_stat_report() from their
+ * first acquisition on, so only name locks which live forever.
+ */
+#ifdef CONFIG_ENABLE_LOCKSTAT
+/* Only ever written by the lock holder */
+struct lock_stat {
+	const char		*name;
+	unsigned long		acquisitions;
+	unsigned long		contended;	/* acquisitions which waited */
+	unsigned long		spins;
+	uint32_t		max_hold;	/* cycles */
+	uint64_t		acquired_at;
+	struct lock_stat	*next;
+};
+
+#define LOCK_STAT_INIT(lock_name)	, { .name = (lock_name) }
+
+void lock_stat_register(struct lock_stat *stat);
+
+static inline void lock_stat_init(struct lock_stat *stat, const char *name)
+{
+	stat->name = name;
+	stat->acquisitions = 0;
+	stat->contended = 0;
+	stat->spins = 0;
+	stat->max_hold = 0;
+	stat->next = NULL;
+}
+
+static inline void lock_stat_acquired(struct lock_stat *stat,
+		unsigned long spins)
+{
+	if (!stat->acquisitions && stat->name) {
+		lock_stat_register(stat);
+	}
+	stat->acquisitions++;
+	if (spins) {
+		stat->contended++;
+		stat->spins += spins;
+	}
+	stat->acquired_at = rdtsc();
+}
+
+static inline void lock_stat_released(struct lock_stat *stat)
+{
+	uint64_t hold = rdtsc() - stat->acquired_at;
+
+	if (hold > stat->max_hold) {
+		stat->max_hold = hold > ~0U ? ~0U : hold;
+	}
+}
+#else
+#define LOCK_STAT_INIT(lock_name)
+#define lock_stat_init(stat, name)		do { } while (0)
+#define lock_stat_acquired(stat, spins)		((void)(spins))
+#define lock_stat_released(stat)		do { } while (0)
+#endif /* CONFIG_ENABLE_LOCKSTAT */
+
+void lock_stat_report(void);
+
+typedef struct {
+	volatile uint16_t	head;		/* ticket being served */
+	volatile uint16_t	tail;		/* next ticket to hand out */
+#ifdef CONFIG_ENABLE_LOCKSTAT
+	struct lock_stat	stat;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT(name)	{ 0, 0 LOCK_STAT_INIT(name) }
+
+unsigned long spin_lock_wait(spinlock_t *lock, uint16_t ticket);
+
+/* @name name for lock_stat_report(), or NULL not to list the lock */
+static inline void spin_lock_init(spinlock_t *lock, const char *name)
+{
+	lock->head = 0;
+	lock->tail = 0;
+	lock_stat_init(&lock->stat, name);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	uint16_t ticket = atomic_fetch_add(&lock->tail, 1, ATOMIC_ACQUIRE);
+	unsigned long spins = 0;
+
+	if (atomic_load(&lock->head, ATOMIC_ACQUIRE) != ticket) {
+		spins = spin_lock_wait(lock, ticket);
+	}
+	lock_stat_acquired(&lock->stat, spins);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	lock_stat_released(&lock->stat);
+	atomic_store(&lock->head, lock->head + 1, ATOMIC_RELEASE);
+}
+
+/* Each CPU taking an MCS lock queues its own node, usually on its stack */
+struct mcs_node {
+	struct mcs_node * volatile	next;
+	volatile int			waiting;
+};
+
+typedef struct {
+	struct mcs_node * volatile	tail;	/* last node in the queue */
+#ifdef CONFIG_ENABLE_LOCKSTAT
+	struct lock_stat		stat;
+#endif
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(name)	{ NULL LOCK_STAT_INIT(name) }
+
+unsigned long mcs_lock_wait(struct mcs_node *prev, struct mcs_node *node);
+struct mcs_node * mcs_unlock_wait(struct mcs_node *node);
+
+static inline void mcs_lock_init(mcs_lock_t *lock, const char *name)
+{
+	lock->tail = NULL;
+	lock_stat_init(&lock->stat, name);
+}
+
+/* @node must stay put until the matching mcs_unlock() */
+static inline void mcs_lock(mcs_lock_t *lock, struct mcs_node *node)
+{
+	struct mcs_node *prev;
+	unsigned long spins = 0;
+
+	node->next = NULL;
+	node->waiting = 1;
+	prev = atomic_xchg(&lock->tail, node, ATOMIC_ACQ_REL);
+	if (prev) {
+		spins = mcs_lock_wait(prev, node);
+	}
+	lock_stat_acquired(&lock->stat, spins);
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, struct mcs_node *node)
+{
+	struct mcs_node *next = atomic_load(&node->next, ATOMIC_ACQUIRE);
+
+	lock_stat_released(&lock->stat);
+	if (!next) {
+		/* Nobody queued behind us unless the swap fails */
+		if (atomic_cmpxchg(&lock->tail, node, NULL, ATOMIC_RELEASE) ==
+				node) {
+			return;
+		}
+		next = mcs_unlock_wait(node);
+	}
+	atomic_store(&next->waiting, 0, ATOMIC_RELEASE);
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_SPINLOCK_H */
@@ -0,0 +1,22 @@
+#ifndef _FMIOS_SYSCALL_H
+#define _FMIOS_SYSCALL_H
+
+/* Syscall numbers, the index into syscall_table[] */
+#define SYS_NULL		0	/* does nothing, for measuring entry */
+#define SYS_YIELD		1
+#define SYS_EXIT		2
+#define SYS_CPU			3	/* the CPU the caller is running on */
+#define SYSCALL_MAX		4
+
+/* Returned for a syscall number with nothing behind it */
+#define SYSCALL_INVALID		(-1)
+
+#ifndef __ASSEMBLY__
+
+long syscall_dispatch(unsigned long nr, unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3);
+void syscall_bench(int iterations);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _FMIOS_SYSCALL_H */
@@ -387,6 +387,8 @@ uint32_t mb_fb_height(void);
 uint8_t mb_fb_depth(void);
 uint8_t mb_fb_type(void);
 
+void * mb_acpi_rsdp(void);
+
 #endif /* ! __ASSEMBLY__ */
 
 #ifdef CONFIG_ENABLE_MULTIBOOT1
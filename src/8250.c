@@ -20,7 +20,11 @@
 */
 #include <fmios/config.h>
 #include <fmios/types.h>
+#include <fmios/atomic.h>
+#include <fmios/console.h>
+#include <fmios/spinlock.h>
 #include <fmios/io.h>
+#include <asm/irq.h>
 
 /* 8250 registers */
 #define DIVISOR_LOW_REG		0x00	/* When DLAB set */
@@ -28,7 +32,8 @@
 #define TX_HOLD_REG		0x00	/* outb() */
 #define	RX_BUFF_REG		0x00	/* inb() */
 #define INTR_ENABLE_REG		0x01
-#define INTR_STATUS_REG		0x02
+#define INTR_STATUS_REG		0x02	/* inb() */
+#define FIFO_CTRL_REG		0x02	/* outb(), 16550 onwards */
 #define LINE_CTRL_REG		0x03
 #define MODEM_CTRL_REG		0x04
 #define LINE_STATUS_REG		0x05
@@ -40,6 +45,24 @@
 #define INTR_CTRL_TX_READY	(1<<1)
 #define INTR_CTRL_RX_DATA	(1<<0)
 
+/* Interrupt Status Register bits */
+#define INTR_STATUS_NONE	(1<<0)	/* Nothing pending */
+#define INTR_STATUS_ID		0x0e
+#define INTR_STATUS_MODEM	0x00
+#define INTR_STATUS_TX_READY	0x02
+#define INTR_STATUS_RX_DATA	0x04
+#define INTR_STATUS_LINE	0x06
+#define INTR_STATUS_RX_TIMEOUT	0x0c	/* 16550 onwards */
+#define INTR_STATUS_FIFO	0xc0
+#define INTR_STATUS_FIFO_OK	0xc0	/* 16550A, the 16550 FIFO is broken */
+
+/* FIFO Control Register bits */
+#define FIFO_CTRL_RX_TRIG8	(2<<6)	/* RX interrupt at 8 bytes */
+#define FIFO_CTRL_CLEAR_TX	(1<<2)
+#define FIFO_CTRL_CLEAR_RX	(1<<1)
+#define FIFO_CTRL_ENABLE	(1<<0)
+#define FIFO_SIZE		16
+
 /* Line Control Register bits */
 #define LINE_CTRL_DLAB		(1<<7)
 #define LINE_CTRL_BREAK		(1<<6)
@@ -54,7 +77,7 @@
 
 /* 8250 Modem Control bits */
 #define MODEM_CTRL_LOOP		(1<<4)
-#define MDOEM_CTRL_INTR1	(1<<3)
+#define MODEM_CTRL_INTR1	(1<<3)	/* Gates the IRQ line on PCs */
 #define MODEM_CTRL_INTR2	(1<<2)	/* Not Connected? */
 #define MODEM_CTRL_RTS		(1<<1)
 #define MODEM_CTRL_DTR		(1<<0)
@@ -66,7 +89,7 @@
 #define LINE_STATUS_FRAME_ERR	(1<<3)
 #define LINE_STATUS_PARITY_ERR	(1<<2)
 #define LINE_STATUS_OVERRUN	(1<<1)
-#define LINE_STATIS_RX_DATA	(1<<0)
+#define LINE_STATUS_RX_DATA	(1<<0)
 
 /* 8250 Modem Status bits */
 #define MODEM_STATUS_RLSD	(1<<7)	/* RX Line Signal Detect */
@@ -81,99 +104,556 @@
 #define DEFAULT_IOBASE		0x3f8	/* COM1 */
 #define DEFAULT_CLOCK		1843200	/* 1.8Mhz */
 #define	DEFAULT_BAUD		9600
-static uint32_t serial_iobase = 0; /* Disabled by default */
-static uint64_t serial_clock = DEFAULT_CLOCK;
-static uint32_t serial_baud = DEFAULT_BAUD;
-static uint16_t serial_div = DEFAULT_CLOCK / DEFAULT_BAUD / 16;
-static uint8_t  serial_flags = LINE_CTRL_8BIT; /* 8n1 */
 
-static void __serial_init(void) {
+#define SERIAL_PORTS		4
+#define SERIAL_TX_RING		1024	/* a power of two */
+#define SERIAL_RX_RING		256	/* a power of two */
+
+struct serial_port {
+	struct console		console;	/* first, see serial_con() */
+	const char		*name;
+	uint32_t		iobase;		/* 0 while unused */
+	uint64_t		clock;
+	uint32_t		baud;
+	uint16_t		div;
+	uint8_t			flags;
+	uint32_t		burst;		/* bytes taken when TX is ready */
+	int			irq;		/* polled while 0 */
+
+	/* Queued output for the TX ready interrupt to hand over */
+	spinlock_t		tx_lock;	/* protects tx_tail */
+	volatile uint32_t	tx_head;	/* written by serial_send() */
+	volatile uint32_t	tx_tail;
+	char			tx_ring[SERIAL_TX_RING];
+
+	/* Input from the RX interrupt, or polled in by serial_read() */
+	volatile uint32_t	rx_head;	/* written by serial_rx() */
+	volatile uint32_t	rx_tail;	/* written by serial_read() */
+	unsigned long		rx_bytes;
+	unsigned long		rx_dropped;	/* no room left in the ring */
+	volatile unsigned long	rx_overruns;	/* lost by the UART */
+	char			rx_ring[SERIAL_RX_RING];
+};
+
+/* Where a port goes in serial_ports[] if it is one of the usual ones */
+static const uint32_t serial_com_iobase[SERIAL_PORTS] = {
+	0x3f8, 0x2f8, 0x3e8, 0x2e8
+};
+static const char *serial_names[SERIAL_PORTS] = {
+	"ttyS0", "ttyS1", "ttyS2", "ttyS3"
+};
+static struct serial_port serial_ports[SERIAL_PORTS];
+
+static inline struct serial_port * serial_con(struct console *con)
+{
+	return (struct serial_port *)con;
+}
+
+static void __serial_init(struct serial_port *port) {
+	uint32_t iobase = port->iobase;
+
 	/* Compute the divisor */
-	serial_div = serial_clock / serial_baud / 16;
+	port->div = port->clock / port->baud / 16;
 
 	/* set the divisor */
-	outb(serial_iobase + LINE_CTRL_REG, LINE_CTRL_DLAB);
-	outb(serial_iobase + DIVISOR_LOW_REG, serial_div & 0xff);
-	outb(serial_iobase + DIVISOR_HI_REG, (serial_div >> 8) & 0xff);
-	outb(serial_iobase + LINE_CTRL_REG, 0x0); /* clear DLAB */
+	outb(iobase + LINE_CTRL_REG, LINE_CTRL_DLAB);
+	outb(iobase + DIVISOR_LOW_REG, port->div & 0xff);
+	outb(iobase + DIVISOR_HI_REG, (port->div >> 8) & 0xff);
+	outb(iobase + LINE_CTRL_REG, 0x0); /* clear DLAB */
 
 	/* Set bits, parity, stop */
-	outb((serial_iobase + LINE_CTRL_REG), serial_flags);
+	outb((iobase + LINE_CTRL_REG), port->flags);
 
 	/* Clear Interrupts */
-	outb(serial_iobase + INTR_ENABLE_REG, 0x0);
-	outb(serial_iobase + MODEM_CTRL_REG, 0x0);
+	outb(iobase + INTR_ENABLE_REG, 0x0);
+	outb(iobase + MODEM_CTRL_REG, 0x0);
 
 	/* Print using printk() so the information can show up on alternate
 	 * output devices */
-	printk("serial_init: iobase=0x%x, baud=%d, flags=0x%x, div=0x%x\n",
-			serial_iobase, serial_baud,
-			serial_flags, serial_div);
+	printk("serial_init: %s iobase=0x%x, baud=%d, flags=0x%x, div=0x%x\n",
+			port->name, iobase, port->baud,
+			port->flags, port->div);
 }
 
 /**
- * Write the character to the serial port
+ * Reading the line status clears the overrun bit, so every read goes
+ * through here to have it counted whoever is looking
  */
-int serial_putc(int c)
+static uint8_t serial_line_status(struct serial_port *port)
 {
-	uint32_t count = 0;
-	uint8_t status = 0;
+	uint8_t status = inb(port->iobase + LINE_STATUS_REG);
 
-	if (!serial_iobase) {
-		return 0;
+	if (status & LINE_STATUS_OVERRUN) {
+		atomic_inc(&port->rx_overruns);
 	}
+	return status;
+}
 
-	if (c == '\n') {
-		serial_putc('\r');
-	}
+/**
+ * Wait for the transmitter to take more
+ * @return 0 if it never did
+ */
+static int serial_tx_wait(struct serial_port *port)
+{
+	uint32_t count = 0;
 
 	/* Wait for TX_READY bit to be set */
 	/* FIXME we should have a sleep/delay in here */
 	while (count++ < 1000) {
-		status = inb(serial_iobase + LINE_STATUS_REG);
+		if (serial_line_status(port) & LINE_STATUS_TX_READY) {
+			return 1;
+		}
+	}
 
-		if (status & LINE_STATUS_TX_READY) {
-			break;
+	/* ETIMEOUT? */
+	return 0;
+}
+
+/**
+ * Send c, only waiting for the transmitter once room runs out
+ * @room bytes the transmitter is known to take without checking again
+ */
+static int serial_tx(struct serial_port *port, uint32_t *room, int c)
+{
+	if (!*room) {
+		if (!serial_tx_wait(port)) {
+			return 0;
+		}
+		*room = port->burst;
+	}
+
+	outb(port->iobase + TX_HOLD_REG, c & 0xFF);
+	(*room)--;
+	return 1;
+}
+
+/**
+ * Move as much of the ring as it will take into the transmitter.  Called
+ * with the port's tx_lock held.
+ * @wait poll until the transmitter is ready rather than leave it to the
+ * interrupt
+ */
+static int serial_tx_fill(struct serial_port *port, int wait)
+{
+	uint32_t head = atomic_load(&port->tx_head, ATOMIC_ACQUIRE);
+	uint32_t tail = port->tx_tail;
+	uint32_t room;
+
+	if (tail == head) {
+		return 1;
+	}
+
+	if (wait) {
+		if (!serial_tx_wait(port)) {
+			return 0;
+		}
+	} else if (!(serial_line_status(port) & LINE_STATUS_TX_READY)) {
+		return 1;
+	}
+
+	for (room = port->burst; room && tail != head; room--) {
+		outb(port->iobase + TX_HOLD_REG,
+				port->tx_ring[tail++ & (SERIAL_TX_RING - 1)]);
+	}
+	atomic_store(&port->tx_tail, tail, ATOMIC_RELEASE);
+	return 1;
+}
+
+static int serial_tx_kick(struct serial_port *port, int wait)
+{
+	unsigned long flags;
+	int ret;
+
+	flags = irq_save();
+	spin_lock(&port->tx_lock);
+	ret = serial_tx_fill(port, wait);
+	spin_unlock(&port->tx_lock);
+	irq_restore(flags);
+	return ret;
+}
+
+/* Add c to the ring, waiting on the transmitter when the ring is full */
+static int serial_tx_queue(struct serial_port *port, int c)
+{
+	uint32_t head = port->tx_head;
+
+	while (head - atomic_load(&port->tx_tail, ATOMIC_ACQUIRE) ==
+			SERIAL_TX_RING) {
+		if (!serial_tx_kick(port, 1)) {
+			return 0;
 		}
 	}
 
-	if (!(status & LINE_STATUS_TX_READY)) {
-		/* ETIMEOUT? */
-		return -1;
+	port->tx_ring[head & (SERIAL_TX_RING - 1)] = c;
+	atomic_store(&port->tx_head, head + 1, ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ * Send buf, turning each \n into \r\n.  Only one caller at a time.
+ * @return 0 if the transmitter stopped taking anything
+ */
+static int serial_send(struct serial_port *port, const char *buf, size_t len)
+{
+	uint32_t room = 0;
+
+	if (port->irq) {
+		for (; len; len--, buf++) {
+			if (*buf == '\n' && !serial_tx_queue(port, '\r')) {
+				return 0;
+			}
+			if (!serial_tx_queue(port, *buf)) {
+				return 0;
+			}
+		}
+
+		/* Start off the transmitter if it has gone quiet */
+		return serial_tx_kick(port, 0);
 	}
 
-	outb(serial_iobase + TX_HOLD_REG, c & 0xFF);
+	for (; len; len--, buf++) {
+		if (*buf == '\n' && !serial_tx(port, &room, '\r')) {
+			return 0;
+		}
+		if (!serial_tx(port, &room, *buf)) {
+			return 0;
+		}
+	}
 	return 1;
 }
 
-void serial_init(uint32_t iobase, uint32_t baud, uint8_t flags,
-		uint16_t divisor)
+/**
+ * @index port number, 0 through 3 are COM1 through COM4
+ * @return the port, or NULL if it has not been set up
+ */
+struct serial_port * serial_get(int index)
+{
+	if (index < 0 || index >= SERIAL_PORTS ||
+	    !serial_ports[index].iobase) {
+		return NULL;
+	}
+	return &serial_ports[index];
+}
+
+/**
+ * Write the character to the serial port
+ */
+int serial_putc(struct serial_port *port, int c)
+{
+	char ch = c;
+
+	if (!port || !port->iobase) {
+		return 0;
+	}
+
+	return serial_send(port, &ch, 1) ? 1 : -1;
+}
+
+/**
+ * Write buf to a port which is not carrying the kernel log, which would
+ * otherwise be writing to it as well
+ * @return len, or -1 if the transmitter stopped taking anything
+ */
+int serial_write(struct serial_port *port, const char *buf, size_t len)
+{
+	if (!port || !port->iobase) {
+		return 0;
+	}
+
+	return serial_send(port, buf, len) ? (int)len : -1;
+}
+
+static void serial_console_write(struct console *con, const char *buf,
+		size_t len)
+{
+	serial_send(serial_con(con), buf, len);
+}
+
+/* Wait for the ring to empty, for when there may be no interrupt to come */
+static void serial_console_flush(struct console *con)
 {
-	if (iobase) {
-		serial_iobase = iobase;
+	struct serial_port *port = serial_con(con);
+	unsigned long flags;
+
+	if (!port->irq) {
+		return;
+	}
+
+	flags = irq_save();
+	spin_lock(&port->tx_lock);
+	while (port->tx_tail != atomic_load(&port->tx_head, ATOMIC_ACQUIRE)) {
+		if (!serial_tx_fill(port, 1)) {
+			break;
+		}
+	}
+	spin_unlock(&port->tx_lock);
+	irq_restore(flags);
+}
+
+/**
+ * Move everything the receiver holds into the ring.  Only one caller at a
+ * time, the interrupt handler or else serial_read().
+ */
+static void serial_rx(struct serial_port *port)
+{
+	uint32_t head = port->rx_head;
+
+	while (serial_line_status(port) & LINE_STATUS_RX_DATA) {
+		char c = inb(port->iobase + RX_BUFF_REG);
+
+		port->rx_bytes++;
+		if (head - atomic_load(&port->rx_tail, ATOMIC_ACQUIRE) ==
+				SERIAL_RX_RING) {
+			port->rx_dropped++;
+			continue;
+		}
+		port->rx_ring[head++ & (SERIAL_RX_RING - 1)] = c;
+		atomic_store(&port->rx_head, head, ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * @buf filled with whatever input has arrived
+ * @len size of buf
+ * @return bytes read, 0 if there was nothing, never waits
+ *
+ * Only one reader at a time for each port.
+ */
+int serial_read(struct serial_port *port, char *buf, size_t len)
+{
+	uint32_t tail, head;
+	int count = 0;
+
+	if (!port || !port->iobase) {
+		return 0;
+	}
+
+	if (!port->irq) {
+		serial_rx(port);
+	}
+
+	tail = port->rx_tail;
+	head = atomic_load(&port->rx_head, ATOMIC_ACQUIRE);
+	while (tail != head && len--) {
+		buf[count++] = port->rx_ring[tail++ & (SERIAL_RX_RING - 1)];
+	}
+
+	/* The bytes are copied out before their room can be reused */
+	atomic_store(&port->rx_tail, tail, ATOMIC_RELEASE);
+	return count;
+}
+
+void serial_report(void)
+{
+	struct serial_port *port;
+	int index;
+
+	for (index = 0; index < SERIAL_PORTS; index++) {
+		port = &serial_ports[index];
+		if (!port->iobase) {
+			continue;
+		}
+		printk("serial: %s %u bytes received, %u dropped, "
+				"%u overruns\n", port->name, port->rx_bytes,
+				port->rx_dropped, port->rx_overruns);
+	}
+}
+
+/* Service every port sharing the line, until none has anything left */
+static void serial_interrupt(void *arg)
+{
+	struct serial_port *port;
+	int irq = (unsigned long)arg;
+	int index, busy;
+	uint8_t status;
+
+	do {
+		busy = 0;
+		for (index = 0; index < SERIAL_PORTS; index++) {
+			port = &serial_ports[index];
+			if (port->irq != irq) {
+				continue;
+			}
+
+			status = inb(port->iobase + INTR_STATUS_REG);
+			if (status & INTR_STATUS_NONE) {
+				continue;
+			}
+			busy = 1;
+
+			switch (status & INTR_STATUS_ID) {
+			case INTR_STATUS_TX_READY:
+				spin_lock(&port->tx_lock);
+				serial_tx_fill(port, 0);
+				spin_unlock(&port->tx_lock);
+				break;
+			case INTR_STATUS_RX_DATA:
+			case INTR_STATUS_RX_TIMEOUT:
+			case INTR_STATUS_LINE:
+				serial_rx(port);
+				break;
+			case INTR_STATUS_MODEM:
+				inb(port->iobase + MODEM_STATUS_REG);
+				break;
+			}
+		}
+	} while (busy);
+}
+
+/* Use the FIFO of a 16550A, anything older takes a byte at a time */
+static void serial_fifo_init(struct serial_port *port)
+{
+	uint32_t count = 0;
+
+	/* Changing the FIFO mode clears it, so let the bootloader finish */
+	while (count++ < 1000) {
+		if (serial_line_status(port) & LINE_STATUS_TSR) {
+			break;
+		}
+	}
+
+	outb(port->iobase + FIFO_CTRL_REG, FIFO_CTRL_ENABLE |
+			FIFO_CTRL_CLEAR_RX | FIFO_CTRL_CLEAR_TX |
+			FIFO_CTRL_RX_TRIG8);
+	if ((inb(port->iobase + INTR_STATUS_REG) & INTR_STATUS_FIFO) ==
+			INTR_STATUS_FIFO_OK) {
+		port->burst = FIFO_SIZE;
+		return;
+	}
+
+	outb(port->iobase + FIFO_CTRL_REG, 0x0);
+	port->burst = 1;
+}
+
+/* From here on output is queued for the TX ready interrupt to send, and
+ * input is taken in as it arrives.  COM1 and COM3, or COM2 and COM4, share
+ * a line and the one handler serves both. */
+static void serial_irq_init(struct serial_port *port, int irq)
+{
+	int index;
+
+	for (index = 0; index < SERIAL_PORTS; index++) {
+		if (serial_ports[index].irq == irq) {
+			break;
+		}
+	}
+	if (index == SERIAL_PORTS &&
+	    !irq_register(irq, serial_interrupt, (void *)(unsigned long)irq)) {
+		return;
+	}
+	port->irq = irq;
+}
+
+/* Has to be done again whenever __serial_init() has cleared it */
+static void serial_irq_enable(struct serial_port *port)
+{
+	outb(port->iobase + MODEM_CTRL_REG,
+			inb(port->iobase + MODEM_CTRL_REG) | MODEM_CTRL_INTR1);
+	outb(port->iobase + INTR_ENABLE_REG, INTR_CTRL_RX_DATA |
+			INTR_CTRL_LINE_STATUS | INTR_CTRL_TX_READY);
+}
+
+/* The slot for iobase, preferring its usual COM number */
+static struct serial_port * serial_port_find(uint32_t iobase)
+{
+	int index;
+
+	for (index = 0; index < SERIAL_PORTS; index++) {
+		if (serial_ports[index].iobase == iobase) {
+			return &serial_ports[index];
+		}
+	}
+	for (index = 0; index < SERIAL_PORTS; index++) {
+		if (serial_com_iobase[index] == iobase &&
+		    !serial_ports[index].iobase) {
+			return &serial_ports[index];
+		}
+	}
+	for (index = 0; index < SERIAL_PORTS; index++) {
+		if (!serial_ports[index].iobase) {
+			return &serial_ports[index];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @iobase I/O port of the UART, 0 for COM1
+ * @baud line speed, 0 to leave the port as the bootloader set it up
+ * @flags SERIAL_* line settings, 0 for the current ones
+ * @divisor clock divisor, 0 to work it out from baud
+ * @irq interrupt line for queued output and input, 0 to poll the UART
+ * @console non-zero to have the kernel log written to the port
+ * @return the port, or NULL if every one is already taken
+ *
+ * Calling it again for the same iobase changes the settings of that port.
+ */
+struct serial_port * serial_init(uint32_t iobase, uint32_t baud,
+		uint8_t flags, uint16_t divisor, int irq, int console)
+{
+	struct serial_port *port;
+
+	if (!iobase) {
+		iobase = DEFAULT_IOBASE;
+	}
+
+	port = serial_port_find(iobase);
+	if (!port) {
+		printk("error: no serial port left for iobase 0x%x\n", iobase);
+		return NULL;
+	}
+
+	if (!port->iobase) {
+		port->name = serial_names[port - serial_ports];
+		port->clock = DEFAULT_CLOCK;
+		port->baud = DEFAULT_BAUD;
+		port->div = DEFAULT_CLOCK / DEFAULT_BAUD / 16;
+		port->flags = LINE_CTRL_8BIT; /* 8n1 */
+		port->burst = 1;
+		port->console.name = port->name;
+		port->console.write = serial_console_write;
+		port->console.flush = serial_console_flush;
+		spin_lock_init(&port->tx_lock, port->name);
+		port->iobase = iobase;
+	}
+
+	if (console) {
+		console_register(&port->console);
 	}
 
 	if (flags) {
-		serial_flags = flags;
+		port->flags = flags;
 	}
 
 	/* Compute everything every way we can */
 	if (divisor && baud) {
-		serial_baud = baud;
-		serial_div = divisor;
-		serial_clock = divisor * baud * 16;
+		port->baud = baud;
+		port->div = divisor;
+		port->clock = divisor * baud * 16;
 	} else if (baud) {
-		serial_baud = baud;
-		serial_div = serial_clock / baud / 16;
+		port->baud = baud;
+		port->div = port->clock / baud / 16;
 	} else if (divisor) {
-		serial_div = divisor;
-		serial_baud = serial_clock / divisor / 16;
+		port->div = divisor;
+		port->baud = port->clock / divisor / 16;
 	}
 
 	/* Only initialize the port if it was requested.  This allows
 	 * transparent use of the serial console which may have been setup by
 	 * the BIOS or the bootloader */
 	if (baud) {
-		__serial_init();
+		__serial_init(port);
+	}
+
+	serial_fifo_init(port);
+	if (irq && !port->irq) {
+		serial_irq_init(port, irq);
 	}
+	if (port->irq) {
+		serial_irq_enable(port);
+	}
+
+	printk("serial_init: %s iobase=0x%x, fifo=%d, irq=%d\n", port->name,
+			port->iobase, port->burst, port->irq);
+	return port;
 }
@@ -0,0 +1,270 @@
+/* bootmem.c - Early boot page allocator */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Until the page allocator is running, memory for boot time structures comes
+ * from here.  bootmem_init() works out once which pages of available memory
+ * are not already holding the kernel, the multiboot information or the boot
+ * modules, and bootmem_alloc() then carves aligned runs out of those.  Every
+ * run handed out is recorded so that init_malloc() can reserve it in the pmap
+ * before the page allocator is seeded, after which bootmem is retired.
+ *
+ * Everything lives in fixed tables as there is nothing to allocate them from.
+ */
+#include <fmios/fmios.h>
+#include <fmios/malloc.h>
+#include <fmios/page.h>
+#include <fmios/io.h>
+
+#include <multiboot.h>
+#include <string.h>
+
+extern unsigned long kernel_start;
+extern unsigned long kernel_end;
+
+#define BOOTMEM_RANGES	64
+#define BOOTMEM_LOW	PAGE_NUM(1024 * 1024)
+
+static struct bootmem_range bootmem_free[BOOTMEM_RANGES];
+static struct bootmem_range bootmem_used[BOOTMEM_RANGES];
+static int bootmem_free_count = 0;
+static int bootmem_used_count = 0;
+static int bootmem_retired = 0;
+
+static void bootmem_free_add(uint32_t start, uint32_t end)
+{
+	if (start > end) {
+		return;
+	}
+
+	if (bootmem_free_count == BOOTMEM_RANGES) {
+		printk("bootmem: ignoring free pages 0x%x-0x%x\n", start, end);
+		return;
+	}
+
+	bootmem_free[bootmem_free_count].start = start;
+	bootmem_free[bootmem_free_count].end = end;
+	bootmem_free_count++;
+}
+
+/* Take start through end back out of the free table.  Splitting a range
+ * needs another slot, and should there be none the top of the range is
+ * dropped rather than risk handing out pages which are in use. */
+static void bootmem_free_remove(uint32_t start, uint32_t end)
+{
+	struct bootmem_range *range;
+	uint32_t top;
+	int index;
+
+	for (index = 0; index < bootmem_free_count; index++) {
+		range = &bootmem_free[index];
+		if (range->end < start || range->start > end) {
+			continue;
+		}
+
+		top = range->end;
+		if (range->start < start) {
+			range->end = start - 1;
+		} else if (top > end) {
+			range->start = end + 1;
+			continue;
+		} else {
+			bootmem_free_count--;
+			memmove(range, range + 1, (bootmem_free_count - index) *
+					sizeof(struct bootmem_range));
+			index--;
+			continue;
+		}
+
+		if (top > end) {
+			bootmem_free_add(end + 1, top);
+		}
+	}
+}
+
+/**
+ * Build the table of free memory from the multiboot memory map less the
+ * regions already in use: the kernel, the multiboot information and every
+ * boot module, however many there are.  Page 0 is never handed out.
+ */
+void bootmem_init(void)
+{
+	int mmap_count = mb_mmap_count();
+	int mod_count = mb_mod_count();
+	int index;
+
+	for (index = 0; index < mmap_count; index++) {
+		uint32_t start, end;
+
+		if (mb_mmap_type(index) != MULTIBOOT_MEMORY_AVAILABLE) {
+			continue;
+		}
+
+		/* Only whole pages are of any use */
+		start = PAGE_NUM(mb_mmap_start(index) + PAGE_SIZE - 1);
+		end = PAGE_NUM(mb_mmap_end(index));
+		if (!start) {
+			start++;
+		}
+		if (start >= end) {
+			continue;
+		}
+		bootmem_free_add(start, end - 1);
+	}
+
+	bootmem_free_remove(PAGE_NUM(kernel_start), PAGE_NUM(kernel_end));
+	bootmem_free_remove(PAGE_NUM(mb_mbi_start()), PAGE_NUM(mb_mbi_end()));
+
+	for (index = 0; index < mod_count; index++) {
+		if (!mb_mod_start(index) || !mb_mod_end(index)) {
+			continue;
+		}
+		bootmem_free_remove(PAGE_NUM(mb_mod_start(index)),
+				PAGE_NUM(mb_mod_end(index)));
+	}
+}
+
+static int bootmem_used_add(uint32_t start, uint32_t end)
+{
+	int index;
+
+	for (index = 0; index < bootmem_used_count; index++) {
+		if (bootmem_used[index].end + 1 == start) {
+			bootmem_used[index].end = end;
+			return 1;
+		}
+		if (bootmem_used[index].start == end + 1) {
+			bootmem_used[index].start = start;
+			return 1;
+		}
+	}
+
+	if (bootmem_used_count == BOOTMEM_RANGES) {
+		return 0;
+	}
+
+	bootmem_used[bootmem_used_count].start = start;
+	bootmem_used[bootmem_used_count].end = end;
+	bootmem_used_count++;
+	return 1;
+}
+
+/* Take the first aligned run of count pages lying within first and last */
+static unsigned long bootmem_take(size_t count, unsigned long align,
+		uint32_t first, uint32_t last)
+{
+	struct bootmem_range *range;
+	int index;
+
+	if (bootmem_retired) {
+		printk("error: bootmem_alloc() after the page allocator is up\n");
+		return 0;
+	}
+
+	if (!align) {
+		align = 1;
+	}
+	if (!count || (align & (align - 1))) {
+		return 0;
+	}
+
+	for (index = 0; index < bootmem_free_count; index++) {
+		uint32_t page;
+
+		range = &bootmem_free[index];
+		if (range->end < first || range->start > last) {
+			continue;
+		}
+
+		page = range->start;
+		if (page < first) {
+			page = first;
+		}
+		page = (page + align - 1) & ~(align - 1);
+		if (page < range->start || page + count - 1 > range->end ||
+		    page + count - 1 > last) {
+			continue;
+		}
+
+		if (!bootmem_used_add(page, page + count - 1)) {
+			printk("error: bootmem_alloc() out of ranges\n");
+			return 0;
+		}
+
+		/* Whatever was skipped over stays free */
+		if (page > range->start) {
+			bootmem_free_add(range->start, page - 1);
+		}
+		range->start = page + count;
+		if (range->start > range->end) {
+			*range = bootmem_free[--bootmem_free_count];
+		}
+		return page;
+	}
+
+	return 0;
+}
+
+/**
+ * @count number of contiguous pages wanted
+ * @align alignment of the first page number in pages, 0 or 1 for none
+ * @return page number of the first page, or 0 on failure
+ *
+ * Memory above 1MiB is preferred so that low memory stays available for
+ * anything which really needs it.
+ */
+unsigned long bootmem_alloc(size_t count, unsigned long align)
+{
+	unsigned long page;
+
+	page = bootmem_take(count, align, BOOTMEM_LOW, ~0U);
+	if (!page) {
+		page = bootmem_take(count, align, 0, ~0U);
+	}
+	return page;
+}
+
+/**
+ * @count number of contiguous pages wanted
+ * @return page number of the first page below 1MiB, or 0 on failure
+ *
+ * For things which have to be reachable from real mode.
+ */
+unsigned long bootmem_alloc_low(size_t count)
+{
+	return bootmem_take(count, 1, 0, BOOTMEM_LOW - 1);
+}
+
+/**
+ * @ranges set to the table of runs handed out by bootmem_alloc()
+ * @return number of entries in the table
+ */
+int bootmem_used_ranges(const struct bootmem_range **ranges)
+{
+	*ranges = bootmem_used;
+	return bootmem_used_count;
+}
+
+/* The page allocator owns memory from here on */
+void bootmem_retire(void)
+{
+	bootmem_retired = 1;
+}
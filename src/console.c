@@ -0,0 +1,148 @@
+/* console.c - Console driver registry */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Consoles register once from their driver's init and are never removed,
+ * so the list only ever grows at the head and can be walked without a
+ * lock.  Writing to them is serialised by the kernel log, which is the only
+ * caller of console_write().
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/console.h>
+#include <fmios/klog.h>
+#include <fmios/io.h>
+#include <asm/processor.h>
+
+static struct console *consoles = NULL;
+
+/* Nothing happens if con is already registered */
+void console_register(struct console *con)
+{
+	struct console *head, *walk;
+
+	do {
+		head = atomic_load(&consoles, ATOMIC_ACQUIRE);
+		for (walk = head; walk; walk = walk->next) {
+			if (walk == con) {
+				return;
+			}
+		}
+		con->next = head;
+	} while (atomic_cmpxchg(&consoles, head, con, ATOMIC_RELEASE) != head);
+}
+
+/* Give buf to every console */
+void console_write(const char *buf, size_t len)
+{
+	struct console *con;
+
+	for (con = atomic_load(&consoles, ATOMIC_ACQUIRE); con;
+			con = con->next) {
+		con->write(con, buf, len);
+	}
+}
+
+/* Wait for every console to have written out whatever it has queued */
+void console_flush(void)
+{
+	struct console *con;
+
+	for (con = atomic_load(&consoles, ATOMIC_ACQUIRE); con;
+			con = con->next) {
+		if (con->flush) {
+			con->flush(con);
+		}
+	}
+}
+
+#define CONSOLE_BENCH_LINE	"console: benchmark line, the quick brown fox " \
+				"jumps over the lazy dog\n"
+#define CONSOLE_BENCH_MAX	8
+
+/* Rate of lines per million cycles, allowing for a clock which never moved */
+static uint32_t console_rate(unsigned long lines, uint64_t cycles)
+{
+	return (uint64_t)lines * 1000000 / (cycles ? cycles : 1);
+}
+
+/**
+ * @lines lines written to each console each way
+ *
+ * Write a printk() sized line to every console, first a line at a time as
+ * the log does and then a byte at a time as printk() used to, and report
+ * both rates.  The consoles are not shared while this runs, so it should be
+ * the only thing logging.  There is no calibrated clock, so rates are per
+ * million tsc cycles.
+ */
+void console_bench(unsigned long lines)
+{
+	static const char line[] = CONSOLE_BENCH_LINE;
+	struct console *con, *list[CONSOLE_BENCH_MAX];
+	uint64_t batched[CONSOLE_BENCH_MAX], bytewise[CONSOLE_BENCH_MAX];
+	uint64_t start;
+	unsigned long count;
+	size_t index;
+	int found = 0;
+	int which;
+
+	if (!lines) {
+		return;
+	}
+
+	/* Nothing else may reach the consoles until the results are in */
+	klog_flush();
+
+	for (con = atomic_load(&consoles, ATOMIC_ACQUIRE);
+			con && found < CONSOLE_BENCH_MAX; con = con->next) {
+		list[found] = con;
+
+		start = rdtsc();
+		for (count = 0; count < lines; count++) {
+			con->write(con, line, sizeof(line) - 1);
+		}
+		if (con->flush) {
+			con->flush(con);
+		}
+		batched[found] = rdtsc() - start;
+
+		start = rdtsc();
+		for (count = 0; count < lines; count++) {
+			for (index = 0; index < sizeof(line) - 1; index++) {
+				con->write(con, &line[index], 1);
+			}
+		}
+		if (con->flush) {
+			con->flush(con);
+		}
+		bytewise[found] = rdtsc() - start;
+
+		found++;
+	}
+
+	for (which = 0; which < found; which++) {
+		printk("console %s: %u lines of %u bytes, %u per million cycles "
+				"a line at a time, %u a byte at a time\n",
+				list[which]->name, lines, sizeof(line) - 1,
+				console_rate(lines, batched[which]),
+				console_rate(lines, bytewise[which]));
+	}
+}
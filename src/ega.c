@@ -20,6 +20,7 @@
 */
 
 #include <fmios/types.h>
+#include <fmios/console.h>
 #include <fmios/io.h>
 
 #define VIDEO_ADDR	0xb8000
@@ -81,18 +82,14 @@ static void __ega_putc(int c) {
 }
 
 /**
- * Place a character on next screen position
+ * Place a character on next screen position, leaving the cursor behind
  */
-int ega_putc(int c)
+static void ega_emit(int c)
 {
-	if (!video_addr) {
-		return 0;
-	}
-
 	switch (c) {
 	case '\t':
 		do {
-			ega_putc(' ');
+			ega_emit(' ');
 		} while (cur_col % 8);
 		break;
 	case '\r':
@@ -122,11 +119,41 @@ int ega_putc(int c)
 			}
 		}
 	};
+}
+
+/**
+ * Place a character on next screen position
+ */
+int ega_putc(int c)
+{
+	if (!video_addr) {
+		return 0;
+	}
+
+	ega_emit(c);
 	update_cursor();
 
 	return 1;
 }
 
+/* The cursor only needs to catch up once the whole buffer is on screen */
+static void ega_write(struct console *con, const char *buf, size_t len)
+{
+	if (!video_addr) {
+		return;
+	}
+
+	while (len--) {
+		ega_emit(*buf++);
+	}
+	update_cursor();
+}
+
+static struct console ega_console = {
+	.name	= "ega",
+	.write	= ega_write,
+};
+
 void ega_init(uint32_t addr, uint8_t cols, uint8_t rows)
 {
 	if (addr) {
@@ -141,6 +168,10 @@ void ega_init(uint32_t addr, uint8_t cols, uint8_t rows)
 		cur_row = rows - 1;
 	}
 
+	if (video_addr) {
+		console_register(&ega_console);
+	}
+
 	/* Use printk to display the data so that the message shows up on all
 	 * outputs */
 	printk("ega_init: addr=0x%x, cols=%d, rows=%d\n",
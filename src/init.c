@@ -1,8 +1,20 @@
 #include <fmios/fmios.h>
 #include <fmios/malloc.h>
+#include <fmios/slab.h>
+#include <fmios/paging.h>
+#include <fmios/mmap.h>
+#include <fmios/sched.h>
+#include <fmios/smp.h>
+#include <fmios/syscall.h>
 #include <fmios/serial.h>
 #include <fmios/video.h>
+#include <fmios/ipc.h>
+#include <fmios/pid.h>
+#include <fmios/rcu.h>
+#include <fmios/console.h>
 #include <fmios/io.h>
+#include <fmios/klog.h>
+#include <asm/irq.h>
 #include <multiboot.h>
 #include <string.h>
 
@@ -55,25 +67,23 @@ static void init_video(char *cmdline, struct video_config *config)
 	}
 }
 
-static void init_serial(char *cmdline)
+/* @return where the next serial= entry can be looked for from */
+static char * init_serial_port(char *param)
 {
 	uint32_t iobase = 0;
 	uint32_t baud = 0;
 	uint16_t divisor = 0;
 	uint8_t flags = 0;
-	char *param;
-
-	param = cmdline_get_opt(cmdline, "serial");
+	int irq = 0;
+	int console = 1;
 
 	/* cmdline param will be in the format of:
-	 * [iobase][,baud][,flags][,divisor]
+	 * [iobase][,baud][,flags][,divisor][,irq][,tty]
+	 * an irq switches the port from polling to interrupts, and a tty
+	 * port is left for interactive use instead of carrying the kernel log
 	 */
-	if (!param) {
-		return;
-	}
-
 	if (strncmp("off", param, 3) == 0) {
-		return;
+		return param;
 	}
 
 	iobase = strtol(param, &param, 0);
@@ -136,10 +146,196 @@ static void init_serial(char *cmdline)
 	}
 
 	if (*param == ',') {
-		divisor = strtol(param, &param, 0);
+		divisor = strtol(++param, &param, 0);
+	}
+
+	if (*param == ',') {
+		irq = strtol(++param, &param, 0);
+	}
+
+	if (*param == ',' && strncmp("tty", ++param, 3) == 0) {
+		console = 0;
+		param += 3;
+	}
+
+	serial_init(iobase, baud, flags, divisor, irq, console);
+	return param;
+}
+
+/* Every serial= entry sets up another port */
+static void init_serial(char *cmdline)
+{
+	char *param;
+
+	for (param = cmdline_get_opt(cmdline, "serial"); param;
+			param = cmdline_get_opt(param, "serial")) {
+		param = init_serial_port(param);
+	}
+}
+
+/* Rounds sched_bench() times for each of its figures */
+#define INIT_SCHED_ROUNDS	10000
+/* Null calls syscall_bench() times each way */
+#define INIT_SYSCALL_CALLS	100000
+/* Messages ipc_bench() passes through its channel */
+#define INIT_IPC_MESSAGES	100000
+/* Round trips ipc_call_bench() makes */
+#define INIT_IPC_CALLS		100000
+/* pid_alloc()/pid_free() pairs per pid_bench() task */
+#define INIT_PID_ALLOCS		100000
+/* Reads per rcu_bench() reader and way of reading */
+#define INIT_RCU_READS		100000
+/* Lines console_bench() writes each way, slow consoles take a while */
+#define INIT_CONSOLE_LINES	100
+
+/* Something bench= or stats= can ask for by name */
+struct init_run {
+	const char	*name;
+	void		(*run)(void);
+};
+
+static void init_bench_sched(void)
+{
+	sched_bench(INIT_SCHED_ROUNDS);
+}
+
+static void init_bench_syscall(void)
+{
+	syscall_bench(INIT_SYSCALL_CALLS);
+}
+
+static void init_bench_ipc(void)
+{
+	ipc_bench(INIT_IPC_MESSAGES);
+}
+
+static void init_bench_ipc_call(void)
+{
+	ipc_call_bench(INIT_IPC_CALLS);
+}
+
+static void init_bench_pid(void)
+{
+	pid_bench(INIT_PID_ALLOCS);
+}
+
+static void init_bench_rcu(void)
+{
+	rcu_bench(INIT_RCU_READS);
+}
+
+static void init_bench_console(void)
+{
+	console_bench(INIT_CONSOLE_LINES);
+}
+
+static const struct init_run init_benches[] = {
+	{ "sched", init_bench_sched },
+	{ "syscall", init_bench_syscall },
+	{ "ipc", init_bench_ipc },
+	{ "ipc-call", init_bench_ipc_call },
+	{ "pid", init_bench_pid },
+	{ "rcu", init_bench_rcu },
+	{ "console", init_bench_console },
+	{ NULL, NULL }
+};
+
+static const struct init_run init_stats[] = {
+	{ "sched", sched_report },
+	{ "lock", lock_stat_report },
+	{ "rcu", rcu_report },
+	{ "klog", klog_report },
+	{ "serial", serial_report },
+	{ NULL, NULL }
+};
+
+/* Benchmarks run in tasks of their own, and only once they are all gone is
+ * the next one started.  Nothing at a lower priority than us gets to run, so
+ * the log is written out from here rather than from the idle loop. */
+static void init_run_wait(void)
+{
+	while (sched_task_count() > 1) {
+		klog_flush();
+		irq_window();
+		yield();
 	}
+	klog_flush();
+}
 
-	serial_init(iobase, baud, flags, divisor);
+/**
+ * @param value of a bench= or stats= entry, a comma separated list of names
+ * @table what the names can be
+ * @return where the next entry can be looked for from
+ */
+static char * init_run_list(char *param, const struct init_run *table)
+{
+	const struct init_run *entry;
+	char name[16];
+	size_t len;
+
+	while (*param != '\0' && *param != ' ') {
+		for (len = 0; param[len] != '\0' && param[len] != ' ' &&
+				param[len] != ','; len++);
+
+		for (entry = table; entry->name; entry++) {
+			if (strlen(entry->name) == len &&
+					!strncmp(entry->name, param, len)) {
+				break;
+			}
+		}
+
+		if (entry->name) {
+			entry->run();
+			init_run_wait();
+		} else {
+			if (len >= sizeof(name)) {
+				len = sizeof(name) - 1;
+			}
+			memcpy(name, param, len);
+			name[len] = '\0';
+			printk("error: nothing called %s to run\n", name);
+		}
+
+		for (param += len; *param != '\0' && *param != ' ' &&
+				*param != ','; param++);
+		if (*param == ',') {
+			param++;
+		}
+	}
+	return param;
+}
+
+/* Runs every bench= entry in the order given, then every stats= one */
+static void init_run_task(void *arg)
+{
+	char *cmdline = arg;
+	char *param;
+
+	for (param = cmdline_get_opt(cmdline, "bench"); param;
+			param = cmdline_get_opt(param, "bench")) {
+		param = init_run_list(param, init_benches);
+	}
+
+	for (param = cmdline_get_opt(cmdline, "stats"); param;
+			param = cmdline_get_opt(param, "stats")) {
+		param = init_run_list(param, init_stats);
+	}
+}
+
+/* cmdline params are in the format of bench=<name>[,<name>...] and
+ * stats=<name>[,<name>...], run once the scheduler is up.  Nothing else is
+ * left to run by then, so the system halts once they are done. */
+static void init_run(char *cmdline)
+{
+	if (!cmdline_get_opt(cmdline, "bench") &&
+			!cmdline_get_opt(cmdline, "stats")) {
+		return;
+	}
+
+	if (!task_create("init-run", init_run_task, cmdline,
+			SCHED_PRIO_IDLE - 1)) {
+		printk("error: unable to start the bench= and stats= runs\n");
+	}
 }
 
 /* These routines are platform specific and must be defined to boot */
@@ -180,6 +376,17 @@ static int __init_paging(struct pmap_table *pmap)
 }
 weak_symbol(__init_paging, init_paging);
 
+/* Uniprocessor platforms have nothing to reserve or start */
+static void __smp_reserve(void)
+{
+}
+weak_symbol(__smp_reserve, smp_reserve);
+
+static void __init_smp(void)
+{
+}
+weak_symbol(__init_smp, init_smp);
+
 /** Start of OS independant initialization
  * @magic Multiboot magic number
  * @addr Address of Multiboot Information Structure
@@ -224,17 +431,24 @@ int fmios_init(unsigned long magic, unsigned long addr)
 	 * usable until after paging is enabled, but we can not initialize
 	 * paging until we have the initial bit-buckets for malloc setup and
 	 * have a map of existing memory */
+	bootmem_init();
+	smp_reserve();
 	pmap = init_malloc();
 	if (!pmap) {
 		printk("error initializing memory\n");
 		return 1;
 	}
+	kmem_init();
 
 	if (!init_paging(pmap)) {
 		printk("error initializing paging\n");
 		return 1;
 	}
 	printk("Paging enabled.\n");
+	mmap_init();
+	sched_init();
+	init_smp();
+	init_run(cmdline);
 
 	/* At this point we return to to boot.S/entry.S to clear the stack and
 	 * to allow any extra platform specific code to be fired off.  From
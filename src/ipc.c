@@ -0,0 +1,515 @@
+/* ipc.c - Shared memory message rings */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * A channel is a single producer, single consumer ring of fixed size slots
+ * in a shared mapping.  Messages are built and read in place: the producer
+ * fills the slot ipc_send_slot() hands it and publishes it with
+ * ipc_send_commit(), the consumer reads the slot from ipc_recv_slot() and
+ * gives it back with ipc_recv_release().
+ *
+ * Each end owns a cache line holding its index, a copy of the far end's
+ * index which is only refreshed when the ring looks full or empty, and a
+ * waiting flag.  A side with nothing to do sets its flag and sleeps, and the
+ * other side only calls wake() when it finds the flag set, so while both
+ * keep up no message goes near the scheduler.  Setting the flag and checking
+ * the far index, like publishing an index and checking the flag, are ordered
+ * by full barriers, so at least one side always sees the other.
+ *
+ * There are no separate address spaces yet, so "shared" means the mapping
+ * both tasks already see.
+ *
+ * For request and reply traffic ipc_call() and ipc_reply_wait() pass a few
+ * words at a time synchronously, L4 style.  The words go straight into the
+ * receiver's message registers in its struct task and the CPU is handed
+ * over with sched_switch_to(), so a round trip is two switches and never
+ * touches a run queue.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/ipc.h>
+#include <fmios/mmap.h>
+#include <fmios/page.h>
+#include <fmios/sched.h>
+#include <fmios/slab.h>
+#include <fmios/io.h>
+#include <asm/processor.h>
+
+#include <string.h>
+
+#define IPC_HEADER_SIZE	\
+	((sizeof(struct ipc_ring) + IPC_CACHELINE - 1) & ~(IPC_CACHELINE - 1))
+
+/**
+ * @slots number of messages the ring holds, a power of two
+ * @slot_size bytes in each message
+ * @return the new channel, NULL on failure
+ */
+struct ipc_channel * ipc_channel_create(uint32_t slots, uint32_t slot_size)
+{
+	struct ipc_channel *channel;
+	void *map;
+	size_t len;
+
+	if (!slots || (slots & (slots - 1)) || !slot_size) {
+		return NULL;
+	}
+
+	/* Keep every slot on its own cache lines */
+	slot_size = (slot_size + IPC_CACHELINE - 1) & ~(IPC_CACHELINE - 1);
+	len = IPC_HEADER_SIZE + (size_t)slots * slot_size;
+	len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	channel = kmalloc(sizeof(*channel));
+	if (!channel) {
+		return NULL;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		kfree(channel);
+		return NULL;
+	}
+
+	/* Fault everything in now rather than from both ends at once */
+	memset(map, 0, len);
+
+	memset(channel, 0, sizeof(*channel));
+	channel->ring = map;
+	channel->data = (char *)map + IPC_HEADER_SIZE;
+	channel->len = len;
+	channel->ring->slots = slots;
+	channel->ring->slot_size = slot_size;
+	return channel;
+}
+
+/* Both ends must be done with the channel */
+void ipc_channel_destroy(struct ipc_channel *channel)
+{
+	if (!channel) {
+		return;
+	}
+	munmap(channel->ring, channel->len);
+	kfree(channel);
+}
+
+/* Sleep until the far end's index is no longer stuck */
+static void ipc_wait(struct task **self, struct ipc_end *end,
+		volatile uint32_t *far, uint32_t stuck)
+{
+	*self = current_task();
+	atomic_store(&end->waiting, 1, ATOMIC_SEQ_CST);
+	if (atomic_load(far, ATOMIC_SEQ_CST) == stuck) {
+		end->sleeps++;
+		sched_sleep();
+	}
+	atomic_store(&end->waiting, 0, ATOMIC_RELAXED);
+}
+
+/* Wake the far end if, and only if, it went to sleep on us */
+static void ipc_notify(struct task *task, struct ipc_end *far,
+		struct ipc_end *self)
+{
+	atomic_fence(ATOMIC_SEQ_CST);
+	if (far->waiting &&
+	    atomic_xchg(&far->waiting, 0, ATOMIC_ACQUIRE)) {
+		self->wakeups++;
+		wake(task);
+	}
+}
+
+/**
+ * @return the next free slot, after sleeping for one if the ring is full
+ */
+void * ipc_send_slot(struct ipc_channel *channel)
+{
+	struct ipc_ring *ring = channel->ring;
+	struct ipc_end *end = &ring->producer;
+
+	while (end->index - end->other == ring->slots) {
+		end->other = atomic_load(&ring->consumer.index, ATOMIC_ACQUIRE);
+		if (end->index - end->other != ring->slots) {
+			break;
+		}
+		ipc_wait(&channel->producer, end, &ring->consumer.index,
+				end->index - ring->slots);
+	}
+
+	return channel->data + (end->index & (ring->slots - 1)) *
+		ring->slot_size;
+}
+
+/* Hand the slot from ipc_send_slot() over to the consumer */
+void ipc_send_commit(struct ipc_channel *channel)
+{
+	struct ipc_ring *ring = channel->ring;
+	struct ipc_end *end = &ring->producer;
+
+	atomic_store(&end->index, end->index + 1, ATOMIC_RELEASE);
+	end->messages++;
+	ipc_notify(channel->consumer, &ring->consumer, end);
+}
+
+/**
+ * @return the oldest message, after sleeping for one if the ring is empty
+ */
+void * ipc_recv_slot(struct ipc_channel *channel)
+{
+	struct ipc_ring *ring = channel->ring;
+	struct ipc_end *end = &ring->consumer;
+
+	while (end->other == end->index) {
+		end->other = atomic_load(&ring->producer.index, ATOMIC_ACQUIRE);
+		if (end->other != end->index) {
+			break;
+		}
+		ipc_wait(&channel->consumer, end, &ring->producer.index,
+				end->index);
+	}
+
+	return channel->data + (end->index & (ring->slots - 1)) *
+		ring->slot_size;
+}
+
+/* Give the slot from ipc_recv_slot() back to the producer */
+void ipc_recv_release(struct ipc_channel *channel)
+{
+	struct ipc_ring *ring = channel->ring;
+	struct ipc_end *end = &ring->consumer;
+
+	atomic_store(&end->index, end->index + 1, ATOMIC_RELEASE);
+	end->messages++;
+	ipc_notify(channel->producer, &ring->producer, end);
+}
+
+/* What ipc_bench() sends */
+struct ipc_bench_msg {
+	unsigned long	seq;
+	uint64_t	sent;		/* tsc */
+};
+
+/* seq of the message which tells the consumer there is no producer */
+#define IPC_BENCH_CLOSE	(~0UL)
+
+struct ipc_bench {
+	struct ipc_channel	*channel;
+	unsigned long		messages;
+	volatile int		running;
+	uint64_t		start;
+	uint64_t		end;
+	uint64_t		latency;
+	uint64_t		latency_max;
+	unsigned long		errors;
+	int			closed;		/* the producer never ran */
+};
+
+static void ipc_bench_done(struct ipc_bench *bench)
+{
+	struct ipc_ring *ring = bench->channel->ring;
+
+	/* The last one out reports */
+	if (!atomic_dec_and_test(&bench->running)) {
+		return;
+	}
+
+	/* Nothing was sent if the producer never ran */
+	if (!bench->closed) {
+		printk("ipc: %u messages, %u cycles each, "
+				"latency %u avg %u max\n", bench->messages,
+				(uint32_t)((bench->end - bench->start) /
+					bench->messages),
+				(uint32_t)(bench->latency / bench->messages),
+				(uint32_t)bench->latency_max);
+		printk("ipc: producer slept %u times, consumer %u, "
+				"%u out of order\n", ring->producer.sleeps,
+				ring->consumer.sleeps, bench->errors);
+	}
+
+	ipc_channel_destroy(bench->channel);
+	kfree(bench);
+}
+
+static void ipc_bench_producer(void *arg)
+{
+	struct ipc_bench *bench = arg;
+	struct ipc_bench_msg *msg;
+	unsigned long seq;
+
+	bench->start = rdtsc();
+	for (seq = 0; seq < bench->messages; seq++) {
+		msg = ipc_send_slot(bench->channel);
+		msg->seq = seq;
+		msg->sent = rdtsc();
+		ipc_send_commit(bench->channel);
+	}
+
+	ipc_bench_done(bench);
+}
+
+static void ipc_bench_consumer(void *arg)
+{
+	struct ipc_bench *bench = arg;
+	struct ipc_bench_msg *msg;
+	unsigned long seq;
+	uint64_t latency;
+
+	for (seq = 0; seq < bench->messages; seq++) {
+		msg = ipc_recv_slot(bench->channel);
+		if (msg->seq == IPC_BENCH_CLOSE) {
+			ipc_recv_release(bench->channel);
+			break;
+		}
+		latency = rdtsc() - msg->sent;
+		if (msg->seq != seq) {
+			bench->errors++;
+		}
+		ipc_recv_release(bench->channel);
+
+		bench->latency += latency;
+		if (latency > bench->latency_max) {
+			bench->latency_max = latency;
+		}
+	}
+	bench->end = rdtsc();
+
+	ipc_bench_done(bench);
+}
+
+/**
+ * @messages how many messages to pass
+ *
+ * Start a producer and a consumer task passing timestamped messages through
+ * a channel, the last of them to finish reports throughput and latency in
+ * tsc cycles.
+ */
+void ipc_bench(unsigned long messages)
+{
+	struct ipc_bench *bench;
+	struct ipc_bench_msg *msg;
+
+	if (!messages) {
+		return;
+	}
+
+	bench = kmalloc(sizeof(*bench));
+	if (!bench) {
+		return;
+	}
+	memset(bench, 0, sizeof(*bench));
+
+	bench->channel = ipc_channel_create(64, sizeof(struct ipc_bench_msg));
+	if (!bench->channel) {
+		kfree(bench);
+		return;
+	}
+	bench->messages = messages;
+	bench->running = 2;
+
+	if (!task_create("ipc-consumer", ipc_bench_consumer, bench,
+			SCHED_PRIO_DEFAULT)) {
+		ipc_channel_destroy(bench->channel);
+		kfree(bench);
+		return;
+	}
+	if (!task_create("ipc-producer", ipc_bench_producer, bench,
+			SCHED_PRIO_DEFAULT)) {
+		/* The consumer may already be waiting, so stand in for the
+		 * producer just long enough to tell it to give up */
+		printk("error: ipc_bench() could not start the producer\n");
+		bench->closed = 1;
+		msg = ipc_send_slot(bench->channel);
+		msg->seq = IPC_BENCH_CLOSE;
+		ipc_send_commit(bench->channel);
+		ipc_bench_done(bench);
+	}
+}
+
+/* Hand the CPU to a partner we just gave a message, or at least wake it */
+static void ipc_handoff(struct task *to)
+{
+	if (!sched_switch_to(to)) {
+		wake(to);
+	}
+}
+
+/**
+ * @to task to call, which answers with ipc_reply_wait()
+ * @msg the request, replaced by the reply
+ * @return 0 once the reply is in msg
+ *
+ * Waits for to to be ready for a call first if it is busy.
+ */
+int ipc_call(struct task *to, struct ipc_msg *msg)
+{
+	struct task *cur = current_task();
+
+	while (atomic_cmpxchg(&to->ipc_state, IPC_WAITING, IPC_CLAIMED,
+			ATOMIC_ACQUIRE) != IPC_WAITING) {
+		yield();
+	}
+
+	to->ipc_msg = *msg;
+	to->ipc_partner = cur;
+	cur->ipc_state = IPC_CALLING;
+	atomic_store(&to->ipc_state, IPC_RECEIVED, ATOMIC_RELEASE);
+
+	ipc_handoff(to);
+	while (atomic_load(&cur->ipc_state, ATOMIC_ACQUIRE) ==
+			IPC_CALLING) {
+		sched_sleep();
+	}
+
+	*msg = cur->ipc_msg;
+	return 0;
+}
+
+/**
+ * @caller task to answer from the last ipc_reply_wait(), NULL for none
+ * @msg the reply, replaced by the next request
+ * @return the task the request came from
+ *
+ * Reply and wait for the next call in one go, switching straight to the
+ * caller so that it can come back with its next request just as quickly.
+ */
+struct task * ipc_reply_wait(struct task *caller, struct ipc_msg *msg)
+{
+	struct task *cur = current_task();
+
+	atomic_store(&cur->ipc_state, IPC_WAITING, ATOMIC_RELEASE);
+	if (caller) {
+		caller->ipc_msg = *msg;
+		atomic_store(&caller->ipc_state, IPC_IDLE,
+				ATOMIC_RELEASE);
+		ipc_handoff(caller);
+	}
+
+	while (atomic_load(&cur->ipc_state, ATOMIC_ACQUIRE) !=
+			IPC_RECEIVED) {
+		sched_sleep();
+	}
+
+	cur->ipc_state = IPC_IDLE;
+	*msg = cur->ipc_msg;
+	return cur->ipc_partner;
+}
+
+/* Answer caller without waiting for anything further */
+void ipc_reply(struct task *caller, struct ipc_msg *msg)
+{
+	caller->ipc_msg = *msg;
+	atomic_store(&caller->ipc_state, IPC_IDLE, ATOMIC_RELEASE);
+	wake(caller);
+}
+
+/* What ipc_call_bench() asks the server to do */
+#define IPC_BENCH_ECHO	0
+#define IPC_BENCH_STOP	1
+
+struct ipc_call_bench {
+	struct task	*server;
+	unsigned long	rounds;
+};
+
+static void ipc_call_bench_server(void *arg)
+{
+	struct task *caller = NULL;
+	struct ipc_msg msg;
+
+	for (;;) {
+		caller = ipc_reply_wait(caller, &msg);
+		if (msg.word[0] == IPC_BENCH_STOP) {
+			ipc_reply(caller, &msg);
+			return;
+		}
+		msg.word[1]++;
+	}
+}
+
+static void ipc_call_bench_client(void *arg)
+{
+	struct ipc_call_bench *bench = arg;
+	uint64_t start, cycles, total = 0, best = ~0ULL;
+	struct ipc_msg msg;
+	unsigned long round, errors = 0;
+
+	for (round = 0; round < bench->rounds; round++) {
+		msg.word[0] = IPC_BENCH_ECHO;
+		msg.word[1] = round;
+
+		start = rdtsc();
+		ipc_call(bench->server, &msg);
+		cycles = rdtsc() - start;
+
+		if (msg.word[1] != round + 1) {
+			errors++;
+		}
+		total += cycles;
+		if (cycles < best) {
+			best = cycles;
+		}
+	}
+
+	msg.word[0] = IPC_BENCH_STOP;
+	ipc_call(bench->server, &msg);
+
+	printk("ipc: %u calls, round trip %u cycles avg %u best, %u bad\n",
+			bench->rounds, (uint32_t)(total / bench->rounds),
+			(uint32_t)best, errors);
+	kfree(bench);
+}
+
+/**
+ * @rounds calls to make
+ *
+ * Start a server which echoes back whatever it is sent and a client which
+ * times its ipc_call()s to it, reporting round trips in tsc cycles.
+ */
+void ipc_call_bench(unsigned long rounds)
+{
+	struct ipc_call_bench *bench;
+	struct ipc_msg msg;
+
+	if (!rounds) {
+		return;
+	}
+
+	bench = kmalloc(sizeof(*bench));
+	if (!bench) {
+		return;
+	}
+	bench->rounds = rounds;
+
+	bench->server = task_create("ipc-server", ipc_call_bench_server, NULL,
+			SCHED_PRIO_DEFAULT);
+	if (!bench->server) {
+		kfree(bench);
+		return;
+	}
+	if (!task_create("ipc-client", ipc_call_bench_client, bench,
+			SCHED_PRIO_DEFAULT)) {
+		/* Rather than leave the server waiting for calls forever */
+		printk("error: ipc_call_bench() could not start the client\n");
+		msg.word[0] = IPC_BENCH_STOP;
+		ipc_call(bench->server, &msg);
+		kfree(bench);
+	}
+}
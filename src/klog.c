@@ -0,0 +1,355 @@
+/* klog.c - Lock-free per-CPU kernel log */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Every CPU owns one ring and is the only writer of its head and tail, with
+ * interrupts disabled while it does so.  Records are a small header followed
+ * by the text, padded to eight bytes, and may wrap around the end of the
+ * ring.  When a new record does not fit the oldest ones are dropped: the
+ * tail moves past them before their bytes are reused, so a reader copying a
+ * record out checks the tail again afterwards and throws the copy away if
+ * the record has gone meanwhile.  That makes reading safe from any CPU
+ * without ever stopping the writer.
+ *
+ * Records carry a sequence number from one global counter which orders
+ * them across the rings.  One CPU at a time drains to the consoles, picking
+ * the lowest sequence number each time; anybody finding the drain already
+ * in progress simply leaves their record for it.  Two CPUs logging at the
+ * same instant may still come out in either order.
+ *
+ * Until the idle loop is running nothing else would drain the rings, so
+ * printk() flushes as it goes, consoles included, until klog_defer() is
+ * called.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/console.h>
+#include <fmios/klog.h>
+#include <fmios/smp.h>
+#include <fmios/io.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+
+#define KLOG_MASK	(KLOG_RING_SIZE - 1)
+#define KLOG_ALIGN(n)	(((n) + 7) & ~7)
+
+struct klog_record {
+	uint32_t	seq;
+	uint16_t	len;		/* of the text following */
+	uint8_t		cpu;
+	uint8_t		pad;
+};
+
+struct klog_ring {
+	volatile uint32_t	head;		/* where the next record goes */
+	volatile uint32_t	tail;		/* oldest record still held */
+	volatile uint32_t	con;		/* next record for the consoles */
+	unsigned long		records;
+	unsigned long		dropped;	/* lost before reaching a console */
+	char			buf[KLOG_RING_SIZE];
+} __attribute__((aligned(64)));
+
+static struct klog_ring klog_ring[NR_CPUS];
+static volatile uint32_t klog_seq = 0;
+static volatile int klog_draining = 0;
+static volatile int klog_deferred = 0;	/* klog_defer(1) calls outstanding */
+
+/* Is sequence number or ring position a the same as or after b */
+static inline int klog_after(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) >= 0;
+}
+
+static void klog_copy_in(struct klog_ring *ring, uint32_t pos,
+		const void *src, size_t len)
+{
+	const char *from = src;
+
+	while (len--) {
+		ring->buf[pos++ & KLOG_MASK] = *from++;
+	}
+}
+
+static void klog_copy_out(struct klog_ring *ring, uint32_t pos, void *dst,
+		size_t len)
+{
+	char *to = dst;
+
+	while (len--) {
+		*to++ = ring->buf[pos++ & KLOG_MASK];
+	}
+}
+
+/**
+ * @text copied out as well when not NULL, up to max bytes of it
+ * @return 1 if the record at pos was still held once it was copied
+ */
+static int klog_fetch(struct klog_ring *ring, uint32_t pos,
+		struct klog_record *rec, char *text, size_t max)
+{
+	klog_copy_out(ring, pos, rec, sizeof(*rec));
+	if (text) {
+		klog_copy_out(ring, pos + sizeof(*rec), text,
+				rec->len < max ? rec->len : max);
+	}
+
+	/* The copy is finished before the tail is looked at again */
+	atomic_fence(ATOMIC_ACQUIRE);
+	return klog_after(pos, atomic_load(&ring->tail, ATOMIC_ACQUIRE));
+}
+
+/**
+ * @text one line, or part of one, without any terminator
+ * @len bytes of text, anything beyond KLOG_LINE_MAX is cut off
+ */
+void klog_write(const char *text, size_t len)
+{
+	struct klog_ring *ring;
+	struct klog_record rec;
+	unsigned long flags;
+	uint32_t head, tail, size;
+
+	if (len > KLOG_LINE_MAX) {
+		len = KLOG_LINE_MAX;
+	}
+	size = KLOG_ALIGN(sizeof(rec) + len);
+
+	flags = irq_save();
+	ring = &klog_ring[cpu_id()];
+	head = ring->head;
+	tail = ring->tail;
+
+	if (head - tail + size > KLOG_RING_SIZE) {
+		do {
+			klog_copy_out(ring, tail, &rec, sizeof(rec));
+			if (klog_after(tail, atomic_load(&ring->con,
+							ATOMIC_RELAXED))) {
+				ring->dropped++;
+			}
+			tail += KLOG_ALIGN(sizeof(rec) + rec.len);
+		} while (head - tail + size > KLOG_RING_SIZE);
+
+		/* Readers must see the records go before their bytes change */
+		atomic_store(&ring->tail, tail, ATOMIC_RELEASE);
+		atomic_fence(ATOMIC_RELEASE);
+	}
+
+	rec.seq = atomic_fetch_add(&klog_seq, 1, ATOMIC_RELAXED);
+	rec.len = len;
+	rec.cpu = cpu_id();
+	rec.pad = 0;
+	klog_copy_in(ring, head, &rec, sizeof(rec));
+	klog_copy_in(ring, head + sizeof(rec), text, len);
+	ring->records++;
+
+	atomic_store(&ring->head, head + size, ATOMIC_RELEASE);
+	irq_restore(flags);
+
+	if (!atomic_load(&klog_deferred, ATOMIC_RELAXED)) {
+		klog_flush();
+		console_flush();
+	}
+}
+
+/* Is there anything the consoles have not been given yet */
+static int klog_pending(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct klog_ring *ring = &klog_ring[cpu];
+
+		if (!klog_after(ring->con,
+				atomic_load(&ring->head, ATOMIC_ACQUIRE))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Look at the next record for the consoles, skipping whatever was dropped
+ * before they got to it.  The tail may briefly be ahead of the head while
+ * the writer is making room.
+ * @return 1 if there is one
+ */
+static int klog_peek(struct klog_ring *ring, struct klog_record *rec)
+{
+	for (;;) {
+		if (klog_after(ring->con,
+				atomic_load(&ring->head, ATOMIC_ACQUIRE))) {
+			return 0;
+		}
+		if (klog_fetch(ring, ring->con, rec, NULL, 0)) {
+			return 1;
+		}
+		ring->con = atomic_load(&ring->tail, ATOMIC_ACQUIRE);
+	}
+}
+
+/* Hand the record with the lowest sequence number to the consoles */
+static int klog_drain_one(void)
+{
+	struct klog_ring *ring, *next = NULL;
+	struct klog_record rec;
+	char text[KLOG_LINE_MAX];
+	uint32_t seq = 0;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		ring = &klog_ring[cpu];
+		if (!klog_peek(ring, &rec)) {
+			continue;
+		}
+		if (!next || !klog_after(rec.seq, seq)) {
+			next = ring;
+			seq = rec.seq;
+		}
+	}
+
+	if (!next) {
+		return 0;
+	}
+
+	/* Dropped from under us, it will be skipped next time round */
+	if (!klog_fetch(next, next->con, &rec, text, sizeof(text))) {
+		return 1;
+	}
+	next->con += KLOG_ALIGN(sizeof(rec) + rec.len);
+	console_write(text, rec.len);
+	return 1;
+}
+
+/**
+ * Write out everything logged so far.  Returns straight away if another
+ * CPU, or this one further up the stack, is already doing so.
+ */
+void klog_flush(void)
+{
+	do {
+		if (atomic_xchg(&klog_draining, 1, ATOMIC_ACQUIRE)) {
+			return;
+		}
+		while (klog_drain_one()) {
+			continue;
+		}
+		atomic_store(&klog_draining, 0, ATOMIC_SEQ_CST);
+
+		/* Somebody may have logged and left it to us meanwhile */
+	} while (klog_pending());
+}
+
+/**
+ * @defer non-zero once something will call klog_flush() regularly, zero
+ * when it stops
+ *
+ * Calls nest, one for every idle loop running, and printk() only writes out
+ * each line itself again once every klog_defer(1) has been matched by a
+ * klog_defer(0).
+ */
+void klog_defer(int defer)
+{
+	if (defer) {
+		atomic_inc(&klog_deferred);
+		return;
+	}
+	if (atomic_dec_and_test(&klog_deferred)) {
+		klog_flush();
+		console_flush();
+	}
+}
+
+/**
+ * @seq sequence number to start from, 0 for the oldest record held, moved
+ * past the record returned
+ * @buf filled with the text of the record, truncated to fit
+ * @len size of buf
+ * @return bytes of text copied, or -1 once there are no more records
+ */
+int klog_read(uint32_t *seq, char *buf, size_t len)
+{
+	struct klog_ring *ring, *next;
+	struct klog_record rec;
+	uint32_t pos, head, best = 0, at = 0;
+	int cpu;
+
+	for (;;) {
+		next = NULL;
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			ring = &klog_ring[cpu];
+			head = atomic_load(&ring->head, ATOMIC_ACQUIRE);
+			pos = atomic_load(&ring->tail, ATOMIC_ACQUIRE);
+
+			while (!klog_after(pos, head) && klog_fetch(ring, pos, &rec,
+						NULL, 0)) {
+				if (klog_after(rec.seq, *seq) &&
+				    (!next || !klog_after(rec.seq, best))) {
+					next = ring;
+					best = rec.seq;
+					at = pos;
+				}
+				pos += KLOG_ALIGN(sizeof(rec) + rec.len);
+			}
+		}
+
+		if (!next) {
+			return -1;
+		}
+		if (klog_fetch(next, at, &rec, buf, len)) {
+			break;
+		}
+	}
+
+	*seq = rec.seq + 1;
+	return rec.len < len ? rec.len : len;
+}
+
+/* Write every record still held to the consoles, oldest first */
+void klog_dump(void)
+{
+	char text[KLOG_LINE_MAX];
+	uint32_t seq = 0;
+	int len;
+
+	while (atomic_xchg(&klog_draining, 1, ATOMIC_ACQUIRE)) {
+		cpu_relax();
+	}
+	while ((len = klog_read(&seq, text, sizeof(text))) >= 0) {
+		console_write(text, len);
+	}
+	atomic_store(&klog_draining, 0, ATOMIC_RELEASE);
+}
+
+void klog_report(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct klog_ring *ring = &klog_ring[cpu];
+
+		if (!ring->records) {
+			continue;
+		}
+		printk("klog: cpu %d, %u records, %u dropped, %u bytes held\n",
+				cpu, ring->records, ring->dropped,
+				ring->head - ring->tail);
+	}
+}
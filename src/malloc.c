@@ -1,7 +1,10 @@
 #include <fmios/fmios.h>
 #include <fmios/malloc.h>
 #include <fmios/page.h>
+#include <fmios/smp.h>
+#include <fmios/spinlock.h>
 #include <fmios/io.h>
+#include <asm/irq.h>
 
 #include <string.h>
 
@@ -12,293 +15,994 @@ extern const void _end;
 extern unsigned long kernel_start;
 extern unsigned long kernel_end;
 
-/* Find free pages for the kernel config */
-static void * find_free_pages(size_t count)
+/* The pmap is built in one pass rather than by splitting entries on every
+ * insert.  Each memory map entry and each in-use region is turned into a pair
+ * of boundary events, the events are sorted by page and a single sweep across
+ * them emits one entry per stretch of pages whose covering set is unchanged.
+ * Overlapping firmware entries resolve to the highest type present, as does
+ * Linux with the e820 map, and in-use regions only ever mark available
+ * memory. */
+#define PMAP_CLASS_KERNEL	(MULTIBOOT_MEMORY_BADRAM)
+#define PMAP_CLASS_LOADER	(MULTIBOOT_MEMORY_BADRAM + 1)
+#define PMAP_CLASS_MODULE	(MULTIBOOT_MEMORY_BADRAM + 2)
+#define PMAP_CLASSES		(MULTIBOOT_MEMORY_BADRAM + 3)
+
+struct pmap_event {
+	uint32_t	page;
+	int16_t		class;	/* type - 1 or one of PMAP_CLASS_* */
+	int16_t		delta;	/* +1 where a region starts, -1 past its end */
+};
+
+struct pmap_build {
+	struct pmap_event	*event;
+	int			count;
+	int			max;
+	int			lost;	/* regions which did not fit */
+};
+
+static void pmap_event_add(struct pmap_build *build, uint32_t first,
+		uint32_t last, int class)
+{
+	if (first > last) {
+		return;
+	}
+	if (build->count + 2 > build->max) {
+		build->lost++;
+		return;
+	}
+
+	build->event[build->count].page = first;
+	build->event[build->count].class = class;
+	build->event[build->count].delta = 1;
+	build->count++;
+
+	/* last is at most PAGE_NUM(~0UL) so this can not wrap */
+	build->event[build->count].page = last + 1;
+	build->event[build->count].class = class;
+	build->event[build->count].delta = -1;
+	build->count++;
+}
+
+/* Add the bytes from start up to, but not including, end.  Available memory
+ * is shrunk to whole pages while anything else grows to cover partial pages. */
+static void pmap_range_add(struct pmap_build *build, unsigned long start,
+		unsigned long end, int class)
 {
-	unsigned long pstart = PAGE_NUM(kernel_end) + 1;
-	unsigned long pend = pstart + count;
-	int mod_count = mb_mod_count();
-	int module;
+	unsigned long last = end - 1;
+	uint32_t first_page, last_page;
 
-	/* Check the MBI location */
-	if (PAGE_NUM(mb_mbi_start()) < pend &&
-	    PAGE_NUM(mb_mbi_start()) > pstart) {
-		pstart = (PAGE_NUM(mb_mbi_end()) + 1);
-		pend = pstart + count;
+	if (start == end) {
+		return;
 	}
 
-	for (module = 0; module < mod_count; module++) {
-		unsigned long start;
-		unsigned long end;
+	/* Regions running off the top of the address space */
+	if (last < start) {
+		last = ~0UL;
+	}
 
-		start = mb_mod_start(module);
-		end = mb_mod_end(module);
+	first_page = PAGE_NUM(start);
+	last_page = PAGE_NUM(last);
 
-		if (!start || !end) {
-			continue;
+	if (class == MULTIBOOT_MEMORY_AVAILABLE - 1) {
+		if (start & (PAGE_SIZE - 1)) {
+			first_page++;
 		}
-
-		if (PAGE_NUM(start) <= pend && PAGE_NUM(start) >= pstart) {
-			pstart = PAGE_NUM(end + 1);
-			pend = (pstart + (count - 1));
+		if ((last + 1) & (PAGE_SIZE - 1)) {
+			if (!last_page) {
+				return;
+			}
+			last_page--;
 		}
 	}
 
-	/* FIXME is this address in valid memory? */
-	return (void *)(pstart * PAGE_SIZE);
+	pmap_event_add(build, first_page, last_page, class);
 }
 
-static int pmap_shift(struct pmap_entry *entries, int count)
+static inline int pmap_event_less(struct pmap_event *a, struct pmap_event *b)
 {
-	int total = 0;
-	int index;
+	return a->page < b->page;
+}
 
-#ifdef CONFIG_ENABLE_DEBUG
-	printk("pmap_shift: shifting by %d\n", count);
-#endif
+static void pmap_sift(struct pmap_event *event, int root, int count)
+{
+	struct pmap_event tmp;
+	int child;
 
-	/* Figure out how many entries we have left */
-	while (entries[total+1].flags != MEMORY_PMAP_END) {
-		total++;
-		if (total > 42) {
-			printk("pmap_shift: huge pmap?\n");
+	while ((child = 2 * root + 1) < count) {
+		if (child + 1 < count &&
+		    pmap_event_less(&event[child], &event[child + 1])) {
+			child++;
 		}
+		if (!pmap_event_less(&event[root], &event[child])) {
+			return;
+		}
+		tmp = event[root];
+		event[root] = event[child];
+		event[child] = tmp;
+		root = child;
 	}
+}
 
-	if (!total) {
-		printk("error: failed to shift page map\n");
-		return 0;
+/* Heap sort, there is nowhere to take scratch space for anything better */
+static void pmap_sort(struct pmap_event *event, int count)
+{
+	struct pmap_event tmp;
+	int index;
+
+	for (index = count / 2 - 1; index >= 0; index--) {
+		pmap_sift(event, index, count);
 	}
 
-	/* This is something of a reverse memcpy as we are copying overlapping
-	 * regions */
-	index = total - count;
-	while ((index) >= 0) {
-		if (entries[index].type) {
-			memcpy(&entries[index+count], &entries[index],
-				sizeof(struct pmap_entry));
+	for (index = count - 1; index > 0; index--) {
+		tmp = event[0];
+		event[0] = event[index];
+		event[index] = tmp;
+		pmap_sift(event, 0, index);
+	}
+}
+
+/* Work out what the pages covered by the given set of regions are */
+static int pmap_state(int *active, uint32_t *type, uint32_t *flags)
+{
+	int class;
+
+	for (class = MULTIBOOT_MEMORY_BADRAM - 1; class >= 0; class--) {
+		if (active[class]) {
+			break;
 		}
-		index--;
+	}
+	if (class < 0) {
+		return 0;
 	}
 
+	*type = class + 1;
+	*flags = MEMORY_PMAP_UNUSED;
+	if (*type != MULTIBOOT_MEMORY_AVAILABLE) {
+		return 1;
+	}
+
+	if (active[PMAP_CLASS_KERNEL]) {
+		*flags = MEMORY_PMAP_KERNEL;
+	} else if (active[PMAP_CLASS_LOADER]) {
+		*flags = MEMORY_PMAP_LOADER;
+	} else if (active[PMAP_CLASS_MODULE]) {
+		*flags = MEMORY_PMAP_MODULE;
+	}
 	return 1;
 }
 
-/* Insert the given pmap entry into the existing pmap table.  We need to
- * properly split existing regions and reset the start/len elements with each
- * insert. */
-static int pmap_add(struct pmap_entry *entries, struct pmap_entry *entry, int index)
+/**
+ * @pmap table with room for at least max - 1 entries
+ * @event scratch space for max events
+ * @max number of events which fit in the scratch space
+ * @return number of entries in the table, 0 on failure
+ */
+static int pmap_fill(struct pmap_table *pmap, struct pmap_event *event, int max)
 {
-	/* Sanity checking */
-	if (entries[index].type != MULTIBOOT_MEMORY_AVAILABLE) {
-		return 0;
+	struct pmap_entry *entries = pmap->entry;
+	const struct bootmem_range *used;
+	struct pmap_build build;
+	int active[PMAP_CLASSES];
+	int index, count, entry_max;
+
+	build.event = event;
+	build.count = 0;
+	build.max = max;
+	build.lost = 0;
+
+	entry_max = mb_mmap_count();
+#ifdef CONFIG_ENABLE_DEBUG
+	printk("Initializing page map with %d entries\n", entry_max);
+#endif
+	for (index = 0; index < entry_max; index++) {
+		uint32_t type = mb_mmap_type(index);
+
+		/* Anything unknown is to be treated as reserved */
+		if (type < MULTIBOOT_MEMORY_AVAILABLE ||
+		    type > MULTIBOOT_MEMORY_BADRAM) {
+			type = MULTIBOOT_MEMORY_RESERVED;
+		}
+
+		pmap_range_add(&build, mb_mmap_start(index),
+				mb_mmap_end(index), type - 1);
+	}
+
+	pmap_range_add(&build, kernel_start, kernel_end, PMAP_CLASS_KERNEL);
+	pmap_range_add(&build, mb_mbi_start(), mb_mbi_end(), PMAP_CLASS_LOADER);
+
+	entry_max = mb_mod_count();
+	for (index = 0; index < entry_max; index++) {
+		pmap_range_add(&build, mb_mod_start(index), mb_mod_end(index),
+				PMAP_CLASS_MODULE);
+	}
+
+	/* Everything bootmem has handed out, including this table */
+	entry_max = bootmem_used_ranges(&used);
+	for (index = 0; index < entry_max; index++) {
+		pmap_event_add(&build, used[index].start, used[index].end,
+				PMAP_CLASS_KERNEL);
 	}
-	if (entry->start > entries[index].end) {
+
+	if (build.lost) {
+		printk("error: pmap_fill() lost %d regions\n", build.lost);
 		return 0;
 	}
 
+	pmap_sort(event, build.count);
+
+	memset(active, 0, sizeof(active));
+	count = 0;
+	for (index = 0; index < build.count; ) {
+		uint32_t page = event[index].page;
+		uint32_t type, flags;
+		struct pmap_entry *prev;
+
+		while (index < build.count && event[index].page == page) {
+			active[event[index].class] += event[index].delta;
+			index++;
+		}
+
+		if (index == build.count || !pmap_state(active, &type, &flags)) {
+			continue;
+		}
+
+		/* Coalesce with the previous entry where nothing changed */
+		prev = count ? &entries[count - 1] : NULL;
+		if (prev && prev->end + 1 == page && prev->type == type &&
+		    prev->flags == flags) {
+			prev->end = event[index].page - 1;
+			continue;
+		}
+
+		entries[count].start = page;
+		entries[count].end = event[index].page - 1;
+		entries[count].type = type;
+		entries[count].flags = flags;
+		count++;
+	}
+
 #ifdef CONFIG_ENABLE_DEBUG
-	printk("pmap_add:\n");
-	printk("  cur: start=0x%x, end=0x%x, type=0x%x, flags=0x%x\n",
-			entries[index].start, entries[index].end,
-			entries[index].type, entries[index].flags);
-	printk("  new: start=0x%x, end=0x%x, type=0x%x, flags=0x%x\n",
-			entry->start, entry->end, entry->type, entry->flags);
+	for (index = 0; index < count; index++) {
+		printk("pmap_fill: start=0x%x, end=0x%x, type=0x%x, flags=0x%x\n",
+				entries[index].start, entries[index].end,
+				entries[index].type, entries[index].flags);
+	}
 #endif
 
-	/* Add the entry to the list in a sorted order.  We have 3 types of
-	 * insertions we can do.
-	 * 1) Insert this entry at the start of the current entry
-	 * 2) Insert this entry at the tail of the current entry
-	 * 3) Split the current entry in two and do the insertion.  */
-
-	/* Consumes the start of this entry */
-	if (entry->start == entries[index].start &&
-	    entry->end >= entries[index].start) {
-
-		/* Extend the next current with the new entry */
-		if (entries[index].flags == entry->flags &&
-		    entries[index].end <= entry->end) {
-			entries[index].end = entry->end;
-			if (entries[index].start < entry->end) {
-				entries[index+1].start = entry->end + 1;
+	pmap->count = count;
+	entries[count].flags = MEMORY_PMAP_END;
+
+	return count;
+}
+
+/* The free page B+tree.  Every leaf entry describes one contiguous run of
+ * free pages, keyed by its first page with the (inclusive) last page as the
+ * value.  Internal keys are separators which are kept equal to the first key
+ * of the leftmost leaf in child[i + 1], so the run preceding any page is always
+ * found in the leaf that page routes to.  Leaves are chained in address order
+ * so page_alloc() can simply take from the head of the list.
+ *
+ * Nodes are never rebalanced on removal, a node is only released once it is
+ * empty.  Runs are coalesced on free so the number of leaf entries tracks the
+ * fragmentation of memory rather than the number of page_free() calls.
+ *
+ * The nodes themselves live in pages taken from the tree, so the allocator
+ * needs no memory of its own beyond the first page handed to page_init(). */
+#define PAGE_TREE_KEYS	14
+
+struct page_node {
+	struct page_node	*parent;
+	struct page_node	*next;
+	struct page_node	*prev;
+	uint16_t		leaf;
+	uint16_t		count;
+	/* One spare slot so a node can overflow before it is split */
+	uint32_t		key[PAGE_TREE_KEYS + 1];
+	union {
+		uint32_t		end[PAGE_TREE_KEYS + 1];
+		struct page_node	*child[PAGE_TREE_KEYS + 2];
+	};
+};
+
+static struct page_node *page_root = NULL;
+static struct page_node *page_head = NULL;
+static struct page_node *page_pool = NULL;
+static unsigned long page_pool_count = 0;
+static unsigned long page_height = 0;
+static struct page_stats page_counters;
+/* Always taken with interrupts disabled, as the per-CPU caches refill from
+ * under it with interrupts off and a fault may allocate on any CPU */
+static mcs_lock_t page_lock = MCS_LOCK_INIT("page");
+
+static void page_pool_fill(unsigned long page)
+{
+	struct page_node *node = (struct page_node *)(page * PAGE_SIZE);
+	unsigned long index;
+
+	for (index = 0; index < PAGE_SIZE / sizeof(struct page_node); index++) {
+		node[index].next = page_pool;
+		page_pool = &node[index];
+		page_pool_count++;
+	}
+	page_counters.nodes_pages++;
+}
+
+static struct page_node * page_node_get(int leaf)
+{
+	struct page_node *node = page_pool;
+
+	/* page_tree_reserve() guarantees this for every caller */
+	page_pool = node->next;
+	page_pool_count--;
+
+	memset(node, 0, sizeof(struct page_node));
+	node->leaf = leaf;
+	page_counters.nodes++;
+	return node;
+}
+
+static void page_node_put(struct page_node *node)
+{
+	node->next = page_pool;
+	page_pool = node;
+	page_pool_count++;
+	page_counters.nodes--;
+}
+
+static int page_child_index(struct page_node *parent, struct page_node *child)
+{
+	int index;
+
+	for (index = 0; index <= parent->count; index++) {
+		if (parent->child[index] == child) {
+			break;
+		}
+	}
+	return index;
+}
+
+static struct page_node * page_leaf_find(uint32_t page)
+{
+	struct page_node *node = page_root;
+	int index;
+
+	while (!node->leaf) {
+		for (index = 0; index < node->count; index++) {
+			if (page < node->key[index]) {
+				break;
 			}
-			return 0;
 		}
+		node = node->child[index];
+	}
+	return node;
+}
+
+/* The first key of a leaf has changed, update the separator to the left of
+ * it.  That lives in the nearest ancestor where this subtree is not child[0],
+ * the head leaf has no separator at all. */
+static void page_key_fix(struct page_node *node)
+{
+	struct page_node *parent = node->parent;
+	uint32_t page = node->key[0];
+	int index;
+
+	if (node == page_head || !node->count) {
+		return;
+	}
+
+	while (parent && parent->child[0] == node) {
+		node = parent;
+		parent = node->parent;
+	}
+
+	if (!parent) {
+		return;
+	}
+
+	index = page_child_index(parent, node);
+	parent->key[index - 1] = page;
+}
+
+static void page_parent_insert(struct page_node *left, uint32_t key,
+		struct page_node *right)
+{
+	struct page_node *parent = left->parent;
+	struct page_node *split;
+	int index, mid;
+
+	if (!parent) {
+		parent = page_node_get(0);
+		parent->count = 1;
+		parent->key[0] = key;
+		parent->child[0] = left;
+		parent->child[1] = right;
+		left->parent = parent;
+		right->parent = parent;
+		page_root = parent;
+		page_height++;
+		return;
+	}
+
+	index = page_child_index(parent, left);
+	memmove(&parent->key[index + 1], &parent->key[index],
+			(parent->count - index) * sizeof(uint32_t));
+	memmove(&parent->child[index + 2], &parent->child[index + 1],
+			(parent->count - index) * sizeof(struct page_node *));
+	parent->key[index] = key;
+	parent->child[index + 1] = right;
+	right->parent = parent;
+	parent->count++;
+
+	if (parent->count <= PAGE_TREE_KEYS) {
+		return;
+	}
+
+	/* The middle key moves up, it is not kept in either half */
+	mid = parent->count / 2;
+	split = page_node_get(0);
+	split->count = parent->count - mid - 1;
+	memcpy(split->key, &parent->key[mid + 1],
+			split->count * sizeof(uint32_t));
+	memcpy(split->child, &parent->child[mid + 1],
+			(split->count + 1) * sizeof(struct page_node *));
+	for (index = 0; index <= split->count; index++) {
+		split->child[index]->parent = split;
+	}
+	parent->count = mid;
+
+	page_parent_insert(parent, parent->key[mid], split);
+}
+
+static void page_leaf_insert(struct page_node *leaf, int index,
+		uint32_t start, uint32_t end)
+{
+	struct page_node *split;
+	int mid;
+
+	memmove(&leaf->key[index + 1], &leaf->key[index],
+			(leaf->count - index) * sizeof(uint32_t));
+	memmove(&leaf->end[index + 1], &leaf->end[index],
+			(leaf->count - index) * sizeof(uint32_t));
+	leaf->key[index] = start;
+	leaf->end[index] = end;
+	leaf->count++;
+	page_counters.free_ranges++;
+
+	if (index == 0) {
+		page_key_fix(leaf);
+	}
+
+	if (leaf->count <= PAGE_TREE_KEYS) {
+		return;
+	}
+
+	mid = leaf->count / 2;
+	split = page_node_get(1);
+	split->count = leaf->count - mid;
+	memcpy(split->key, &leaf->key[mid], split->count * sizeof(uint32_t));
+	memcpy(split->end, &leaf->end[mid], split->count * sizeof(uint32_t));
+	leaf->count = mid;
+
+	split->prev = leaf;
+	split->next = leaf->next;
+	if (leaf->next) {
+		leaf->next->prev = split;
+	}
+	leaf->next = split;
+
+	page_parent_insert(leaf, split->key[0], split);
+}
+
+/* Drop 'node' from its parent, releasing any ancestors left without
+ * children along the way. */
+static void page_node_remove(struct page_node *node)
+{
+	struct page_node *parent = node->parent;
+	int index;
+
+	page_node_put(node);
+
+	if (!parent) {
+		return;
+	}
+
+	index = page_child_index(parent, node);
+	if (parent->count == 0) {
+		page_node_remove(parent);
+		return;
+	}
+
+	/* Removing child[0] takes key[0] with it, otherwise the separator
+	 * to the left of the child goes */
+	if (index == 0) {
+		memmove(&parent->key[0], &parent->key[1],
+				(parent->count - 1) * sizeof(uint32_t));
+		memmove(&parent->child[0], &parent->child[1],
+				parent->count * sizeof(struct page_node *));
+	} else {
+		memmove(&parent->key[index - 1], &parent->key[index],
+				(parent->count - index) * sizeof(uint32_t));
+		memmove(&parent->child[index], &parent->child[index + 1],
+				(parent->count - index) * sizeof(struct page_node *));
+	}
+	parent->count--;
+}
+
+static void page_leaf_delete(struct page_node *leaf, int index)
+{
+	struct page_node *next = leaf->next;
+
+	memmove(&leaf->key[index], &leaf->key[index + 1],
+			(leaf->count - index - 1) * sizeof(uint32_t));
+	memmove(&leaf->end[index], &leaf->end[index + 1],
+			(leaf->count - index - 1) * sizeof(uint32_t));
+	leaf->count--;
+	page_counters.free_ranges--;
 
-		if (!pmap_shift(&entries[index], 1)) {
-			return -1;
+	/* The root leaf is allowed to be empty */
+	if (leaf->count || leaf == page_root) {
+		if (index == 0) {
+			page_key_fix(leaf);
 		}
-		entries[index].start = entry->start;
-		entries[index].end = entry->end;
-		entries[index].type = entry->type;
-		entries[index].flags = entry->flags;
+		return;
+	}
 
-		entries[index+1].start = entry->end + 1;
-		return 1;
+	if (leaf->prev) {
+		leaf->prev->next = leaf->next;
+	} else {
+		page_head = leaf->next;
+	}
+	if (leaf->next) {
+		leaf->next->prev = leaf->prev;
 	}
+	page_node_remove(leaf);
 
-	/* Consume the tail of the current entry */
-	if (entry->start <= entries[index].end &&
-	    entry->end >= entries[index].end) {
+	/* Collapse single-child roots so the height stays honest */
+	while (!page_root->leaf && page_root->count == 0) {
+		struct page_node *root = page_root;
+
+		page_root = root->child[0];
+		page_root->parent = NULL;
+		page_node_put(root);
+		page_height--;
+	}
+
+	/* The separator which guarded the released leaf may now guard the
+	 * next one */
+	if (next) {
+		page_key_fix(next);
+	}
+}
 
-		/* Merge with the current entry if the flags are the same */
-		/* FIXME do we need to merge the follow entry as well? */
-		if (entries[index].flags == entry->flags) {
-			entries[index].end = entry->end;
-			if (entries[index+1].type == MULTIBOOT_MEMORY_AVAILABLE
-			 && entries[index+1].start <= entry->end) {
-				entries[index+1].start = entry->end + 1;
+static unsigned long page_tree_alloc(size_t count)
+{
+	struct page_node *leaf;
+	int index;
+
+	for (leaf = page_head; leaf; leaf = leaf->next) {
+		for (index = 0; index < leaf->count; index++) {
+			uint32_t start = leaf->key[index];
+
+			if (leaf->end[index] - start + 1 < count) {
+				continue;
 			}
-			return 0;
-		}
 
-		/* Merge the next entry with the new entry */
-		if (entries[index+1].flags == entry->flags &&
-		    entries[index+1].start >= entry->end) {
-			entries[index+1].start = entry->start;
-			entries[index].end = entry->start - 1;
-			return 0;
+			if (leaf->end[index] - start + 1 == count) {
+				page_leaf_delete(leaf, index);
+			} else {
+				leaf->key[index] += count;
+				if (index == 0) {
+					page_key_fix(leaf);
+				}
+			}
+			page_counters.free_pages -= count;
+			return start;
 		}
+	}
+
+	return 0;
+}
+
+/* Carve a run of 'count' pages starting on an 'align' boundary out of the
+ * first free run which can hold one.  Whatever is left either side of it
+ * stays in the tree, and page_tree_free() merges it all back together.  The
+ * caller must have the node pool reserved as the tail may need a new entry. */
+static unsigned long page_tree_alloc_aligned(size_t count, unsigned long align)
+{
+	struct page_node *leaf;
+	int index;
+
+	for (leaf = page_head; leaf; leaf = leaf->next) {
+		for (index = 0; index < leaf->count; index++) {
+			uint32_t start = leaf->key[index];
+			uint32_t end = leaf->end[index];
+			uint32_t page = (start + align - 1) & ~(align - 1);
 
-		/* make space to add a new entry */
-		if (!pmap_shift(&entries[index], 1)) {
-			return -1;
+			if (page < start || end - start + 1 < count ||
+			    page + count - 1 > end) {
+				continue;
+			}
+
+			if (page == start) {
+				if (end - start + 1 == count) {
+					page_leaf_delete(leaf, index);
+				} else {
+					leaf->key[index] += count;
+					if (index == 0) {
+						page_key_fix(leaf);
+					}
+				}
+			} else {
+				leaf->end[index] = page - 1;
+				if (page + count - 1 < end) {
+					page_leaf_insert(leaf, index + 1,
+							page + count, end);
+				}
+			}
+			page_counters.free_pages -= count;
+			return page;
 		}
+	}
+
+	return 0;
+}
+
+/* An insert can split every level of the tree and add a new root.  Make sure
+ * that many nodes are on hand before touching the tree, preferably from a
+ * free page but otherwise by consuming the first page of the range being
+ * freed.  Returns the number of pages taken from the freed range. */
+static int page_tree_reserve(unsigned long page, size_t count)
+{
+	unsigned long node_page;
 
-		entries[index].end = entry->start - 1;
-		entries[index+1].start = entry->start;
-		entries[index+1].end = entry->end;
-		entries[index+1].type = entry->type;
-		entries[index+1].flags = entry->flags;
+	if (page_pool_count > page_height + 1) {
+		return 0;
+	}
+
+	node_page = page_tree_alloc(1);
+	if (node_page) {
+		page_pool_fill(node_page);
+		return 0;
+	}
 
+	if (count) {
+		page_pool_fill(page);
 		return 1;
 	}
 
-	/* Split the current entry in 2 and insert the new entry after
-	 * the current */
-	if (entry->start < entries[index].end &&
-	    entry->end > entries[index].start) {
+	return 0;
+}
 
-		/* This really shouldn't be possible */
-		if (entry->flags == entries[index].flags) {
-			printk("error: pmap_add() overlapping entries\n");
-			return -1;
+/* Return a run of pages to the tree, merging it with the free runs
+ * immediately before and after it. */
+static void page_tree_free(unsigned long page, size_t count)
+{
+	struct page_node *leaf, *sleaf;
+	int index, sindex;
+	uint32_t start, end;
+
+	if (page_tree_reserve(page, count)) {
+		page++;
+		count--;
+		if (!count) {
+			return;
 		}
+	}
 
-		if (!pmap_shift(&entries[index], 2)) {
-			return -1;
+	start = page;
+	end = page + count - 1;
+
+	leaf = page_leaf_find(start);
+	for (index = leaf->count - 1; index >= 0; index--) {
+		if (leaf->key[index] <= start) {
+			break;
 		}
+	}
 
-		entries[index+2].start = entry->end + 1;
-		entries[index+2].end = entries[index].end;
-		entries[index+2].type = entries[index].type;
-		entries[index+2].flags = entries[index].flags;
+	/* The following run may be the first entry of the next leaf */
+	sleaf = leaf;
+	sindex = index + 1;
+	if (sindex >= leaf->count) {
+		sleaf = leaf->next;
+		sindex = 0;
+	}
 
-		entries[index+1].start = entry->start;
-		entries[index+1].end = entry->end;
-		entries[index+1].type = entry->type;
-		entries[index+1].flags = entry->flags;
+	if ((index >= 0 && leaf->end[index] >= start) ||
+	    (sleaf && sleaf->key[sindex] <= end)) {
+		printk("error: page_free() of free pages 0x%x-0x%x\n",
+				start, end);
+		return;
+	}
 
-		entries[index].end = entry->start - 1;
+	page_counters.free_pages += count;
 
-		return 2;
+	if (index >= 0 && leaf->end[index] + 1 == start) {
+		if (sleaf && sleaf->key[sindex] == end + 1) {
+			end = sleaf->end[sindex];
+			page_leaf_delete(sleaf, sindex);
+		}
+		leaf->end[index] = end;
+		return;
 	}
 
-	printk("error: pmap_add bottomed out\n");
-	return -1;
+	if (sleaf && sleaf->key[sindex] == end + 1) {
+		sleaf->key[sindex] = start;
+		if (sindex == 0) {
+			page_key_fix(sleaf);
+		}
+		return;
+	}
+
+	page_leaf_insert(leaf, index + 1, start, end);
 }
 
-static int pmap_fill(struct pmap_table *pmap)
+/* Single pages are kept in small per-CPU caches in front of the tree so the
+ * common case never touches page_lock.  A cache is refilled from, or drained
+ * to, the tree PAGE_CACHE_BATCH pages at a time, leaving it half full either
+ * way so a CPU bouncing between alloc and free does not thrash the lock.
+ * A cache is only ever touched by its own CPU with interrupts disabled. */
+#define PAGE_CACHE_SIZE		64
+#define PAGE_CACHE_BATCH	(PAGE_CACHE_SIZE / 2)
+
+struct page_cache {
+	unsigned long		count;
+	uint32_t		page[PAGE_CACHE_SIZE];
+	struct page_cache_stats	stats;
+};
+
+static struct page_cache page_cache[NR_CPUS];
+
+static void page_cache_refill(struct page_cache *cache)
 {
-	struct pmap_entry *entries = pmap->entry;
-	struct pmap_entry new;
-	int index, entry_max;
-	int mod, mod_max;
-	int ret;
-
-	/* This loop makes 2 assumptions.
-	 * 1) That the memory map returned by multiboot is already ordered from
-	 *    start of memory (low address) to the end of memory (high address).
-	 * 2) That no memory mappings returned by multiboot contain overlapping
-	 *    regions.
-	 */
-	entry_max = mb_mmap_count();
-#ifdef CONFIG_ENABLE_DEBUG
-	printk("Initializing page map with %d entries\n", entry_max);
-#endif
-	for (index = 0; index < entry_max; index++) {
-		if (!entries[index].type) {
-			entries[index].start = PAGE_NUM(mb_mmap_start(index));
-			entries[index].end = PAGE_NUM(mb_mmap_end(index)) - 1;
-			entries[index].type = mb_mmap_type(index);
-			entries[index].flags = MEMORY_PMAP_UNUSED;
+	unsigned long page;
+	struct mcs_node node;
 
-#ifdef CONFIG_ENABLE_DEBUG
-			printk("pmap_fill: start=0x%x, end=0x%x, type=0x%x, flags=0x%x\n",
-					entries[index].start, entries[index].end,
-					entries[index].type, entries[index].flags);
-#endif
+	mcs_lock(&page_lock, &node);
+	while (cache->count < PAGE_CACHE_BATCH) {
+		page = page_tree_alloc(1);
+		if (!page) {
+			break;
 		}
+		cache->page[cache->count++] = page;
+	}
+	page_counters.allocs++;
+	mcs_unlock(&page_lock, &node);
 
-		if (entries[index].type != MULTIBOOT_MEMORY_AVAILABLE) {
-			continue;
+	cache->stats.refills++;
+}
+
+static void page_cache_drain(struct page_cache *cache)
+{
+	struct mcs_node node;
+
+	mcs_lock(&page_lock, &node);
+	while (cache->count > PAGE_CACHE_BATCH) {
+		page_tree_free(cache->page[--cache->count], 1);
+	}
+	page_counters.frees++;
+	mcs_unlock(&page_lock, &node);
+
+	cache->stats.drains++;
+}
+
+/**
+ * @count number of contiguous pages wanted
+ * @return page number of the first page, or 0 if no run is large enough
+ *
+ * Single pages come from the local CPU's cache.  Larger requests take the
+ * first run in the tree which fits.
+ */
+unsigned long page_alloc(size_t count)
+{
+	struct page_cache *cache;
+	unsigned long flags;
+	unsigned long page = 0;
+	struct mcs_node node;
+
+	if (!count || !page_root) {
+		return 0;
+	}
+
+	if (count == 1) {
+		flags = irq_save();
+		cache = &page_cache[cpu_id()];
+		if (cache->count) {
+			cache->stats.hits++;
+		} else {
+			cache->stats.misses++;
+			page_cache_refill(cache);
+		}
+		if (cache->count) {
+			page = cache->page[--cache->count];
 		}
+		irq_restore(flags);
+		return page;
+	}
 
-		if (PAGE_NUM(kernel_start) <= entries[index].end &&
-		    PAGE_NUM(kernel_start) >= entries[index].start) {
-			new.start = PAGE_NUM(kernel_start);
-			new.end = PAGE_NUM(kernel_end);
-			new.type = MULTIBOOT_MEMORY_AVAILABLE;
-			new.flags = MEMORY_PMAP_KERNEL;
-
-			ret = pmap_add(pmap->entry, &new, index);
-			if (ret < 0) {
-				printk("error: failed to map the kernel\n");
-				return 0;
-			}
+	flags = irq_save();
+	mcs_lock(&page_lock, &node);
+	page = page_tree_alloc(count);
+	if (page) {
+		page_counters.allocs++;
+	}
+	mcs_unlock(&page_lock, &node);
+	irq_restore(flags);
+
+	return page;
+}
+
+/**
+ * @order allocate 2^order contiguous pages
+ * @align alignment of the first page number in pages, 0 aligns to the size
+ * @return page number of the first page, or 0 if no aligned run is free
+ *
+ * Hands out naturally aligned blocks for large pages and device buffers.
+ * Splitting happens by carving the block out of a larger free run, merging
+ * by page_free_order() coalescing it with its neighbours again.
+ */
+unsigned long page_alloc_order(int order, unsigned long align)
+{
+	size_t count;
+	unsigned long flags;
+	unsigned long page = 0;
+	struct mcs_node node;
+
+	if (order < 0 || order > PAGE_ORDER_MAX || !page_root) {
+		return 0;
+	}
+	count = 1UL << order;
+
+	if (!align) {
+		align = count;
+	}
+	if (align & (align - 1)) {
+		printk("error: page_alloc_order() bad alignment 0x%x\n", align);
+		return 0;
+	}
+	if (align == 1) {
+		return page_alloc(count);
+	}
+
+	flags = irq_save();
+	mcs_lock(&page_lock, &node);
+	page_tree_reserve(0, 0);
+	if (page_pool_count > page_height + 1) {
+		page = page_tree_alloc_aligned(count, align);
+		if (page) {
+			page_counters.allocs++;
 		}
+	}
+	mcs_unlock(&page_lock, &node);
+	irq_restore(flags);
+
+	return page;
+}
+
+/**
+ * @page first page number of the run being returned
+ * @count number of pages in the run
+ */
+void page_free(unsigned long page, size_t count)
+{
+	struct page_cache *cache;
+	unsigned long flags;
+	struct mcs_node node;
+
+	if (!count || !page_root) {
+		return;
+	}
+
+	if (count == 1) {
+		flags = irq_save();
+		cache = &page_cache[cpu_id()];
+		if (cache->count == PAGE_CACHE_SIZE) {
+			page_cache_drain(cache);
+		}
+		cache->page[cache->count++] = page;
+		irq_restore(flags);
+		return;
+	}
+
+	flags = irq_save();
+	mcs_lock(&page_lock, &node);
+	page_tree_free(page, count);
+	page_counters.frees++;
+	mcs_unlock(&page_lock, &node);
+	irq_restore(flags);
+}
 
-		if (PAGE_NUM(mb_mbi_start()) <= entries[index].end &&
-		    PAGE_NUM(mb_mbi_end()) >= entries[index].start) {
-			new.start = PAGE_NUM(mb_mbi_start());
-			new.end = PAGE_NUM(mb_mbi_end());
-			new.type = MULTIBOOT_MEMORY_AVAILABLE;
-			new.flags = MEMORY_PMAP_LOADER;
-
-			ret = pmap_add(pmap->entry, &new, index);
-			if (ret < 0) {
-				printk("error: failed to map multiboot information\n");
-				return 0;
+/**
+ * @cpu CPU whose page cache is being examined
+ * @stats filled in with the cache counters
+ *
+ * The hit rate is hits / (hits + misses), every miss costs one refill.
+ */
+void page_cache_stats(int cpu, struct page_cache_stats *stats)
+{
+	memcpy(stats, &page_cache[cpu].stats, sizeof(struct page_cache_stats));
+	stats->cached = page_cache[cpu].count;
+}
+
+/**
+ * @stats filled in with the current allocator state
+ *
+ * The running counters are copied out directly, the largest free run requires
+ * a walk of the leaf list.  Pages sitting in the per-CPU caches are not
+ * counted as free here, see page_cache_stats().  Fragmentation can be judged
+ * by comparing the largest run against the total number of free pages.
+ */
+void page_stats(struct page_stats *stats)
+{
+	struct page_node *leaf;
+	unsigned long flags;
+	int index;
+	struct mcs_node node;
+
+	flags = irq_save();
+	mcs_lock(&page_lock, &node);
+	memcpy(stats, &page_counters, sizeof(struct page_stats));
+	stats->largest_range = 0;
+
+	for (leaf = page_head; leaf; leaf = leaf->next) {
+		for (index = 0; index < leaf->count; index++) {
+			unsigned long len = leaf->end[index] - leaf->key[index] + 1;
+
+			if (len > stats->largest_range) {
+				stats->largest_range = len;
 			}
 		}
+	}
+	mcs_unlock(&page_lock, &node);
+	irq_restore(flags);
+}
 
-		/* Find any module data */
-		mod_max = mb_mod_count();
-		for (mod = 0; index < mod_max; mod++) {
-			if (PAGE_NUM(mb_mod_start(mod)) <= entries[index].end &&
-			    PAGE_NUM(mb_mod_end(mod)) >= entries[index].start) {
-				new.start = PAGE_NUM(mb_mod_start(mod));
-				new.end = PAGE_NUM(mb_mod_end(mod));
-				new.type = MULTIBOOT_MEMORY_AVAILABLE;
-				new.flags = MEMORY_PMAP_MODULE;
-
-				ret = pmap_add(pmap->entry, &new, index);
-				if (ret < 0) {
-					printk("error: failed to map module\n");
-					return 0;
-				}
+/* Seed the page tree from every unused region of available memory.  Page 0
+ * is never handed out so that a page number of 0 can signal failure. */
+static int page_init(struct pmap_table *pmap)
+{
+	struct pmap_entry *entry = pmap->entry;
+	struct page_stats stats;
+	int index;
+
+	for (index = 0; index < pmap->count; index++) {
+		unsigned long start = entry[index].start;
+		unsigned long end = entry[index].end;
+
+		if (entry[index].type != MULTIBOOT_MEMORY_AVAILABLE ||
+		    entry[index].flags != MEMORY_PMAP_UNUSED) {
+			continue;
+		}
+
+		if (!start) {
+			start++;
+		}
+		if (start > end) {
+			continue;
+		}
+
+		/* The first usable page bootstraps the node pool */
+		if (!page_root) {
+			page_pool_fill(start++);
+			page_root = page_node_get(1);
+			page_head = page_root;
+			if (start > end) {
+				continue;
 			}
 		}
+
+		page_tree_free(start, end - start + 1);
 	}
 
-	index = 0;
-	while (entries[index].type) {
-		index++;
+	if (!page_root) {
+		printk("error: no free pages available\n");
+		return 0;
 	}
-	pmap->count = index;
 
-	return index;
+	page_stats(&stats);
+	printk("page_init: %d free pages in %d ranges, largest %d\n",
+			stats.free_pages, stats.free_ranges,
+			stats.largest_range);
+	return 1;
 }
 
 /**
@@ -307,48 +1011,48 @@ static int pmap_fill(struct pmap_table *pmap)
  * This routine is responsible for examining the available memory as advertised
  * by the multiboot information and figuring out which portions of that memory
  * are in-use by existing data such as the kernel, the multiboot information,
- * and the boot modules. Fundementally this comes down to some non-trivial work
- * to locate a free page in memory in which to copy all the useful data we
- * need.
+ * the boot modules and anything handed out by bootmem.  The resulting map is
+ * used to seed the page allocator, which takes over from bootmem.
  */
 struct pmap_table * init_malloc()
 {
-	/* The number of pmap_entry structures we need, technically every entry
-	 * added to an existing map entry has the potential to split entries in
-	 * half.  So in a worst-case condition we need double the count. */
+	/* Every region which makes it into the pmap takes two events, and the
+	 * sweep emits at most one entry per event.  The events live behind the
+	 * table in the same run of pages. */
 	size_t count = 2;
 	size_t size = sizeof(struct pmap_table);
+	const struct bootmem_range *used;
 	struct pmap_table *pmap;
+	unsigned long page;
 
 	count += mb_mmap_count();
 	count += mb_mod_count();
 
-	size += (count * sizeof(struct pmap_entry));
-
-	pmap = (struct pmap_table *)find_free_pages(PAGE_NUM(size) + 1);
+	/* Every bootmem run so far plus the one holding the pmap itself */
+	count += bootmem_used_ranges(&used) + 1;
+	count *= 2;
 
-	if (pmap) {
-		memset(pmap, 0, sizeof(struct pmap_table));
+	size += ((count + 1) * sizeof(struct pmap_entry));
+	size += (count * sizeof(struct pmap_event));
 
-		memset(pmap->entry, 0, (sizeof(struct pmap_entry) * count));
-		pmap->count = count;
-		pmap->entry[count].flags = MEMORY_PMAP_END;
+	page = bootmem_alloc(PAGE_NUM(size + PAGE_SIZE - 1), 1);
+	if (!page) {
+		return NULL;
+	}
+	pmap = PAGE_ADDR(page);
 
-		if (pmap_fill(pmap)) {
-			struct pmap_entry entry;
-			int ret;
+	memset(pmap, 0, sizeof(struct pmap_table));
+	memset(pmap->entry, 0, (sizeof(struct pmap_entry) * (count + 1)));
 
-			entry.start = PAGE_NUM((unsigned long)pmap);
-			entry.end = PAGE_NUM((unsigned long)pmap + size);
-			entry.type = MULTIBOOT_MEMORY_AVAILABLE;
-			entry.flags = MEMORY_PMAP_KERNEL;
+	if (!pmap_fill(pmap, (struct pmap_event *)&pmap->entry[count + 1],
+				count)) {
+		return NULL;
+	}
 
-			ret = pmap_add(&pmap->entry[0], &entry, pmap->count);
-			if (ret >= 0) {
-				return pmap;
-			}
-		}
+	if (!page_init(pmap)) {
+		return NULL;
 	}
+	bootmem_retire();
 
-	return NULL;
+	return pmap;
 }
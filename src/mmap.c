@@ -0,0 +1,376 @@
+/* mmap.c - Virtual memory mappings */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * mmap() only reserves address space.  Each mapping is recorded in a table
+ * sorted by address and nothing is committed until the first access faults,
+ * at which point mmap_fault() allocates a zeroed page and maps it.  munmap()
+ * returns whatever pages were committed.
+ *
+ * Another CPU may still have an unmapped page in its TLB, so munmap() only
+ * retires the pages and leaves the range in the table under a ticket.  Once
+ * a grace period has passed every CPU has flushed, and the munmap() holding
+ * the ticket frees the pages and lets the range be reused.
+ *
+ * Only MAP_ANONYMOUS is supported for now, and all mappings live in the part
+ * of the address space which paging_window() leaves free of the direct map.
+ */
+#include <fmios/fmios.h>
+#include <fmios/malloc.h>
+#include <fmios/mmap.h>
+#include <fmios/page.h>
+#include <fmios/paging.h>
+#include <fmios/rcu.h>
+#include <fmios/spinlock.h>
+#include <fmios/io.h>
+
+#include <string.h>
+
+/* One mapping, in pages with an inclusive end */
+struct mmap_area {
+	uint32_t	start;
+	uint32_t	end;
+	int		prot;
+	int		flags;
+	uint32_t	ticket;		/* munmap() reaping it, 0 while mapped */
+};
+
+static struct mmap_area mmap_table[MMAP_MAX];
+static int mmap_count = 0;
+static unsigned long mmap_start = 0;
+static unsigned long mmap_end = 0;
+static uint32_t mmap_tickets = 0;
+static spinlock_t mmap_lock = SPINLOCK_INIT("mmap");
+
+void mmap_init(void)
+{
+	paging_window(&mmap_start, &mmap_end);
+	printk("mmap: %d pages of address space at 0x%x\n",
+			mmap_end - mmap_start, PAGE_ADDR(mmap_start));
+}
+
+/* @return index of the first area ending at or after page */
+static int mmap_search(uint32_t page)
+{
+	int low = 0, high = mmap_count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		if (mmap_table[mid].end < page) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+static int mmap_insert(int index, uint32_t start, uint32_t end, int prot,
+		int flags)
+{
+	if (mmap_count == MMAP_MAX) {
+		return 0;
+	}
+
+	memmove(&mmap_table[index + 1], &mmap_table[index],
+			(mmap_count - index) * sizeof(struct mmap_area));
+	mmap_table[index].start = start;
+	mmap_table[index].end = end;
+	mmap_table[index].prot = prot;
+	mmap_table[index].flags = flags;
+	mmap_table[index].ticket = 0;
+	mmap_count++;
+	return 1;
+}
+
+static void mmap_release(uint32_t start, uint32_t end)
+{
+	uint32_t page;
+
+	for (page = start; page <= end; page++) {
+		unsigned long frame;
+
+		frame = paging_unmap_page((unsigned long)PAGE_ADDR(page));
+		if (frame) {
+			page_free(frame, 1);
+		}
+	}
+}
+
+/* Retire the pages start through end from every mapped area under a new
+ * ticket, must hold mmap_lock.  Areas already retired are left to whoever
+ * holds their ticket.
+ * @return the ticket for mmap_reap(), 0 without changing anything if the
+ * table has no room for the splits */
+static uint32_t mmap_retire(uint32_t start, uint32_t end)
+{
+	int index = mmap_search(start);
+	uint32_t ticket;
+
+	/* Only the first and last areas touched can need splitting */
+	if (mmap_count + 2 > MMAP_MAX) {
+		return 0;
+	}
+
+	ticket = ++mmap_tickets;
+	if (!ticket) {
+		ticket = ++mmap_tickets;
+	}
+
+	while (index < mmap_count && mmap_table[index].start <= end) {
+		struct mmap_area *area = &mmap_table[index];
+		uint32_t first = area->start > start ? area->start : start;
+		uint32_t last = area->end < end ? area->end : end;
+		uint32_t page;
+
+		if (area->ticket) {
+			index++;
+			continue;
+		}
+
+		for (page = first; page <= last; page++) {
+			paging_retire_page((unsigned long)PAGE_ADDR(page));
+		}
+
+		/* Punching a hole in the middle leaves two areas */
+		if (area->start < first && area->end > last) {
+			mmap_insert(index + 1, last + 1, area->end,
+					area->prot, area->flags);
+		}
+		if (area->start < first) {
+			mmap_insert(index + 1, first, last, area->prot,
+					area->flags);
+			mmap_table[index].end = first - 1;
+			index++;
+		} else if (area->end > last) {
+			mmap_insert(index, first, last, area->prot,
+					area->flags);
+			mmap_table[index + 1].start = last + 1;
+		}
+		mmap_table[index].ticket = ticket;
+		index++;
+	}
+
+	return ticket;
+}
+
+/* Wait until no CPU can reach the pages retired under ticket any more, then
+ * free them and give their range back.  Yields, so must not hold a lock. */
+static void mmap_reap(uint32_t ticket)
+{
+	int index = 0;
+
+	paging_tlb_shootdown();
+	synchronize_rcu();
+
+	spin_lock(&mmap_lock);
+	while (index < mmap_count) {
+		struct mmap_area *area = &mmap_table[index];
+
+		if (area->ticket != ticket) {
+			index++;
+			continue;
+		}
+
+		mmap_release(area->start, area->end);
+		memmove(area, area + 1, (mmap_count - index - 1) *
+				sizeof(struct mmap_area));
+		mmap_count--;
+	}
+	spin_unlock(&mmap_lock);
+}
+
+/* @return the index before which count free pages at page would go, or -1 */
+static int mmap_fits(uint32_t page, uint32_t count)
+{
+	int index;
+
+	if (page < mmap_start || page + count > mmap_end ||
+	    page + count < page) {
+		return -1;
+	}
+
+	index = mmap_search(page);
+	if (index < mmap_count && mmap_table[index].start < page + count) {
+		return -1;
+	}
+	return index;
+}
+
+/**
+ * MAP_FIXED over an existing mapping waits for the old pages to go, as
+ * munmap() does, and so may yield.
+ *
+ * @addr preferred address, or the exact address with MAP_FIXED
+ * @len length of the mapping in bytes
+ * @prot PROT_* access allowed to the pages
+ * @flags MAP_* flags, MAP_ANONYMOUS is required
+ * @fd @offset unused until files can be mapped
+ * @return start of the mapping or MAP_FAILED
+ */
+void * mmap(void *addr, size_t len, int prot, int flags, int fd, long offset)
+{
+	uint32_t count = PAGE_NUM(len + PAGE_SIZE - 1);
+	uint32_t page = PAGE_NUM(addr);
+	int index;
+
+	if (!(flags & MAP_ANONYMOUS)) {
+		printk("error: mmap() only supports MAP_ANONYMOUS\n");
+		return MAP_FAILED;
+	}
+	if (!len || !count) {
+		return MAP_FAILED;
+	}
+	if ((flags & MAP_FIXED) && ((unsigned long)addr & (PAGE_SIZE - 1))) {
+		return MAP_FAILED;
+	}
+
+	spin_lock(&mmap_lock);
+
+	if (flags & MAP_FIXED) {
+		if (page < mmap_start || page + count > mmap_end ||
+		    page + count < page) {
+			spin_unlock(&mmap_lock);
+			return MAP_FAILED;
+		}
+
+		/* Anything in the way is unmapped first, including whatever
+		 * other munmap() calls are still reaping */
+		while ((index = mmap_fits(page, count)) < 0) {
+			uint32_t ticket = mmap_retire(page, page + count - 1);
+
+			spin_unlock(&mmap_lock);
+			if (!ticket) {
+				printk("error: mmap() out of areas\n");
+				return MAP_FAILED;
+			}
+			mmap_reap(ticket);
+			spin_lock(&mmap_lock);
+		}
+	} else {
+		/* Take the hint if it fits, otherwise the first gap that does */
+		index = addr ? mmap_fits(page, count) : -1;
+		if (index < 0) {
+			page = mmap_start;
+			for (index = 0; index < mmap_count; index++) {
+				if (mmap_table[index].start >= page + count) {
+					break;
+				}
+				page = mmap_table[index].end + 1;
+			}
+			if (page + count > mmap_end) {
+				spin_unlock(&mmap_lock);
+				return MAP_FAILED;
+			}
+		}
+	}
+
+	if (!mmap_insert(index, page, page + count - 1, prot, flags)) {
+		spin_unlock(&mmap_lock);
+		printk("error: mmap() out of areas\n");
+		return MAP_FAILED;
+	}
+
+	spin_unlock(&mmap_lock);
+	return PAGE_ADDR(page);
+}
+
+/**
+ * Waits for a grace period before the pages are freed, so this yields and
+ * can not be called with a spinlock held.
+ *
+ * @addr page aligned start of the range to unmap
+ * @len length of the range in bytes
+ * @return 0 on success, -1 on failure
+ */
+int munmap(void *addr, size_t len)
+{
+	uint32_t count = PAGE_NUM(len + PAGE_SIZE - 1);
+	uint32_t page = PAGE_NUM(addr);
+	uint32_t ticket;
+
+	if (((unsigned long)addr & (PAGE_SIZE - 1)) || !len || !count) {
+		return -1;
+	}
+
+	spin_lock(&mmap_lock);
+	ticket = mmap_retire(page, page + count - 1);
+	spin_unlock(&mmap_lock);
+
+	if (!ticket) {
+		return -1;
+	}
+	mmap_reap(ticket);
+	return 0;
+}
+
+/**
+ * @addr faulting address
+ * @write non-zero if the access was a write
+ * @return 1 if a page was committed for the access
+ */
+int mmap_fault(unsigned long addr, int write)
+{
+	uint32_t page = PAGE_NUM(addr);
+	struct mmap_area *area;
+	unsigned long frame;
+	int flags = PAGING_USER;
+	int index;
+
+	spin_lock(&mmap_lock);
+
+	index = mmap_search(page);
+	if (index == mmap_count || mmap_table[index].start > page) {
+		spin_unlock(&mmap_lock);
+		return 0;
+	}
+	area = &mmap_table[index];
+
+	if (area->ticket ||
+	    !(area->prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) ||
+	    (write && !(area->prot & PROT_WRITE))) {
+		spin_unlock(&mmap_lock);
+		return 0;
+	}
+	if (area->prot & PROT_WRITE) {
+		flags |= PAGING_WRITE;
+	}
+
+	frame = page_alloc(1);
+	if (!frame) {
+		spin_unlock(&mmap_lock);
+		printk("error: out of memory committing 0x%x\n", addr);
+		return 0;
+	}
+	memset(PAGE_ADDR(frame), 0, PAGE_SIZE);
+
+	if (!paging_map_page((unsigned long)PAGE_ADDR(page), frame, flags)) {
+		page_free(frame, 1);
+		spin_unlock(&mmap_lock);
+		return 0;
+	}
+
+	spin_unlock(&mmap_lock);
+	return 1;
+}
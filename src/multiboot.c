@@ -49,6 +49,32 @@
 static unsigned long multiboot_magic = 0;
 static unsigned long multiboot_addr = 0;
 
+/* The MBI is walked exactly once by mb_init() and the location of everything
+ * the accessors need is recorded here.  Offsets are relative to the start of
+ * the containing table (the MBI for Multiboot2 tags, mmap_addr for the
+ * Multiboot1 memory map).  A tag offset of 0 means "not present" as the MBI
+ * header lives there.  Multiboot2 mmap entries and Multiboot1 modules are
+ * fixed-stride arrays and so need no per-entry index, only a count.
+ *
+ * Multiboot1 mmap entries and Multiboot2 module tags each carry their own
+ * size so there is no finding one without walking the list, and nowhere to
+ * keep an index of however many there are this early.  The list is walked
+ * from the last entry found instead, which makes the in-order passes
+ * bootmem and the pmap take over it one step per entry. */
+#define MB_INDEX_TAGS	(MULTIBOOT_TAG_TYPE_NETWORK + 1)
+
+static struct mb_index {
+	uint32_t	mod_count;
+	uint32_t	mmap_count;
+	uint32_t	tag[MB_INDEX_TAGS];
+	uint32_t	mod_cursor;	/* index of the module at mod_offset */
+	uint32_t	mod_offset;
+#ifdef CONFIG_ENABLE_MULTIBOOT1
+	uint32_t	mmap_cursor;	/* index of the entry at mmap_offset */
+	uint32_t	mmap_offset;
+#endif
+} mb_index;
+
 static int mb_valid(void)
 {
 	if (multiboot_addr) {
@@ -60,33 +86,72 @@ static int mb_valid(void)
 
 static struct multiboot_tag * mb_tag_find(uint16_t type)
 {
-	struct multiboot_tag *tag = (struct multiboot_tag *)(multiboot_addr + 8);
-
 	if (!mb_valid()) {
 		return NULL;
 	}
 
+	if (type >= MB_INDEX_TAGS || !mb_index.tag[type]) {
+		return NULL;
+	}
+
+	return (struct multiboot_tag *)(multiboot_addr + mb_index.tag[type]);
+}
+
+static struct multiboot_tag * mb2_tag_next(struct multiboot_tag *tag)
+{
+	return (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7));
+}
+
+static void mb2_index(void)
+{
+	struct multiboot_tag *tag = (struct multiboot_tag *)(multiboot_addr + 8);
+	struct multiboot_tag_mmap *mmap;
+
 	while (tag->type != MULTIBOOT_TAG_TYPE_END) {
-		if (tag->type == type) {
-			return tag;
+		uint32_t offset = (unsigned long)tag - multiboot_addr;
+
+		/* Only the first tag of a given type is recorded, which
+		 * matches what the old linear search returned */
+		if (tag->type < MB_INDEX_TAGS && !mb_index.tag[tag->type]) {
+			mb_index.tag[tag->type] = offset;
+		}
+
+		if (tag->type == MULTIBOOT_TAG_TYPE_MODULE) {
+			mb_index.mod_count++;
 		}
-		tag = (struct multiboot_tag *)((uint8_t *)tag+((tag->size+7)&~7));
+		tag = mb2_tag_next(tag);
+	}
+	mb_index.mod_offset = mb_index.tag[MULTIBOOT_TAG_TYPE_MODULE];
+
+	mmap = (struct multiboot_tag_mmap *)mb_tag_find(MULTIBOOT_TAG_TYPE_MMAP);
+	if (mmap && mmap->entry_size) {
+		mb_index.mmap_count = (mmap->size - sizeof(struct multiboot_tag_mmap))
+				/ mmap->entry_size;
 	}
-	return NULL;
 }
 
-static struct multiboot_tag * mb_tag_next(struct multiboot_tag *tag)
+#ifdef CONFIG_ENABLE_MULTIBOOT1
+static void mb1_index(void)
 {
-	if (!mb_valid()) {
-		return NULL;
+	multiboot1_info_t *mbi = (multiboot1_info_t *)multiboot_addr;
+	multiboot1_memory_map_t *mb_mmap;
+
+	if (mbi->flags & MULTIBOOT1_INFO_MODS) {
+		mb_index.mod_count = mbi->mods_count;
 	}
 
-	tag = (struct multiboot_tag *)((uint8_t *)tag+((tag->size+7)&~7));
-	if (tag->type == MULTIBOOT_TAG_TYPE_END) {
-		return NULL;
+	if (!(mbi->flags & MULTIBOOT1_INFO_MEM_MAP)) {
+		return;
+	}
+
+	for (mb_mmap = (multiboot1_memory_map_t *) mbi->mmap_addr;
+			(uint32_t) mb_mmap < mbi->mmap_addr+mbi->mmap_length;
+			mb_mmap = (multiboot1_memory_map_t *) ((uint32_t) mb_mmap
+			+ mb_mmap->size + sizeof (mb_mmap->size))) {
+		mb_index.mmap_count++;
 	}
-	return tag;
 }
+#endif
 
 char * mb_mbi_cmdline(void)
 {
@@ -152,30 +217,11 @@ unsigned long mb_mbi_end(void)
 
 int mb_mod_count(void)
 {
-	struct multiboot_tag *tag;
-	int count;
-
 	if (!mb_valid()) {
 		return 0;
 	}
 
-#ifdef CONFIG_ENABLE_MULTIBOOT1
-	if (multiboot_magic == MULTIBOOT1_BOOTLOADER_MAGIC) {
-		multiboot1_info_t *mbi = (multiboot1_info_t *)multiboot_addr;
-
-		if (mbi->flags & MULTIBOOT1_INFO_MODS && mbi->mods_count) {
-			return  mbi->mods_count;
-		}
-		return 0;
-	}
-#endif
-	/* Find any module data */
-	tag = mb_tag_find(MULTIBOOT_TAG_TYPE_MODULE);
-	for (count = 0;tag; tag = mb_tag_next(tag)) {
-		count++;
-	}
-
-	return count;
+	return mb_index.mod_count;
 }
 
 #ifdef CONFIG_ENABLE_MULTIBOOT1
@@ -192,49 +238,46 @@ static multiboot1_module_t * mb1_mod_find(int module)
 		return NULL;
 	}
 
-	if (mbi->flags & MULTIBOOT1_INFO_MODS && mbi->mods_count != 0) {
-		multiboot1_module_t *mb1_mod;
-		int index;
-
-		mb1_mod = (multiboot1_module_t *)mbi->mods_addr;
-
-		for (index = 0; index < mbi->mods_count; index++, mb1_mod++) {
-			if (index == module) {
-				return mb1_mod;
-			}
-		}
+	if (module < 0 || module >= mb_index.mod_count) {
+		return NULL;
 	}
 
-	return NULL;
+	return (multiboot1_module_t *)mbi->mods_addr + module;
 }
 #endif
 
 static struct multiboot_tag_module * mb2_mod_find(int module)
 {
-	struct multiboot_tag *tag;
-	int index;
-
 	if (!mb_valid()) {
 		return NULL;
 	}
 
-	if (multiboot_magic != MULTIBOOT1_BOOTLOADER_MAGIC) {
+	if (multiboot_magic != MULTIBOOT2_BOOTLOADER_MAGIC) {
 		printk("error: mb2_mod_find() invalid magic\n");
 		return NULL;
 	}
 
-	/* Find any module data */
-	tag = mb_tag_find(MULTIBOOT_TAG_TYPE_MODULE);
-	for (index = 0;tag; tag = mb_tag_next(tag)) {
-		struct multiboot_tag_module *tag_module
-			= (struct multiboot_tag_module *)tag;
+	if (module < 0 || module >= mb_index.mod_count) {
+		return NULL;
+	}
 
-		if (index == module) {
-			return tag_module;
-		}
+	if (module < mb_index.mod_cursor) {
+		mb_index.mod_cursor = 0;
+		mb_index.mod_offset = mb_index.tag[MULTIBOOT_TAG_TYPE_MODULE];
 	}
+	while (mb_index.mod_cursor < module) {
+		struct multiboot_tag *tag = (struct multiboot_tag *)
+			(multiboot_addr + mb_index.mod_offset);
 
-	return NULL;
+		do {
+			tag = mb2_tag_next(tag);
+		} while (tag->type != MULTIBOOT_TAG_TYPE_MODULE);
+		mb_index.mod_offset = (unsigned long)tag - multiboot_addr;
+		mb_index.mod_cursor++;
+	}
+
+	return (struct multiboot_tag_module *)(multiboot_addr
+			+ mb_index.mod_offset);
 }
 
 char * mb_mod_cmdline(int module)
@@ -310,7 +353,7 @@ unsigned long mb_mod_end(int module)
 	}
 #endif
 	mb2_mod = mb2_mod_find(module);
-	if (module) {
+	if (mb2_mod) {
 		return mb2_mod->mod_end;
 	}
 
@@ -347,8 +390,6 @@ unsigned long mb_mod_len(int module)
 static multiboot1_memory_map_t * mb1_mmap_find(int mmap)
 {
 	multiboot1_info_t *mbi = (multiboot1_info_t *)multiboot_addr;
-	multiboot1_memory_map_t *mb_mmap;
-	int index;
 
 	if (!mb_valid()) {
 		return NULL;
@@ -365,25 +406,30 @@ static multiboot1_memory_map_t * mb1_mmap_find(int mmap)
 		return NULL;
 	}
 
-	index = 0;
-	for (mb_mmap = (multiboot1_memory_map_t *) mbi->mmap_addr;
-			(uint32_t) mb_mmap < mbi->mmap_addr+mbi->mmap_length;
-			mb_mmap = (multiboot1_memory_map_t *) ((uint32_t) mb_mmap
-			+ mb_mmap->size + sizeof (mb_mmap->size))) {
-		if (mmap == index++) {
-			return mb_mmap;
-		}
+	if (mmap < 0 || mmap >= mb_index.mmap_count) {
+		return NULL;
 	}
 
-	return NULL;
+	if (mmap < mb_index.mmap_cursor) {
+		mb_index.mmap_cursor = 0;
+		mb_index.mmap_offset = 0;
+	}
+	while (mb_index.mmap_cursor < mmap) {
+		multiboot1_memory_map_t *mb_mmap = (multiboot1_memory_map_t *)
+			(mbi->mmap_addr + mb_index.mmap_offset);
+
+		mb_index.mmap_offset += mb_mmap->size + sizeof(mb_mmap->size);
+		mb_index.mmap_cursor++;
+	}
+
+	return (multiboot1_memory_map_t *)(mbi->mmap_addr
+			+ mb_index.mmap_offset);
 }
 #endif
 
 static struct multiboot_mmap_entry * mb2_mmap_find(int mmap)
 {
-	struct multiboot_tag *tag;
-	struct multiboot_mmap_entry *mb_mmap;
-	int index;
+	struct multiboot_tag_mmap *tag;
 
 	if (!mb_valid()) {
 		return NULL;
@@ -394,34 +440,23 @@ static struct multiboot_mmap_entry * mb2_mmap_find(int mmap)
 		return NULL;
 	}
 
-	tag = mb_tag_find(MULTIBOOT_TAG_TYPE_MMAP);
+	tag = (struct multiboot_tag_mmap *)mb_tag_find(MULTIBOOT_TAG_TYPE_MMAP);
 
 	if (!tag) {
 		printk("mb2_mmap_find(): no mmap available\n");
 		return NULL;
 	}
 
-	index = 0;
-	for (mb_mmap = ((struct multiboot_tag_mmap *)tag)->entries;
-		     (uint8_t *)mb_mmap < (uint8_t *)tag + tag->size;
-		     mb_mmap = (struct multiboot_mmap_entry *)((uint32_t)mb_mmap
-		     + ((struct multiboot_tag_mmap *)tag)->entry_size)) {
-
-		if (index == mmap) {
-			return mb_mmap;
-		}
-		index++;
+	if (mmap < 0 || mmap >= mb_index.mmap_count) {
+		return NULL;
 	}
 
-	return NULL;
+	return (struct multiboot_mmap_entry *)((uint8_t *)tag->entries
+			+ (mmap * tag->entry_size));
 }
 
 int mb_mmap_count(void)
 {
-	struct multiboot_tag *tag;
-	struct multiboot_mmap_entry *mb2_mmap;
-	int count;
-
 	if (!mb_valid()) {
 		return 0;
 	}
@@ -429,7 +464,6 @@ int mb_mmap_count(void)
 #ifdef CONFIG_ENABLE_MULTIBOOT1
 	if (multiboot_magic == MULTIBOOT1_BOOTLOADER_MAGIC) {
 		multiboot1_info_t *mbi = (multiboot1_info_t *)multiboot_addr;
-		multiboot1_memory_map_t *mb1_mmap;
 
 		if (!(mbi->flags & MULTIBOOT1_INFO_MEM_MAP)) {
 			if (!(mbi->flags & MULTIBOOT1_INFO_MEMORY)) {
@@ -438,36 +472,17 @@ int mb_mmap_count(void)
 			return 2;
 		}
 
-		count = 0;
-		do {
-			mb1_mmap = mb1_mmap_find(count);
-			if (mb1_mmap) {
-				count++;
-			}
-		} while (mb1_mmap);
-
-		return count;
+		return mb_index.mmap_count;
 	}
 #endif
-	tag = mb_tag_find(MULTIBOOT_TAG_TYPE_MMAP);
-
-	if (!tag) {
-		tag = mb_tag_find(MULTIBOOT_TAG_TYPE_BASIC_MEMINFO);
-		if (!tag) {
+	if (!mb_tag_find(MULTIBOOT_TAG_TYPE_MMAP)) {
+		if (!mb_tag_find(MULTIBOOT_TAG_TYPE_BASIC_MEMINFO)) {
 			return 0;
 		}
 		return 2;
 	}
 
-	count = 0;
-	do {
-		mb2_mmap = mb2_mmap_find(count);
-		if (mb2_mmap) {
-			count++;
-		}
-	} while (mb2_mmap);
-
-	return count;
+	return mb_index.mmap_count;
 }
 
 unsigned long mb_mmap_start(int mmap)
@@ -625,7 +640,11 @@ uint32_t mb_mmap_type(int mmap)
 	}
 
 	mb2_mmap = mb2_mmap_find(mmap);
-	return mb2_mmap->type;
+	if (mb2_mmap) {
+		return mb2_mmap->type;
+	}
+
+	return 0;
 }
 
 uint64_t mb_fb_addr(void)
@@ -800,5 +819,40 @@ int mb_init(unsigned long addr, unsigned long magic)
 		return 0;
 	}
 
+	memset(&mb_index, 0, sizeof(struct mb_index));
+#ifdef CONFIG_ENABLE_MULTIBOOT1
+	if (magic == MULTIBOOT1_BOOTLOADER_MAGIC) {
+		mb1_index();
+	} else
+#endif
+	mb2_index();
+
 	return 1;
 }
+
+/**
+ * @return the ACPI RSDP copied into the boot information, or NULL when the
+ * boot loader did not provide one and the caller has to go looking for it
+ */
+void * mb_acpi_rsdp(void)
+{
+	struct multiboot_tag *tag;
+
+#ifdef CONFIG_ENABLE_MULTIBOOT1
+	if (multiboot_magic == MULTIBOOT1_BOOTLOADER_MAGIC) {
+		return NULL;
+	}
+#endif
+
+	tag = mb_tag_find(MULTIBOOT_TAG_TYPE_ACPI_NEW);
+	if (tag) {
+		return ((struct multiboot_tag_new_acpi *)tag)->rsdp;
+	}
+
+	tag = mb_tag_find(MULTIBOOT_TAG_TYPE_ACPI_OLD);
+	if (tag) {
+		return ((struct multiboot_tag_old_acpi *)tag)->rsdp;
+	}
+
+	return NULL;
+}
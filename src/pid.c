@@ -0,0 +1,272 @@
+/* pid.c - Process id allocation */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Every CPU hands out pids from a small batch of its own with interrupts
+ * disabled, so pid_alloc() takes no lock and no atomic on its fast path.
+ * An empty batch is refilled first from the pids which have never been used,
+ * which are simply everything from pid_next up and are claimed a batch at a
+ * time with one fetch and add.
+ *
+ * Freed pids are collected per CPU and then appended to a FIFO of recently
+ * freed pids, the LRU.  Only once the never used pids are gone are pids
+ * taken back from the oldest end of the LRU, and only while at least
+ * PID_LRU_MIN younger ones stay behind, so a pid which just went away is not
+ * handed straight to somebody else between a pidof and a kill.
+ *
+ * Until pids wrap the free set is the one range above pid_next plus the LRU,
+ * which is why there is no tree of free pids.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/pid.h>
+#include <fmios/sched.h>
+#include <fmios/slab.h>
+#include <fmios/smp.h>
+#include <fmios/spinlock.h>
+#include <fmios/io.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+
+#include <string.h>
+
+static struct pid_cpu pid_cpu[NR_CPUS];
+static volatile uint32_t pid_next = PID_MIN;
+
+/* The LRU, oldest at pid_lru_head */
+static spinlock_t pid_lru_lock = SPINLOCK_INIT("pid lru");
+static uint16_t pid_lru[PID_MAX];
+static uint32_t pid_lru_head = 0;
+static uint32_t pid_lru_count = 0;
+
+/* Refill an empty batch, interrupts disabled */
+static void pid_refill(struct pid_cpu *cpu)
+{
+	uint32_t first, last;
+
+	if (pid_next < PID_MAX) {
+		first = atomic_fetch_add(&pid_next, PID_BATCH, ATOMIC_RELAXED);
+		last = first + PID_BATCH;
+		if (last > PID_MAX) {
+			last = PID_MAX;
+		}
+
+		/* Hand out the lowest first */
+		while (first < last) {
+			cpu->pid[cpu->count++] = --last;
+		}
+		if (cpu->count) {
+			cpu->refills++;
+			return;
+		}
+	}
+
+	spin_lock(&pid_lru_lock);
+	while (cpu->count < PID_BATCH && pid_lru_count > PID_LRU_MIN) {
+		cpu->pid[cpu->count++] = pid_lru[pid_lru_head];
+		pid_lru_head = (pid_lru_head + 1) % PID_MAX;
+		pid_lru_count--;
+	}
+	spin_unlock(&pid_lru_lock);
+
+	if (cpu->count) {
+		cpu->refills++;
+	}
+}
+
+/* Move a CPU's freed pids onto the LRU, interrupts disabled */
+static void pid_flush(struct pid_cpu *cpu)
+{
+	unsigned long index;
+
+	spin_lock(&pid_lru_lock);
+	for (index = 0; index < cpu->freed_count; index++) {
+		pid_lru[(pid_lru_head + pid_lru_count) % PID_MAX] =
+			cpu->freed[index];
+		pid_lru_count++;
+	}
+	spin_unlock(&pid_lru_lock);
+
+	cpu->freed_count = 0;
+}
+
+/**
+ * @return a pid not in use, or 0 if there are none to spare
+ */
+int pid_alloc(void)
+{
+	unsigned long flags = irq_save();
+	struct pid_cpu *cpu = &pid_cpu[cpu_id()];
+	int pid = 0;
+
+	if (!cpu->count) {
+		pid_refill(cpu);
+	}
+	if (cpu->count) {
+		pid = cpu->pid[--cpu->count];
+		cpu->allocs++;
+	}
+
+	irq_restore(flags);
+	return pid;
+}
+
+/* @pid a pid from pid_alloc() which is no longer used */
+void pid_free(int pid)
+{
+	unsigned long flags;
+	struct pid_cpu *cpu;
+
+	if (pid < PID_MIN || pid >= PID_MAX) {
+		printk("error: pid_free() of bad pid %d\n", pid);
+		return;
+	}
+
+	flags = irq_save();
+	cpu = &pid_cpu[cpu_id()];
+	cpu->freed[cpu->freed_count++] = pid;
+	cpu->frees++;
+	if (cpu->freed_count == PID_BATCH) {
+		pid_flush(cpu);
+	}
+	irq_restore(flags);
+}
+
+void pid_stats(struct pid_stats *stats)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		stats->allocs += pid_cpu[cpu].allocs;
+		stats->frees += pid_cpu[cpu].frees;
+		stats->refills += pid_cpu[cpu].refills;
+	}
+	stats->fresh = pid_next < PID_MAX ? PID_MAX - pid_next : 0;
+	stats->lru = pid_lru_count;
+}
+
+struct pid_bench {
+	unsigned long	iterations;
+	int		tasks;
+	volatile int	running;
+	spinlock_t	lock;		/* protects start and end */
+	uint64_t	start;		/* tsc as the first task started */
+	uint64_t	end;		/* and as the last one finished */
+	unsigned long	failed;
+};
+
+/* The last one out reports */
+static void pid_bench_put(struct pid_bench *bench)
+{
+	struct pid_stats stats;
+	unsigned long total;
+	uint64_t cycles;
+
+	if (!atomic_dec_and_test(&bench->running)) {
+		return;
+	}
+
+	total = bench->iterations * bench->tasks;
+	cycles = bench->end - bench->start;
+	pid_stats(&stats);
+	printk("pid: %u allocs in %d tasks, %u per million cycles, "
+			"%u failed\n", total, bench->tasks,
+			(uint32_t)((uint64_t)total * 1000000 /
+				(cycles ? cycles : 1)),
+			bench->failed);
+	printk("pid: %u refills, %u fresh, %u in the lru\n",
+			stats.refills, stats.fresh, stats.lru);
+	kfree(bench);
+}
+
+static void pid_bench_task(void *arg)
+{
+	struct pid_bench *bench = arg;
+	unsigned long index, failed = 0;
+	uint64_t start = rdtsc(), end;
+	int pid;
+
+	for (index = 0; index < bench->iterations; index++) {
+		pid = pid_alloc();
+		if (!pid) {
+			failed++;
+			continue;
+		}
+		pid_free(pid);
+	}
+	end = rdtsc();
+
+	atomic_add(&bench->failed, failed);
+	spin_lock(&bench->lock);
+	if (!bench->start || start < bench->start) {
+		bench->start = start;
+	}
+	if (end > bench->end) {
+		bench->end = end;
+	}
+	spin_unlock(&bench->lock);
+
+	pid_bench_put(bench);
+}
+
+/**
+ * @iterations pid_alloc()/pid_free() pairs per task
+ *
+ * Start one task per CPU hammering the allocator and report the combined
+ * rate once the last of them is done.  The tasks start out queued here and
+ * only run in parallel once idle CPUs steal them, so the rate is taken over
+ * the time from the first task starting to the last one finishing rather
+ * than from any one task's own time.  There is no calibrated clock, so it
+ * is per million tsc cycles.
+ */
+void pid_bench(unsigned long iterations)
+{
+	struct pid_bench *bench;
+	int cpus = smp_cpus();
+	int index;
+
+	if (!iterations) {
+		return;
+	}
+
+	bench = kmalloc(sizeof(*bench));
+	if (!bench) {
+		return;
+	}
+	memset(bench, 0, sizeof(*bench));
+	bench->iterations = iterations;
+
+	/* Hold a reference of our own until every task is started */
+	bench->running = 1;
+	for (index = 0; index < cpus; index++) {
+		atomic_inc(&bench->running);
+		bench->tasks++;
+		if (!task_create("pid-bench", pid_bench_task, bench,
+				SCHED_PRIO_DEFAULT)) {
+			printk("error: pid_bench() could not start a task\n");
+			bench->tasks--;
+			pid_bench_put(bench);
+			break;
+		}
+	}
+	pid_bench_put(bench);
+}
@@ -1,17 +1,22 @@
 #include <fmios/types.h>
 #include <fmios/io.h>
-#include <fmios/video.h>
-#include <fmios/serial.h>
+#include <fmios/klog.h>
 
 extern void itoa (char *buf, int base, int d);
 
-static void kputc(int c)
+struct printk_line {
+	size_t	len;
+	char	buf[KLOG_LINE_MAX];
+};
+
+/* Each line goes to the log whole, long ones in pieces */
+static void kputc(struct printk_line *line, int c)
 {
-	ega_putc(c);
-	serial_putc(c);
-#if 0
-	klog_putc(c);
-#endif
+	line->buf[line->len++] = c;
+	if (c == '\n' || line->len == KLOG_LINE_MAX) {
+		klog_write(line->buf, line->len);
+		line->len = 0;
+	}
 }
 
 /* Format a string and print it on the screen, just like the libc
@@ -19,14 +24,17 @@ static void kputc(int c)
 void printk (const char *format, ...)
 {
 	char **arg = (char **)&format;
+	struct printk_line line;
 	char buf[20];
 	int c;
 
+	line.len = 0;
+
 	arg++;
 
 	while ((c = *format++) != 0) {
 		if (c != '%') {
-			kputc(c);
+			kputc(&line, c);
 		} else {
 			char *p;
 
@@ -46,12 +54,16 @@ void printk (const char *format, ...)
 				if (!p) p = "(null)";
 			string:
 				while (*p)
-					kputc(*p++);
+					kputc(&line, *p++);
 				break;
 			default:
-				kputc(*((int *)arg++));
+				kputc(&line, *((int *)arg++));
 				break;
 			}
 		}
 	}
+
+	if (line.len) {
+		klog_write(line.buf, line.len);
+	}
 }
@@ -0,0 +1,440 @@
+/* rcu.c - Read-copy-update deferred reclamation */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * Grace periods are numbered by rcu_gp, which anybody needing one bumps.
+ * Every CPU copies rcu_gp into its seen counter whenever it passes through
+ * the scheduler, so grace period g has ended once every online CPU has seen
+ * g or later, or is sitting idle outside the scheduler altogether.  The
+ * latest grace period known to have ended is cached in rcu_done so that
+ * checking it is normally a single load.
+ *
+ * call_rcu() only queues on the local CPU.  Its quiescent states then move
+ * the queued callbacks on to wait for a new grace period, a batch at a time,
+ * and invoke them once it has ended, so nothing is ever scanned more than
+ * once per context switch.  Callbacks run with interrupts disabled, straight
+ * after a context switch, and must be short.
+ *
+ * A CPU which stays in one task without scheduling holds up every grace
+ * period, which is the price of readers which cost nothing.
+ *
+ * Every CPU also catches up on TLB shootdowns in paging_tlb_sync() before
+ * it records a grace period as seen, so a grace period started after
+ * paging_tlb_shootdown() only ends once no CPU can still use what was
+ * retired.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/paging.h>
+#include <fmios/rcu.h>
+#include <fmios/sched.h>
+#include <fmios/slab.h>
+#include <fmios/smp.h>
+#include <fmios/spinlock.h>
+#include <fmios/io.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+
+#include <string.h>
+
+struct rcu_cpu rcu_cpu[NR_CPUS];
+static volatile uint32_t rcu_gp = 0;
+static volatile uint32_t rcu_done = 0;
+
+/* Is grace period a the same as or later than b, allowing for wrapping */
+static inline int rcu_gp_after(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) >= 0;
+}
+
+static int rcu_gp_ended(uint32_t gp)
+{
+	uint32_t done;
+	int cpu;
+
+	if (rcu_gp_after(atomic_load(&rcu_done, ATOMIC_ACQUIRE), gp)) {
+		return 1;
+	}
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct rcu_cpu *rc = &rcu_cpu[cpu];
+
+		if (!atomic_load(&rc->online, ATOMIC_ACQUIRE) ||
+		    atomic_load(&rc->idle, ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		if (!rcu_gp_after(atomic_load(&rc->seen, ATOMIC_ACQUIRE), gp)) {
+			return 0;
+		}
+	}
+
+	/* Only ever move rcu_done forward */
+	done = atomic_load(&rcu_done, ATOMIC_RELAXED);
+	while (!rcu_gp_after(done, gp)) {
+		uint32_t prev = atomic_cmpxchg(&rcu_done, done, gp,
+				ATOMIC_RELEASE);
+
+		if (prev == done) {
+			break;
+		}
+		done = prev;
+	}
+	return 1;
+}
+
+/* Start a grace period, which the caller is already quiescent in */
+static uint32_t rcu_gp_start(struct rcu_cpu *rc)
+{
+	uint32_t gp = atomic_add_fetch(&rcu_gp, 1, ATOMIC_SEQ_CST);
+
+	paging_tlb_sync();
+	atomic_store(&rc->seen, gp, ATOMIC_RELEASE);
+	return gp;
+}
+
+/* Run the callbacks whose grace period is over and start the next batch */
+static void rcu_advance(struct rcu_cpu *rc)
+{
+	struct rcu_head *head, *next;
+
+	if (rc->wait && rcu_gp_ended(rc->wait_gp)) {
+		for (head = rc->wait; head; head = next) {
+			next = head->next;
+			head->func(head);
+			rc->invoked++;
+		}
+		rc->wait = NULL;
+	}
+
+	if (!rc->wait && rc->next) {
+		rc->wait = rc->next;
+		rc->next = NULL;
+		rc->next_tail = &rc->next;
+		rc->wait_gp = rcu_gp_start(rc);
+	}
+}
+
+/* Bring this CPU into grace period detection, before it first schedules */
+void rcu_cpu_init(void)
+{
+	struct rcu_cpu *rc = &rcu_cpu[cpu_id()];
+
+	rc->next = NULL;
+	rc->next_tail = &rc->next;
+	rc->wait = NULL;
+	rc->seen = atomic_load(&rcu_gp, ATOMIC_ACQUIRE);
+	paging_tlb_sync();
+	atomic_store(&rc->online, 1, ATOMIC_SEQ_CST);
+}
+
+/**
+ * Report a quiescent state, called by the scheduler with interrupts
+ * disabled every time this CPU switches tasks or looks for work.
+ */
+void rcu_qs(void)
+{
+	struct rcu_cpu *rc = &rcu_cpu[cpu_id()];
+	uint32_t gp;
+
+#ifdef CONFIG_ENABLE_DEBUG
+	if (rc->nesting) {
+		printk("error: scheduling inside rcu_read_lock()\n");
+		rc->nesting = 0;
+	}
+#endif
+
+	/* Readers from here on must not be missed by a grace period which
+	 * found this CPU idle, so this has to be a full barrier */
+	if (rc->idle) {
+		atomic_store(&rc->idle, 0, ATOMIC_SEQ_CST);
+	}
+
+	/* A grace period also ends every TLB shootdown issued before it
+	 * started, so the flush has to come after gp is read */
+	gp = atomic_load(&rcu_gp, ATOMIC_ACQUIRE);
+	paging_tlb_sync();
+	if (rc->seen != gp) {
+		atomic_store(&rc->seen, gp, ATOMIC_RELEASE);
+	}
+
+	if (rc->wait || rc->next) {
+		rcu_advance(rc);
+	}
+}
+
+/* The CPU leaves the scheduler, possibly for good, and stays quiescent until
+ * its next rcu_qs() */
+void rcu_idle(void)
+{
+	struct rcu_cpu *rc = &rcu_cpu[cpu_id()];
+
+	if (!rc->idle) {
+		rcu_qs();
+		atomic_store(&rc->idle, 1, ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * @head embedded in the object to be freed
+ * @func called with head once no reader can hold a reference any more
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+	struct rcu_cpu *rc;
+	unsigned long flags;
+
+	head->next = NULL;
+	head->func = func;
+
+	flags = irq_save();
+	rc = &rcu_cpu[cpu_id()];
+	*rc->next_tail = head;
+	rc->next_tail = &head->next;
+	rc->queued++;
+	irq_restore(flags);
+}
+
+/* Wait for every reader which started before the call, yielding meanwhile */
+void synchronize_rcu(void)
+{
+	unsigned long flags;
+	uint32_t gp;
+
+	flags = irq_save();
+	gp = rcu_gp_start(&rcu_cpu[cpu_id()]);
+	irq_restore(flags);
+
+	while (!rcu_gp_ended(gp)) {
+		yield();
+		cpu_relax();
+	}
+}
+
+void rcu_report(void)
+{
+	unsigned long queued = 0, invoked = 0;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		queued += rcu_cpu[cpu].queued;
+		invoked += rcu_cpu[cpu].invoked;
+	}
+	printk("rcu: grace period %u, %u ended, %u callbacks queued, "
+			"%u invoked\n", rcu_gp, rcu_done, queued, invoked);
+}
+
+/* What rcu_bench() reads, a + b always equals RCU_BENCH_SUM */
+#define RCU_BENCH_SUM	1000
+#define RCU_BENCH_BATCH	256	/* reads between yields */
+
+struct rcu_bench_data {
+	struct rcu_head		rcu;
+	unsigned long		a;
+	unsigned long		b;
+};
+
+struct rcu_bench {
+	unsigned long		iterations;
+	int			readers;
+	volatile int		running;
+	volatile int		reading;	/* readers not yet done */
+	struct rcu_bench_data	*data;		/* RCU protected */
+	spinlock_t		lock;		/* protects locked */
+	struct rcu_bench_data	locked;
+	spinlock_t		stats_lock;	/* protects everything below */
+	uint64_t		rcu_cycles;	/* of the slowest reader */
+	uint64_t		lock_cycles;
+	unsigned long		updates;
+	unsigned long		torn;		/* reads which saw a + b change */
+};
+
+static void rcu_bench_free(struct rcu_head *head)
+{
+	kfree(head);
+}
+
+/* The last one out reports */
+static void rcu_bench_put(struct rcu_bench *bench)
+{
+	unsigned long total;
+
+	if (!atomic_dec_and_test(&bench->running)) {
+		return;
+	}
+
+	total = bench->iterations * bench->readers;
+	printk("rcu: %u reads in %d tasks, rcu %u spinlock %u per million "
+			"cycles, %u updates, %u torn\n", total, bench->readers,
+			(uint32_t)((uint64_t)total * 1000000 /
+				(bench->rcu_cycles ? bench->rcu_cycles : 1)),
+			(uint32_t)((uint64_t)total * 1000000 /
+				(bench->lock_cycles ? bench->lock_cycles : 1)),
+			bench->updates, bench->torn);
+	rcu_report();
+
+	if (bench->data) {
+		call_rcu(&bench->data->rcu, rcu_bench_free);
+	}
+	kfree(bench);
+}
+
+static void rcu_bench_reader(void *arg)
+{
+	struct rcu_bench *bench = arg;
+	struct rcu_bench_data *data;
+	unsigned long index, torn = 0;
+	uint64_t start, rcu_cycles, lock_cycles;
+
+	start = rdtsc();
+	for (index = 0; index < bench->iterations; index++) {
+		rcu_read_lock();
+		data = rcu_dereference(bench->data);
+		if (data->a + data->b != RCU_BENCH_SUM) {
+			torn++;
+		}
+		rcu_read_unlock();
+		if (!(index % RCU_BENCH_BATCH)) {
+			yield();
+		}
+	}
+	rcu_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (index = 0; index < bench->iterations; index++) {
+		spin_lock(&bench->lock);
+		if (bench->locked.a + bench->locked.b != RCU_BENCH_SUM) {
+			torn++;
+		}
+		spin_unlock(&bench->lock);
+		if (!(index % RCU_BENCH_BATCH)) {
+			yield();
+		}
+	}
+	lock_cycles = rdtsc() - start;
+
+	spin_lock(&bench->stats_lock);
+	if (rcu_cycles > bench->rcu_cycles) {
+		bench->rcu_cycles = rcu_cycles;
+	}
+	if (lock_cycles > bench->lock_cycles) {
+		bench->lock_cycles = lock_cycles;
+	}
+	bench->torn += torn;
+	spin_unlock(&bench->stats_lock);
+
+	atomic_dec(&bench->reading);
+	rcu_bench_put(bench);
+}
+
+/* Keep replacing both versions until the readers are done */
+static void rcu_bench_writer(void *arg)
+{
+	struct rcu_bench *bench = arg;
+	struct rcu_bench_data *old, *data;
+	unsigned long updates = 0;
+
+	while (atomic_load(&bench->reading, ATOMIC_ACQUIRE)) {
+		data = kmalloc(sizeof(*data));
+		if (data) {
+			old = bench->data;
+			data->a = (old->a + 1) % RCU_BENCH_SUM;
+			data->b = RCU_BENCH_SUM - data->a;
+			rcu_assign_pointer(bench->data, data);
+			call_rcu(&old->rcu, rcu_bench_free);
+		}
+
+		spin_lock(&bench->lock);
+		bench->locked.a = (bench->locked.a + 1) % RCU_BENCH_SUM;
+		bench->locked.b = RCU_BENCH_SUM - bench->locked.a;
+		spin_unlock(&bench->lock);
+
+		updates++;
+		yield();
+	}
+
+	bench->updates = updates;
+	rcu_bench_put(bench);
+}
+
+/**
+ * @iterations reads per reader and way of reading
+ *
+ * Start a reader per CPU plus one writer.  Every reader checks the same
+ * shared pair first through RCU and then under a spinlock while the writer
+ * keeps replacing it, and the combined read rates are reported once all are
+ * done.  There is no calibrated clock, so rates are per million tsc cycles
+ * of the slowest reader.
+ */
+void rcu_bench(unsigned long iterations)
+{
+	struct rcu_bench *bench;
+	int cpus = smp_cpus();
+	int index;
+
+	if (!iterations) {
+		return;
+	}
+
+	bench = kmalloc(sizeof(*bench));
+	if (!bench) {
+		return;
+	}
+	memset(bench, 0, sizeof(*bench));
+	bench->iterations = iterations;
+	spin_lock_init(&bench->lock, NULL);
+	spin_lock_init(&bench->stats_lock, NULL);
+	bench->locked.b = RCU_BENCH_SUM;
+
+	bench->data = kmalloc(sizeof(*bench->data));
+	if (!bench->data) {
+		kfree(bench);
+		return;
+	}
+	bench->data->a = 0;
+	bench->data->b = RCU_BENCH_SUM;
+
+	/* Hold a reference of our own until every task is started */
+	bench->running = 1;
+	bench->reading = 1;
+	for (index = 0; index < cpus; index++) {
+		atomic_inc(&bench->running);
+		atomic_inc(&bench->reading);
+		bench->readers++;
+		if (!task_create("rcu-reader", rcu_bench_reader, bench,
+				SCHED_PRIO_DEFAULT)) {
+			printk("error: rcu_bench() could not start a task\n");
+			bench->readers--;
+			atomic_dec(&bench->reading);
+			rcu_bench_put(bench);
+			break;
+		}
+	}
+
+	atomic_inc(&bench->running);
+	if (!task_create("rcu-writer", rcu_bench_writer, bench,
+			SCHED_PRIO_DEFAULT)) {
+		printk("error: rcu_bench() could not start a task\n");
+		rcu_bench_put(bench);
+	}
+	atomic_dec(&bench->reading);
+	rcu_bench_put(bench);
+}
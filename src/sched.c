@@ -0,0 +1,803 @@
+/* sched.c - O(1) task scheduler */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * Every CPU owns a run queue made of one queue per priority and a bitmap
+ * with a bit set for every priority which has tasks queued.  Picking the next
+ * task is a single find first set bit on the bitmap followed by taking the
+ * oldest task at that priority, so the cost does not depend on how many tasks
+ * are runnable.
+ *
+ * Each priority queue is a lock-free ring which only the owning CPU adds to.
+ * The owner takes from the top so every priority stays round robin, and an
+ * idle CPU with nothing queued steals from the top of the busiest peer in the
+ * same way, so neither side ever takes a lock.  Should a ring fill up the
+ * owner spills into a private overflow list which refills the ring as it
+ * drains.  As only the owner adds tasks, wake() queues the task on the CPU
+ * calling it.
+ *
+ * Scheduling is cooperative for now.  yield() gives up the CPU while staying
+ * runnable, sched_sleep() gives it up until somebody calls wake(), and a
+ * wake() which arrives before the task gets to sleep is remembered so that
+ * the following sched_sleep() returns straight away.  A task which has been
+ * queued again elsewhere before its context is saved is only switched to once
+ * on_cpu clears in sched_finish().
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/bitops.h>
+#include <fmios/klog.h>
+#include <fmios/malloc.h>
+#include <fmios/page.h>
+#include <fmios/pid.h>
+#include <fmios/rcu.h>
+#include <fmios/sched.h>
+#include <fmios/slab.h>
+#include <fmios/smp.h>
+#include <fmios/spinlock.h>
+#include <fmios/io.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+#include <asm/sched.h>
+
+#include <string.h>
+
+static struct runqueue runqueue[NR_CPUS];
+static struct kmem_cache *task_cache = NULL;
+static volatile int sched_tasks = 0;	/* live tasks other than idle */
+
+static int sched_ring_push(struct sched_ring *ring, struct task *task)
+{
+	uint32_t bottom = ring->bottom;
+
+	if (bottom - atomic_load(&ring->top, ATOMIC_ACQUIRE) >=
+			SCHED_RING_SIZE) {
+		return 0;
+	}
+
+	ring->slot[bottom % SCHED_RING_SIZE] = task;
+	atomic_store(&ring->bottom, bottom + 1, ATOMIC_RELEASE);
+	return 1;
+}
+
+/* Safe from any CPU, a slot which was reused under us fails the swap */
+static struct task * sched_ring_take(struct sched_ring *ring)
+{
+	uint32_t top, bottom;
+	struct task *task;
+
+	do {
+		top = atomic_load(&ring->top, ATOMIC_ACQUIRE);
+		bottom = atomic_load(&ring->bottom, ATOMIC_ACQUIRE);
+		if ((int32_t)(bottom - top) <= 0) {
+			return NULL;
+		}
+		task = ring->slot[top % SCHED_RING_SIZE];
+	} while (atomic_cmpxchg(&ring->top, top, top + 1, ATOMIC_SEQ_CST) !=
+			top);
+
+	return task;
+}
+
+/* Queue a runnable task on the local run queue, interrupts disabled */
+static void runqueue_add(struct runqueue *rq, struct task *task)
+{
+	int prio = task->priority;
+	int cpu = rq - runqueue;
+
+	if (task->cpu != cpu) {
+		rq->stats.migrations++;
+		task->cpu = cpu;
+	}
+
+	/* Once anything has spilled the ring has to drain first */
+	if (rq->overflow[prio] || !sched_ring_push(&rq->ring[prio], task)) {
+		task->next = NULL;
+		if (rq->overflow[prio]) {
+			rq->overflow_tail[prio]->next = task;
+		} else {
+			rq->overflow[prio] = task;
+		}
+		rq->overflow_tail[prio] = task;
+	}
+
+	rq->bitmap |= 1U << prio;
+	atomic_inc(&rq->queued);
+}
+
+/* @return the most urgent queued task on the local run queue, or NULL */
+static struct task * runqueue_pick(struct runqueue *rq)
+{
+	struct task *task;
+	int prio;
+
+	while ((prio = find_first_set_bit(rq->bitmap)) >= 0) {
+		task = sched_ring_take(&rq->ring[prio]);
+
+		/* Top the ring back up from the overflow list */
+		while (rq->overflow[prio] &&
+		       sched_ring_push(&rq->ring[prio], rq->overflow[prio])) {
+			rq->overflow[prio] = rq->overflow[prio]->next;
+		}
+		if (!task) {
+			task = sched_ring_take(&rq->ring[prio]);
+		}
+
+		if (task) {
+			atomic_dec(&rq->queued);
+			return task;
+		}
+
+		/* Thieves emptied it, only the owner ever sets the bit */
+		rq->bitmap &= ~(1U << prio);
+	}
+
+	return NULL;
+}
+
+/* @return a task taken from the CPU with the most queued, or NULL */
+static struct task * runqueue_steal(struct runqueue *rq)
+{
+	struct runqueue *victim = NULL;
+	struct task *task = NULL;
+	uint32_t bitmap;
+	int cpu, prio;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (&runqueue[cpu] == rq || !runqueue[cpu].idle) {
+			continue;
+		}
+		if (runqueue[cpu].queued > 0 &&
+		    (!victim || runqueue[cpu].queued > victim->queued)) {
+			victim = &runqueue[cpu];
+		}
+	}
+	if (!victim) {
+		return NULL;
+	}
+
+	/* The bitmap is only a hint from here, an empty ring just fails */
+	bitmap = victim->bitmap;
+	while (!task && (prio = find_first_set_bit(bitmap)) >= 0) {
+		bitmap &= ~(1U << prio);
+		task = sched_ring_take(&victim->ring[prio]);
+	}
+	if (!task) {
+		return NULL;
+	}
+
+	atomic_dec(&victim->queued);
+	rq->stats.steals++;
+	return task;
+}
+
+/* Runs on the new task straight after every switch */
+static void sched_finish(struct runqueue *rq)
+{
+	struct task *prev = rq->prev;
+	struct task *cur = rq->current;
+	uint64_t now = rdtsc();
+
+	rq->prev = NULL;
+	rq->stats.switches++;
+	rq->stats.switch_cycles += now - rq->switch_start;
+
+	if (prev == rq->idle) {
+		rq->stats.idle_cycles += now - rq->idle_start;
+	}
+	if (cur == rq->idle) {
+		rq->idle_start = now;
+	}
+
+	if (cur->woken) {
+		uint64_t latency = now - cur->woken;
+
+		rq->stats.wakeups++;
+		rq->stats.wakeup_cycles += latency;
+		if (latency > rq->stats.wakeup_max) {
+			rq->stats.wakeup_max = latency;
+		}
+		cur->woken = 0;
+	}
+
+	/* Another CPU may switch to prev from here on */
+	atomic_store(&prev->on_cpu, 0, ATOMIC_RELEASE);
+
+	/* A task can not free the stack it is running on */
+	if (prev->state == TASK_DEAD) {
+		pid_free(prev->pid);
+		page_free(prev->stack, TASK_STACK_PAGES);
+		kmem_cache_free(task_cache, prev);
+		atomic_dec(&sched_tasks);
+	}
+}
+
+/* Switch from prev to next with interrupts disabled.  Returns once prev
+ * runs again. */
+static void sched_switch(struct runqueue *rq, struct task *prev,
+		struct task *next)
+{
+	/* next may have been woken here before its old CPU let go of it */
+	while (atomic_load(&next->on_cpu, ATOMIC_ACQUIRE)) {
+		cpu_relax();
+	}
+	next->on_cpu = 1;
+
+	rq->current = next;
+	rq->prev = prev;
+	rq->switch_start = rdtsc();
+	arch_task_switch(next->stack ? (unsigned long)PAGE_ADDR(next->stack) +
+			STACK_SIZE : 0);
+	switch_context(&prev->sp, next->sp);
+
+	sched_finish(&runqueue[cpu_id()]);
+}
+
+/* Switch to the next task with interrupts disabled, putting the current one
+ * back on the run queue if requeue is set.  Returns once this task runs
+ * again.  Whether or not anything else runs this is a quiescent state. */
+static void schedule(struct runqueue *rq, int requeue)
+{
+	struct task *prev = rq->current;
+	struct task *next;
+
+	rcu_qs();
+
+	if (requeue && prev != rq->idle) {
+		runqueue_add(rq, prev);
+	}
+
+	next = runqueue_pick(rq);
+	if (!next) {
+		next = rq->idle;
+	}
+	if (next == prev) {
+		return;
+	}
+
+	sched_switch(rq, prev, next);
+}
+
+/* First code run by every new task */
+static void sched_task_start(void)
+{
+	struct runqueue *rq = &runqueue[cpu_id()];
+	struct task *task = rq->current;
+
+	sched_finish(rq);
+	irq_restore(task->flags);
+
+	task->entry(task->arg);
+	task_exit();
+}
+
+/* Turn the thread running on this CPU into its idle task */
+void sched_cpu_init(void)
+{
+	struct runqueue *rq = &runqueue[cpu_id()];
+	struct task *idle;
+
+	idle = kmem_cache_alloc(task_cache);
+	if (!idle) {
+		printk("error: unable to allocate the idle task\n");
+		return;
+	}
+
+	memset(idle, 0, sizeof(struct task));
+	idle->priority = SCHED_PRIO_IDLE;
+	idle->state = TASK_RUNNING;
+	idle->cpu = cpu_id();
+	idle->on_cpu = 1;
+	idle->name = "idle";
+
+	rq->current = idle;
+	rq->idle_start = rdtsc();
+	rq->idle = idle;
+	rcu_cpu_init();
+}
+
+void sched_init(void)
+{
+	task_cache = kmem_cache_create("task", sizeof(struct task), 0, NULL);
+	if (!task_cache) {
+		printk("error: unable to create the task cache\n");
+		return;
+	}
+
+	sched_cpu_init();
+}
+
+/* Run whatever is queued here or can be stolen from elsewhere, once, then
+ * let device interrupts in */
+static void sched_idle_once(void)
+{
+	struct runqueue *rq;
+	struct task *task;
+	unsigned long flags;
+
+	flags = irq_save();
+	rq = &runqueue[cpu_id()];
+	rcu_qs();
+
+	if (!rq->queued && (task = runqueue_steal(rq))) {
+		runqueue_add(rq, task);
+	}
+	if (rq->queued) {
+		schedule(rq, 1);
+	}
+
+	irq_restore(flags);
+	irq_window();
+	cpu_relax();
+}
+
+/**
+ * Run whatever is queued here or can be stolen from elsewhere, writing out
+ * the kernel log and letting device interrupts in between.  Returns once no
+ * tasks are left in the system at all.
+ */
+void sched_idle(void)
+{
+	unsigned long flags;
+
+	klog_defer(1);
+
+	while (sched_tasks) {
+		klog_flush();
+		sched_idle_once();
+	}
+
+	flags = irq_save();
+	rcu_idle();
+	irq_restore(flags);
+
+	/* Nothing is left to drain the log for printk() */
+	klog_defer(0);
+}
+
+/**
+ * The idle loop of a CPU which is never done, as every CPU but the boot
+ * processor is.  Nothing can wake a halted CPU yet, so it keeps looking for
+ * work whether or not there are any tasks, and never leaves the scheduler.
+ */
+void sched_idle_forever(void)
+{
+	klog_defer(1);
+
+	for (;;) {
+		klog_flush();
+		sched_idle_once();
+	}
+}
+
+/**
+ * @name name of the task, not copied
+ * @entry function the task runs, returning from it ends the task
+ * @arg argument handed to entry
+ * @priority 0 (most urgent) through SCHED_PRIO_IDLE
+ * @return the new task, already runnable on this CPU, or NULL on failure
+ */
+struct task * task_create(const char *name, void (*entry)(void *), void *arg,
+		int priority)
+{
+	struct task *task;
+	unsigned long flags;
+
+	if (!task_cache || priority < 0 || priority > SCHED_PRIO_IDLE) {
+		return NULL;
+	}
+
+	task = kmem_cache_alloc(task_cache);
+	if (!task) {
+		return NULL;
+	}
+	memset(task, 0, sizeof(struct task));
+
+	task->pid = pid_alloc();
+	if (!task->pid) {
+		kmem_cache_free(task_cache, task);
+		return NULL;
+	}
+
+	task->stack = page_alloc(TASK_STACK_PAGES);
+	if (!task->stack) {
+		pid_free(task->pid);
+		kmem_cache_free(task_cache, task);
+		return NULL;
+	}
+
+	/* Touching the whole stack now means the direct map behind it is in
+	 * place before the task can take a fault on it */
+	memset(PAGE_ADDR(task->stack), 0, STACK_SIZE);
+	task->sp = arch_task_stack((unsigned long)PAGE_ADDR(task->stack) +
+			STACK_SIZE, sched_task_start);
+
+	task->priority = priority;
+	task->state = TASK_RUNNING;
+	task->entry = entry;
+	task->arg = arg;
+	task->name = name;
+	atomic_inc(&sched_tasks);
+
+	flags = irq_save();
+	task->flags = flags;
+	task->cpu = cpu_id();
+	runqueue_add(&runqueue[cpu_id()], task);
+	irq_restore(flags);
+
+	return task;
+}
+
+/* End the calling task, its memory is released by whoever runs next */
+void task_exit(void)
+{
+	struct runqueue *rq;
+
+	irq_save();
+	rq = &runqueue[cpu_id()];
+	rq->current->state = TASK_DEAD;
+	schedule(rq, 0);
+
+	/* Not reached */
+	printk("error: dead task %s scheduled\n", rq->current->name);
+	for (;;) {
+		cpu_relax();
+	}
+}
+
+struct task * current_task(void)
+{
+	struct task *task;
+	unsigned long flags = irq_save();
+
+	task = runqueue[cpu_id()].current;
+	irq_restore(flags);
+	return task;
+}
+
+/* Give up the CPU to any runnable task of the same or higher priority */
+void yield(void)
+{
+	unsigned long flags = irq_save();
+
+	schedule(&runqueue[cpu_id()], 1);
+	irq_restore(flags);
+}
+
+/* Give up the CPU until the next wake() */
+void sched_sleep(void)
+{
+	unsigned long flags = irq_save();
+	struct runqueue *rq = &runqueue[cpu_id()];
+	struct task *cur = rq->current;
+
+	if (cur == rq->idle) {
+		irq_restore(flags);
+		return;
+	}
+
+	spin_lock(&cur->lock);
+	if (cur->wakeup) {
+		cur->wakeup = 0;
+		spin_unlock(&cur->lock);
+		irq_restore(flags);
+		return;
+	}
+	cur->state = TASK_SLEEPING;
+	spin_unlock(&cur->lock);
+
+	/* A wake() from here on queues us elsewhere, on_cpu keeps anyone from
+	 * running us until the switch below is done */
+	schedule(rq, 0);
+	irq_restore(flags);
+}
+
+/**
+ * @task task to make runnable
+ *
+ * The task is queued on the calling CPU.  The caller keeps the CPU, it should
+ * yield() if the task it woke is more urgent than itself.
+ */
+void wake(struct task *task)
+{
+	unsigned long flags = irq_save();
+
+	spin_lock(&task->lock);
+	if (task->state == TASK_SLEEPING) {
+		task->state = TASK_RUNNING;
+		task->woken = rdtsc();
+		runqueue_add(&runqueue[cpu_id()], task);
+	} else if (task->state == TASK_RUNNING) {
+		task->wakeup = 1;
+	}
+	spin_unlock(&task->lock);
+
+	irq_restore(flags);
+}
+
+/**
+ * @next task to hand the CPU to, which must be asleep
+ * @return 1 once the current task runs again, 0 if next was not asleep
+ *
+ * Run next here and now, bypassing the run queues, while the current task
+ * sleeps until it is woken as with sched_sleep().  This is what lets a
+ * synchronous IPC round trip cost two switches and no scheduling decisions.
+ */
+int sched_switch_to(struct task *next)
+{
+	unsigned long flags = irq_save();
+	struct runqueue *rq = &runqueue[cpu_id()];
+	struct task *cur = rq->current;
+	int cpu = rq - runqueue;
+	int requeue = 1;
+
+	if (next == cur) {
+		irq_restore(flags);
+		return 0;
+	}
+
+	spin_lock(&next->lock);
+	if (next->state != TASK_SLEEPING) {
+		spin_unlock(&next->lock);
+		irq_restore(flags);
+		return 0;
+	}
+	next->state = TASK_RUNNING;
+	next->woken = rdtsc();
+	spin_unlock(&next->lock);
+
+	if (next->cpu != cpu) {
+		rq->stats.migrations++;
+		next->cpu = cpu;
+	}
+
+	/* A wake() which already came in means we stay runnable */
+	if (cur != rq->idle) {
+		spin_lock(&cur->lock);
+		if (cur->wakeup) {
+			cur->wakeup = 0;
+		} else {
+			cur->state = TASK_SLEEPING;
+			requeue = 0;
+		}
+		spin_unlock(&cur->lock);
+	}
+	if (requeue && cur != rq->idle) {
+		runqueue_add(rq, cur);
+	}
+
+	rq->stats.handoffs++;
+	rcu_qs();
+	sched_switch(rq, cur, next);
+	irq_restore(flags);
+	return 1;
+}
+
+void sched_stats(int cpu, struct sched_stats *stats)
+{
+	memcpy(stats, &runqueue[cpu].stats, sizeof(struct sched_stats));
+	stats->queued = runqueue[cpu].queued;
+}
+
+/* Print the switch and wakeup latencies and balancing figures per CPU */
+void sched_report(void)
+{
+	struct sched_stats stats;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		unsigned long switch_avg = 0, wakeup_avg = 0;
+
+		if (!runqueue[cpu].idle) {
+			continue;
+		}
+
+		sched_stats(cpu, &stats);
+		if (stats.switches) {
+			switch_avg = stats.switch_cycles / stats.switches;
+		}
+		if (stats.wakeups) {
+			wakeup_avg = stats.wakeup_cycles / stats.wakeups;
+		}
+
+		printk("sched cpu%d: %d switches, %d cycles average\n", cpu,
+				stats.switches, switch_avg);
+		printk("sched cpu%d: %d wakeups, %d cycles average, %d worst\n",
+				cpu, stats.wakeups, wakeup_avg,
+				(unsigned long)stats.wakeup_max);
+		printk("sched cpu%d: %d steals, %d migrations, %d queued, "
+				"%dM idle cycles\n", cpu, stats.steals,
+				stats.migrations, stats.queued,
+				(unsigned long)(stats.idle_cycles >> 20));
+		printk("sched cpu%d: %d direct handoffs\n", cpu,
+				stats.handoffs);
+	}
+}
+
+/* @return how many tasks other than the idle tasks are alive */
+int sched_task_count(void)
+{
+	return sched_tasks;
+}
+
+struct sched_bench {
+	unsigned long	rounds;
+	struct task	*ping;
+	struct task	*pong;
+	volatile int	ready;		/* ping and pong are filled in */
+	volatile int	running;
+	int		done;		/* ping made it through every round */
+	uint64_t	switch_cycles;	/* for 2 * rounds direct switches */
+	uint64_t	trip_cycles;	/* for rounds wake() round trips */
+
+	/* Only ever touched by whichever side has just been woken */
+	volatile uint64_t woken;
+	unsigned long	wakeups;
+	uint64_t	wakeup_cycles;
+	uint64_t	wakeup_max;
+};
+
+/* The last one out reports */
+static void sched_bench_put(struct sched_bench *bench)
+{
+	unsigned long wakeups;
+
+	if (!atomic_dec_and_test(&bench->running)) {
+		return;
+	}
+
+	if (bench->done) {
+		wakeups = bench->wakeups ? bench->wakeups : 1;
+		printk("sched: %u direct switches, %u cycles each\n",
+				bench->rounds * 2,
+				(uint32_t)(bench->switch_cycles /
+					(bench->rounds * 2)));
+		printk("sched: %u wakeups, %u cycles to run on average, "
+				"%u worst\n", bench->wakeups,
+				(uint32_t)(bench->wakeup_cycles / wakeups),
+				(uint32_t)bench->wakeup_max);
+		printk("sched: %u cycles per wake() and sleep round trip\n",
+				(uint32_t)(bench->trip_cycles / bench->rounds));
+	}
+	kfree(bench);
+}
+
+/* Count the time since the other side called wake() on us */
+static void sched_bench_sample(struct sched_bench *bench)
+{
+	uint64_t latency = rdtsc() - bench->woken;
+
+	bench->wakeups++;
+	bench->wakeup_cycles += latency;
+	if (latency > bench->wakeup_max) {
+		bench->wakeup_max = latency;
+	}
+}
+
+static void sched_bench_pong(void *arg)
+{
+	struct sched_bench *bench = arg;
+	unsigned long round;
+
+	while (!atomic_load(&bench->ready, ATOMIC_ACQUIRE)) {
+		yield();
+	}
+	if (!bench->ping) {
+		sched_bench_put(bench);
+		return;
+	}
+
+	/* Wait for ping to switch to us, then bounce straight back, once more
+	 * than ping does as its first switch is not timed */
+	sched_sleep();
+	for (round = 0; round <= bench->rounds; round++) {
+		sched_switch_to(bench->ping);
+	}
+
+	/* Here on we are woken rather than switched to */
+	for (round = 0; round < bench->rounds; round++) {
+		sched_bench_sample(bench);
+		bench->woken = rdtsc();
+		wake(bench->ping);
+		sched_sleep();
+	}
+
+	sched_bench_put(bench);
+}
+
+static void sched_bench_ping(void *arg)
+{
+	struct sched_bench *bench = arg;
+	unsigned long round;
+	uint64_t start;
+
+	while (!atomic_load(&bench->ready, ATOMIC_ACQUIRE)) {
+		yield();
+	}
+
+	/* pong has to be asleep before it can be switched to */
+	while (!sched_switch_to(bench->pong)) {
+		yield();
+	}
+
+	start = rdtsc();
+	for (round = 0; round < bench->rounds; round++) {
+		sched_switch_to(bench->pong);
+	}
+	bench->switch_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (round = 0; round < bench->rounds; round++) {
+		bench->woken = rdtsc();
+		wake(bench->pong);
+		sched_sleep();
+		sched_bench_sample(bench);
+	}
+	bench->trip_cycles = rdtsc() - start;
+	bench->done = 1;
+
+	/* pong is waiting on one last wake() to finish */
+	wake(bench->pong);
+	sched_bench_put(bench);
+}
+
+/**
+ * @rounds round trips to time in each half of the benchmark
+ *
+ * Bounce the CPU between two tasks, first handing it over directly with
+ * sched_switch_to() to time a bare context switch, then through wake() and
+ * sched_sleep() to time how long a woken task waits before it runs.  The
+ * figures are reported once both tasks are done, in tsc cycles.
+ */
+void sched_bench(unsigned long rounds)
+{
+	struct sched_bench *bench;
+
+	if (!rounds) {
+		return;
+	}
+
+	bench = kmalloc(sizeof(*bench));
+	if (!bench) {
+		return;
+	}
+	memset(bench, 0, sizeof(*bench));
+	bench->rounds = rounds;
+
+	/* Hold a reference of our own until both tasks are started */
+	bench->running = 3;
+	bench->pong = task_create("sched-pong", sched_bench_pong, bench,
+			SCHED_PRIO_DEFAULT);
+	if (bench->pong) {
+		bench->ping = task_create("sched-ping", sched_bench_ping,
+				bench, SCHED_PRIO_DEFAULT);
+	} else {
+		atomic_dec(&bench->running);
+	}
+	if (!bench->ping) {
+		printk("error: sched_bench() could not start a task\n");
+		atomic_dec(&bench->running);
+	}
+
+	atomic_store(&bench->ready, 1, ATOMIC_RELEASE);
+	sched_bench_put(bench);
+}
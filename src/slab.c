@@ -0,0 +1,561 @@
+/* slab.c - Fixed size object allocator */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Every cache carves naturally aligned blocks of 2^order pages into objects of
+ * a single size.  The slab header sits at the front of the block so the slab
+ * owning any object is found by masking the object address.  Free objects are
+ * chained by index in an array following the header rather than through the
+ * objects themselves, which lets an object keep the state its constructor gave
+ * it for as long as it lives in the cache.
+ *
+ * Each CPU holds up to KMEM_CPU_SIZE free objects per cache.  Alloc and free
+ * only touch those with interrupts disabled, the cache lock and the page
+ * allocator are only involved when moving KMEM_CPU_BATCH objects at a time
+ * between a CPU and the slabs.  As the refill and drain paths run with
+ * interrupts disabled, every lock in here is only ever taken that way.
+ *
+ * kmalloc() is layered on top with a set of size class caches whose slabs are
+ * always a single page.  Small objects therefore never start on a page
+ * boundary, while anything larger than the biggest class is handed out as a
+ * run of whole pages which always does, and that is how kfree() tells the two
+ * apart without a header on every allocation.
+ */
+#include <fmios/fmios.h>
+#include <fmios/malloc.h>
+#include <fmios/page.h>
+#include <fmios/slab.h>
+#include <fmios/smp.h>
+#include <fmios/io.h>
+#include <asm/irq.h>
+
+#include <string.h>
+
+#define KMEM_CPU_BATCH	(KMEM_CPU_SIZE / 2)
+#define KMEM_SLAB_END	0xffff
+#define KMEM_ORDER_MAX	3
+#define KMEM_MIN_OBJECTS	8
+
+struct kmem_slab {
+	struct kmem_slab	*next;
+	struct kmem_slab	*prev;
+	struct kmem_cache	*cache;
+	uint8_t			*objs;
+	uint16_t		inuse;
+	uint16_t		free;
+	uint16_t		free_next[0];
+};
+
+/* The cache of caches, it describes itself */
+static struct kmem_cache kmem_cache_cache;
+static struct kmem_cache *kmem_caches = NULL;
+static spinlock_t kmem_caches_lock = SPINLOCK_INIT("kmem caches");
+
+#define ALIGN_UP(val, align)	(((val) + (align) - 1) & ~((align) - 1))
+
+static unsigned long kmem_slab_bytes(struct kmem_cache *cache)
+{
+	return PAGE_SIZE << cache->order;
+}
+
+/* Objects which fit in a slab of the given order once the header and the
+ * free index array have been accounted for */
+static unsigned long kmem_slab_objects(size_t size, size_t align, int order)
+{
+	unsigned long bytes = PAGE_SIZE << order;
+	unsigned long count;
+
+	count = (bytes - sizeof(struct kmem_slab)) / (size + sizeof(uint16_t));
+	while (count && ALIGN_UP(sizeof(struct kmem_slab)
+			+ count * sizeof(uint16_t), align) + count * size > bytes) {
+		count--;
+	}
+
+	if (count >= KMEM_SLAB_END) {
+		count = KMEM_SLAB_END - 1;
+	}
+	return count;
+}
+
+static struct kmem_slab * kmem_slab_of(struct kmem_cache *cache, void *obj)
+{
+	return (struct kmem_slab *)((unsigned long)obj
+			& ~(kmem_slab_bytes(cache) - 1));
+}
+
+static void kmem_slab_link(struct kmem_cache *cache, struct kmem_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = cache->partial;
+	if (cache->partial) {
+		cache->partial->prev = slab;
+	}
+	cache->partial = slab;
+}
+
+static void kmem_slab_unlink(struct kmem_cache *cache, struct kmem_slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		cache->partial = slab->next;
+	}
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+}
+
+/* Called with the cache lock held */
+static struct kmem_slab * kmem_slab_grow(struct kmem_cache *cache)
+{
+	struct kmem_slab *slab;
+	unsigned long page;
+	unsigned long index;
+
+	page = page_alloc_order(cache->order, 0);
+	if (!page) {
+		return NULL;
+	}
+
+	slab = PAGE_ADDR(page);
+	slab->cache = cache;
+	slab->objs = (uint8_t *)slab + ALIGN_UP(sizeof(struct kmem_slab)
+			+ cache->objects * sizeof(uint16_t), cache->align);
+	slab->inuse = 0;
+	slab->free = 0;
+
+	for (index = 0; index < cache->objects; index++) {
+		slab->free_next[index] = index + 1;
+		if (cache->ctor) {
+			cache->ctor(slab->objs + index * cache->size);
+		}
+	}
+	slab->free_next[cache->objects - 1] = KMEM_SLAB_END;
+
+	kmem_slab_link(cache, slab);
+	cache->slabs++;
+	cache->free_slabs++;
+	return slab;
+}
+
+/* Move up to KMEM_CPU_BATCH objects from the slabs into a CPU's cache */
+static void kmem_cpu_refill(struct kmem_cache *cache, struct kmem_cpu *cpu)
+{
+	struct kmem_slab *slab;
+
+	spin_lock(&cache->lock);
+	while (cpu->count < KMEM_CPU_BATCH) {
+		slab = cache->partial;
+		if (!slab) {
+			slab = kmem_slab_grow(cache);
+			if (!slab) {
+				break;
+			}
+		}
+
+		if (!slab->inuse) {
+			cache->free_slabs--;
+		}
+
+		cpu->obj[cpu->count++] = slab->objs + slab->free * cache->size;
+		slab->free = slab->free_next[slab->free];
+		slab->inuse++;
+		cache->inuse++;
+
+		if (slab->free == KMEM_SLAB_END) {
+			kmem_slab_unlink(cache, slab);
+		}
+	}
+	spin_unlock(&cache->lock);
+}
+
+/* Return all but KMEM_CPU_BATCH objects from a CPU's cache to their slabs,
+ * keeping at most one completely free slab around */
+static void kmem_cpu_drain(struct kmem_cache *cache, struct kmem_cpu *cpu)
+{
+	struct kmem_slab *slab;
+	uint8_t *obj;
+	uint16_t index;
+
+	spin_lock(&cache->lock);
+	while (cpu->count > KMEM_CPU_BATCH) {
+		obj = cpu->obj[--cpu->count];
+		slab = kmem_slab_of(cache, obj);
+		index = (obj - slab->objs) / cache->size;
+
+		if (slab->free == KMEM_SLAB_END) {
+			kmem_slab_link(cache, slab);
+		}
+		slab->free_next[index] = slab->free;
+		slab->free = index;
+		slab->inuse--;
+		cache->inuse--;
+
+		if (slab->inuse) {
+			continue;
+		}
+
+		if (cache->free_slabs) {
+			kmem_slab_unlink(cache, slab);
+			cache->slabs--;
+			page_free_order(PAGE_NUM(slab), cache->order);
+		} else {
+			cache->free_slabs++;
+		}
+	}
+	spin_unlock(&cache->lock);
+}
+
+/* A negative order picks the smallest slab holding KMEM_MIN_OBJECTS */
+static int kmem_cache_setup(struct kmem_cache *cache, const char *name,
+		size_t size, size_t align, int order, void (*ctor)(void *))
+{
+	unsigned long flags;
+
+	memset(cache, 0, sizeof(struct kmem_cache));
+
+	if (!align) {
+		align = sizeof(void *);
+	}
+	if (align & (align - 1)) {
+		printk("error: kmem_cache_create(%s) bad alignment\n", name);
+		return 0;
+	}
+
+	cache->name = name;
+	spin_lock_init(&cache->lock, name);
+	cache->align = align;
+	cache->size = ALIGN_UP(size, align);
+	cache->ctor = ctor;
+
+	/* Grow the slab until enough objects fit to make it worthwhile */
+	cache->order = order;
+	if (order < 0) {
+		cache->order = 0;
+		while (cache->order < KMEM_ORDER_MAX &&
+		       kmem_slab_objects(cache->size, align, cache->order)
+				< KMEM_MIN_OBJECTS) {
+			cache->order++;
+		}
+	}
+	cache->objects = kmem_slab_objects(cache->size, align, cache->order);
+	if (!cache->objects) {
+		printk("error: kmem_cache_create(%s) object too large\n", name);
+		return 0;
+	}
+
+	flags = irq_save();
+	spin_lock(&kmem_caches_lock);
+	cache->next = kmem_caches;
+	kmem_caches = cache;
+	spin_unlock(&kmem_caches_lock);
+	irq_restore(flags);
+
+	return 1;
+}
+
+/**
+ * @name name of the cache for reporting
+ * @size size of each object in bytes
+ * @align object alignment in bytes, 0 for pointer alignment
+ * @ctor called once for every object when its slab is created
+ * @return the new cache, or NULL on failure
+ */
+struct kmem_cache * kmem_cache_create(const char *name, size_t size,
+		size_t align, void (*ctor)(void *))
+{
+	struct kmem_cache *cache;
+
+	cache = kmem_cache_alloc(&kmem_cache_cache);
+	if (!cache) {
+		return NULL;
+	}
+
+	if (!kmem_cache_setup(cache, name, size, align, -1, ctor)) {
+		kmem_cache_free(&kmem_cache_cache, cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/**
+ * @cache cache to allocate from
+ * @return a constructed object, or NULL if no memory is available
+ */
+void * kmem_cache_alloc(struct kmem_cache *cache)
+{
+	struct kmem_cpu *cpu;
+	unsigned long flags;
+	void *obj = NULL;
+
+	flags = irq_save();
+	cpu = &cache->cpu[cpu_id()];
+	if (cpu->count) {
+		cpu->hits++;
+	} else {
+		cpu->misses++;
+		kmem_cpu_refill(cache, cpu);
+	}
+	if (cpu->count) {
+		obj = cpu->obj[--cpu->count];
+	}
+	irq_restore(flags);
+
+	return obj;
+}
+
+/**
+ * @cache cache the object was allocated from
+ * @obj object being returned, which must be in its constructed state
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	struct kmem_cpu *cpu;
+	unsigned long flags;
+
+	if (!obj) {
+		return;
+	}
+
+	flags = irq_save();
+	cpu = &cache->cpu[cpu_id()];
+	if (cpu->count == KMEM_CPU_SIZE) {
+		kmem_cpu_drain(cache, cpu);
+	}
+	cpu->obj[cpu->count++] = obj;
+	irq_restore(flags);
+}
+
+/**
+ * @cache cache to examine
+ * @stats filled in with the cache counters
+ *
+ * Utilization of the cache is inuse / objects.
+ */
+void kmem_cache_stats(struct kmem_cache *cache, struct kmem_cache_stats *stats)
+{
+	unsigned long flags;
+	int index;
+
+	memset(stats, 0, sizeof(struct kmem_cache_stats));
+
+	for (index = 0; index < NR_CPUS; index++) {
+		stats->cached += cache->cpu[index].count;
+		stats->hits += cache->cpu[index].hits;
+		stats->misses += cache->cpu[index].misses;
+	}
+
+	flags = irq_save();
+	spin_lock(&cache->lock);
+	stats->slabs = cache->slabs;
+	stats->objects = cache->slabs * cache->objects;
+	stats->inuse = cache->inuse - stats->cached;
+	spin_unlock(&cache->lock);
+	irq_restore(flags);
+}
+
+/* General purpose size classes.  Powers of two with a class half way between
+ * each pair keep the worst case internal waste around 25%. */
+static const unsigned short kmalloc_sizes[] = {
+	8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+};
+#define KMALLOC_CLASSES	(sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+#define KMALLOC_MAX	1024
+#define KMALLOC_ALIGN	8
+
+static struct kmem_cache kmalloc_caches[KMALLOC_CLASSES];
+static const char *kmalloc_names[KMALLOC_CLASSES] = {
+	"kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64",
+	"kmalloc-96", "kmalloc-128", "kmalloc-192", "kmalloc-256",
+	"kmalloc-384", "kmalloc-512", "kmalloc-768", "kmalloc-1024",
+};
+
+/* Size class for every multiple of KMALLOC_ALIGN up to KMALLOC_MAX */
+static uint8_t kmalloc_index[KMALLOC_MAX / KMALLOC_ALIGN + 1];
+
+/* Allocations beyond KMALLOC_MAX are recorded here so kfree() can find their
+ * length again */
+#define KMALLOC_LARGE_HASH	64
+
+struct kmalloc_large {
+	struct kmalloc_large	*next;
+	unsigned long		page;
+	unsigned long		count;
+	size_t			size;
+};
+
+static struct kmem_cache kmalloc_large_cache;
+static struct kmalloc_large *kmalloc_large_hash[KMALLOC_LARGE_HASH];
+static spinlock_t kmalloc_large_lock = SPINLOCK_INIT("kmalloc large");
+static unsigned long kmalloc_large_pages = 0;
+static unsigned long kmalloc_large_bytes = 0;
+
+static void * kmalloc_large(size_t size)
+{
+	struct kmalloc_large *large;
+	unsigned long count = PAGE_NUM(size + PAGE_SIZE - 1);
+	unsigned long page, flags;
+
+	large = kmem_cache_alloc(&kmalloc_large_cache);
+	if (!large) {
+		return NULL;
+	}
+
+	page = page_alloc(count);
+	if (!page) {
+		kmem_cache_free(&kmalloc_large_cache, large);
+		return NULL;
+	}
+
+	large->page = page;
+	large->count = count;
+	large->size = size;
+
+	flags = irq_save();
+	spin_lock(&kmalloc_large_lock);
+	large->next = kmalloc_large_hash[page % KMALLOC_LARGE_HASH];
+	kmalloc_large_hash[page % KMALLOC_LARGE_HASH] = large;
+	kmalloc_large_pages += count;
+	kmalloc_large_bytes += size;
+	spin_unlock(&kmalloc_large_lock);
+	irq_restore(flags);
+
+	return PAGE_ADDR(page);
+}
+
+static void kfree_large(void *ptr)
+{
+	struct kmalloc_large **prev, *large;
+	unsigned long page = PAGE_NUM(ptr);
+	unsigned long flags;
+
+	flags = irq_save();
+	spin_lock(&kmalloc_large_lock);
+	prev = &kmalloc_large_hash[page % KMALLOC_LARGE_HASH];
+	for (large = *prev; large; prev = &large->next, large = *prev) {
+		if (large->page == page) {
+			*prev = large->next;
+			kmalloc_large_pages -= large->count;
+			kmalloc_large_bytes -= large->size;
+			break;
+		}
+	}
+	spin_unlock(&kmalloc_large_lock);
+	irq_restore(flags);
+
+	if (!large) {
+		printk("error: kfree() of unknown pointer 0x%x\n", ptr);
+		return;
+	}
+
+	page_free(large->page, large->count);
+	kmem_cache_free(&kmalloc_large_cache, large);
+}
+
+/**
+ * @size number of bytes wanted
+ * @return memory aligned to at least KMALLOC_ALIGN, or NULL
+ *
+ * Requests up to KMALLOC_MAX come from the size class caches, anything larger
+ * is a page aligned run of whole pages.
+ */
+void * kmalloc(size_t size)
+{
+	if (!size) {
+		return NULL;
+	}
+
+	if (size > KMALLOC_MAX) {
+		return kmalloc_large(size);
+	}
+
+	return kmem_cache_alloc(&kmalloc_caches[kmalloc_index[
+			(size + KMALLOC_ALIGN - 1) / KMALLOC_ALIGN]]);
+}
+
+/**
+ * @ptr memory returned by kmalloc(), NULL is ignored
+ */
+void kfree(void *ptr)
+{
+	struct kmem_slab *slab;
+
+	if (!ptr) {
+		return;
+	}
+
+	if (!((unsigned long)ptr & (PAGE_SIZE - 1))) {
+		kfree_large(ptr);
+		return;
+	}
+
+	slab = (struct kmem_slab *)PAGE_OF(ptr);
+	kmem_cache_free(slab->cache, ptr);
+}
+
+/* Display the utilization of every cache */
+void kmem_report(void)
+{
+	struct kmem_cache_stats stats;
+	struct kmem_cache *cache;
+	unsigned long flags;
+
+	printk("Object caches:\n");
+
+	flags = irq_save();
+	spin_lock(&kmem_caches_lock);
+	for (cache = kmem_caches; cache; cache = cache->next) {
+		kmem_cache_stats(cache, &stats);
+		printk("  %s: size=%d, inuse=%d/%d, slabs=%d, hits=%d, misses=%d\n",
+				cache->name, cache->size, stats.inuse,
+				stats.objects, stats.slabs, stats.hits,
+				stats.misses);
+	}
+	spin_unlock(&kmem_caches_lock);
+	irq_restore(flags);
+
+	printk("  large allocations: bytes=%d, pages=%d\n",
+			kmalloc_large_bytes, kmalloc_large_pages);
+}
+
+void kmem_init(void)
+{
+	unsigned long index;
+	unsigned long class = 0;
+
+	kmem_cache_setup(&kmem_cache_cache, "kmem_cache",
+			sizeof(struct kmem_cache), 0, -1, NULL);
+	kmem_cache_setup(&kmalloc_large_cache, "kmalloc-large",
+			sizeof(struct kmalloc_large), 0, -1, NULL);
+
+	for (index = 0; index < KMALLOC_CLASSES; index++) {
+		kmem_cache_setup(&kmalloc_caches[index], kmalloc_names[index],
+				kmalloc_sizes[index], KMALLOC_ALIGN, 0, NULL);
+	}
+
+	for (index = 0; index <= KMALLOC_MAX / KMALLOC_ALIGN; index++) {
+		while (kmalloc_sizes[class] < index * KMALLOC_ALIGN) {
+			class++;
+		}
+		kmalloc_index[index] = class;
+	}
+}
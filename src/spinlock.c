@@ -0,0 +1,122 @@
+/* spinlock.c - Queued spinlocks and lock statistics */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+/**
+ * The contended halves of the locks in <fmios/spinlock.h>, kept out of line
+ * so that the uncontended paths stay a couple of instructions, along with
+ * the list of named locks behind lock_stat_report().
+ *
+ * The list is only ever pushed to, by whoever first takes a named lock, so a
+ * compare and swap on its head is all the locking it needs.
+ */
+#include <fmios/fmios.h>
+#include <fmios/atomic.h>
+#include <fmios/spinlock.h>
+#include <fmios/io.h>
+#include <asm/processor.h>
+
+/**
+ * @ticket our place in the queue
+ * @return the number of times round the wait loop, never 0
+ */
+unsigned long spin_lock_wait(spinlock_t *lock, uint16_t ticket)
+{
+	unsigned long spins = 0;
+
+	do {
+		cpu_relax();
+		spins++;
+	} while (atomic_load(&lock->head, ATOMIC_ACQUIRE) != ticket);
+
+	return spins;
+}
+
+/**
+ * @prev the node queued ahead of ours
+ * @return the number of times round the wait loop, never 0
+ *
+ * Link in behind prev and spin on our own node until prev's holder passes
+ * the lock on to us.
+ */
+unsigned long mcs_lock_wait(struct mcs_node *prev, struct mcs_node *node)
+{
+	unsigned long spins = 0;
+
+	atomic_store(&prev->next, node, ATOMIC_RELEASE);
+	do {
+		cpu_relax();
+		spins++;
+	} while (atomic_load(&node->waiting, ATOMIC_ACQUIRE));
+
+	return spins;
+}
+
+/**
+ * @return the node queued behind ours
+ *
+ * Somebody swapped themselves in as the tail but has not linked their node
+ * to ours yet, which they are just about to do.
+ */
+struct mcs_node * mcs_unlock_wait(struct mcs_node *node)
+{
+	struct mcs_node *next;
+
+	while (!(next = atomic_load(&node->next, ATOMIC_ACQUIRE))) {
+		cpu_relax();
+	}
+	return next;
+}
+
+#ifdef CONFIG_ENABLE_LOCKSTAT
+static struct lock_stat * volatile lock_stats = NULL;
+
+/* Called by the first holder of a named lock */
+void lock_stat_register(struct lock_stat *stat)
+{
+	struct lock_stat *head;
+
+	do {
+		head = atomic_load(&lock_stats, ATOMIC_ACQUIRE);
+		stat->next = head;
+	} while (atomic_cmpxchg(&lock_stats, head, stat, ATOMIC_RELEASE) !=
+			head);
+}
+
+/* Print the statistics of every named lock taken so far */
+void lock_stat_report(void)
+{
+	struct lock_stat *stat;
+
+	for (stat = atomic_load(&lock_stats, ATOMIC_ACQUIRE); stat;
+			stat = stat->next) {
+		printk("lock %s: %u acquired, %u contended, %u spins, "
+				"%u cycles max hold\n", stat->name,
+				stat->acquisitions, stat->contended,
+				stat->spins, stat->max_hold);
+	}
+}
+#else
+void lock_stat_report(void)
+{
+	printk("lock: statistics need --enable-lockstat\n");
+}
+#endif /* CONFIG_ENABLE_LOCKSTAT */
@@ -0,0 +1,82 @@
+/* syscall.c - Syscall dispatch */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Every way into the kernel from userland ends up in syscall_dispatch(),
+ * whichever instruction the architecture used to get there.  The entry stubs
+ * hand over the syscall number and up to four arguments exactly as they were
+ * found in registers, and the number indexes straight into syscall_table[],
+ * so no vector is needed per syscall.
+ */
+#include <fmios/fmios.h>
+#include <fmios/sched.h>
+#include <fmios/smp.h>
+#include <fmios/syscall.h>
+
+typedef long (*syscall_t)(unsigned long, unsigned long, unsigned long,
+		unsigned long);
+
+static long sys_null(unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3)
+{
+	return 0;
+}
+
+static long sys_yield(unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3)
+{
+	yield();
+	return 0;
+}
+
+static long sys_exit(unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3)
+{
+	task_exit();
+	return 0;
+}
+
+static long sys_cpu(unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3)
+{
+	return cpu_id();
+}
+
+static const syscall_t syscall_table[SYSCALL_MAX] = {
+	[SYS_NULL]	= sys_null,
+	[SYS_YIELD]	= sys_yield,
+	[SYS_EXIT]	= sys_exit,
+	[SYS_CPU]	= sys_cpu,
+};
+
+/**
+ * @nr syscall number
+ * @arg0 first argument, and so on
+ * @return whatever the syscall returns, SYSCALL_INVALID for a bad number
+ */
+long syscall_dispatch(unsigned long nr, unsigned long arg0, unsigned long arg1,
+		unsigned long arg2, unsigned long arg3)
+{
+	if (nr >= SYSCALL_MAX || !syscall_table[nr]) {
+		return SYSCALL_INVALID;
+	}
+	return syscall_table[nr](arg0, arg1, arg2, arg3);
+}
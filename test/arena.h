@@ -0,0 +1,61 @@
+#ifndef _TEST_ARENA_H
+#define _TEST_ARENA_H
+
+/*
+ * The page allocator running over memory mapped into the harness.  The tree
+ * keeps its nodes in the pages it manages, and the slabs their headers, so
+ * page numbers have to be the real addresses of the arena.  Include this
+ * once, in place of src/malloc.c.
+ */
+
+#include <fmios/fmios.h>
+#include <fmios/malloc.h>
+#include <multiboot.h>
+#include "rt.h"
+
+#include "../src/spinlock.c"
+#include "../src/malloc.c"
+
+/* Only init_malloc() wants these, and it is never called */
+unsigned long kernel_start, kernel_end;
+int mb_mmap_count(void) { return 0; }
+unsigned long mb_mmap_start(int mmap) { return 0; }
+unsigned long mb_mmap_end(int mmap) { return 0; }
+uint32_t mb_mmap_type(int mmap) { return 0; }
+unsigned long mb_mbi_start(void) { return 0; }
+unsigned long mb_mbi_end(void) { return 0; }
+int mb_mod_count(void) { return 0; }
+unsigned long mb_mod_start(int module) { return 0; }
+unsigned long mb_mod_end(int module) { return 0; }
+int bootmem_used_ranges(const struct bootmem_range **ranges) { return 0; }
+unsigned long bootmem_alloc(size_t count, unsigned long align) { return 0; }
+void bootmem_retire(void) { }
+
+/* @return the first page of count pages of fresh memory */
+static unsigned long arena_map(unsigned long count)
+{
+	unsigned long arena = (unsigned long)rt_map((count + 1) * PAGE_SIZE);
+
+	return PAGE_NUM(arena + PAGE_SIZE - 1);
+}
+
+/* Seed the page allocator with count pages from first, as init_malloc()
+ * would from the pmap */
+static void arena_init(unsigned long first, unsigned long count)
+{
+	static struct {
+		struct pmap_table	table;
+		struct pmap_entry	entry[2];
+	} pmap;
+
+	pmap.table.count = 1;
+	pmap.entry[0].start = first;
+	pmap.entry[0].end = first + count - 1;
+	pmap.entry[0].type = MULTIBOOT_MEMORY_AVAILABLE;
+	pmap.entry[0].flags = MEMORY_PMAP_UNUSED;
+	pmap.entry[1].flags = MEMORY_PMAP_END;
+
+	page_init(&pmap.table);
+}
+
+#endif /* _TEST_ARENA_H */
@@ -0,0 +1,227 @@
+/* atomic.c - Host side checks and contention test for <fmios/atomic.h> */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Every operation is checked once at each width, with values chosen so that
+ * anything done at the wrong width shows up in the upper bits, and then a
+ * few processes hammer on shared counters to make sure nothing is lost when
+ * they do it at the same time.
+ */
+#include <fmios/atomic.h>
+#include "rt.h"
+
+#define ATOMIC_WORKERS		4
+#define ATOMIC_ITERATIONS	200000
+
+#define ATOMIC_CHECK_WIDTH(bits)					\
+static void atomic_check##bits(void)					\
+{									\
+	volatile uint##bits##_t v = 100;				\
+	const uint##bits##_t top = (uint##bits##_t)1 << ((bits) - 1);	\
+									\
+	CHECK(atomic_load(&v, ATOMIC_ACQUIRE) == 100);			\
+	atomic_store(&v, 7, ATOMIC_RELEASE);				\
+	CHECK(v == 7);							\
+	atomic_store(&v, 100, ATOMIC_SEQ_CST);				\
+	CHECK(v == 100);						\
+									\
+	CHECK(atomic_fetch_add(&v, 1ul, ATOMIC_SEQ_CST) == 100);	\
+	CHECK(atomic_add_fetch(&v, 1ul, ATOMIC_SEQ_CST) == 102);	\
+	CHECK(atomic_fetch_sub(&v, 1ul, ATOMIC_SEQ_CST) == 102);	\
+	CHECK(v == 101);						\
+	CHECK(atomic_sub_fetch(&v, 1ul, ATOMIC_SEQ_CST) == 100);	\
+	atomic_sub(&v, 1ul);						\
+	CHECK(v == 99);							\
+	atomic_sub(&v, (uint8_t)1);					\
+	CHECK(v == 98);							\
+	atomic_add(&v, 2);						\
+	CHECK(v == 100);						\
+	atomic_inc(&v);							\
+	atomic_dec(&v);							\
+	atomic_dec(&v);							\
+	CHECK(v == 99);							\
+									\
+	/* Borrowing across the top bit */				\
+	v = top;							\
+	atomic_sub(&v, 1u);						\
+	CHECK(v == top - 1);						\
+	CHECK(atomic_fetch_sub(&v, 1u, ATOMIC_RELAXED) == top - 1);	\
+	CHECK(v == top - 2);						\
+	v = 0;								\
+	atomic_dec(&v);							\
+	CHECK(v == (uint##bits##_t)~0);					\
+	atomic_inc(&v);							\
+	CHECK(v == 0);							\
+									\
+	v = 5;								\
+	CHECK(atomic_xchg(&v, top, ATOMIC_SEQ_CST) == 5);		\
+	CHECK(v == top);						\
+	CHECK(atomic_cmpxchg(&v, 5, 6, ATOMIC_SEQ_CST) == top);	\
+	CHECK(v == top);						\
+	CHECK(atomic_cmpxchg(&v, top, 6, ATOMIC_SEQ_CST) == top);	\
+	CHECK(v == 6);							\
+									\
+	atomic_or(&v, top | 1);						\
+	CHECK(v == (top | 7));						\
+	atomic_and(&v, top | 2);					\
+	CHECK(v == (top | 2));						\
+									\
+	v = 3;								\
+	CHECK(!atomic_sub_and_test(&v, 2));				\
+	CHECK(atomic_dec_and_test(&v));					\
+	CHECK(v == 0);							\
+}
+
+ATOMIC_CHECK_WIDTH(8)
+ATOMIC_CHECK_WIDTH(16)
+ATOMIC_CHECK_WIDTH(32)
+ATOMIC_CHECK_WIDTH(64)
+
+/* Widths wider than the value being added or taken away */
+static void atomic_check_widening(void)
+{
+	volatile uint64_t v64 = 100;
+	volatile uint32_t v32 = 100;
+	uint32_t one = 1;
+
+	CHECK(atomic_fetch_sub(&v64, 1ul, ATOMIC_SEQ_CST) == 100);
+	CHECK(v64 == 99);
+	atomic_sub(&v64, 1ul);
+	CHECK(v64 == 98);
+	atomic_sub(&v64, one);
+	CHECK(v64 == 97);
+	CHECK(atomic_sub_fetch(&v64, one, ATOMIC_SEQ_CST) == 96);
+	CHECK(atomic_fetch_sub(&v64, (uint16_t)1, ATOMIC_SEQ_CST) == 96);
+	CHECK(v64 == 95);
+
+	v64 = 0x100000000ULL;
+	atomic_sub(&v64, one);
+	CHECK(v64 == 0xffffffffULL);
+	CHECK(atomic_fetch_sub(&v64, one, ATOMIC_SEQ_CST) == 0xffffffffULL);
+	CHECK(v64 == 0xfffffffeULL);
+
+	CHECK(atomic_fetch_sub(&v32, (uint8_t)1, ATOMIC_SEQ_CST) == 100);
+	atomic_sub(&v32, (uint16_t)1);
+	CHECK(v32 == 98);
+}
+
+struct atomic_shared {
+	volatile uint32_t	count32;
+	volatile uint64_t	count64;
+	volatile uint64_t	balance;
+	volatile uint64_t	cmpxchg;
+	volatile uint32_t	started;
+	uint64_t		cycles[ATOMIC_WORKERS];
+};
+
+/**
+ * One contending process.  balance starts well above anything the workers
+ * can take from it, every worker both adds and takes away the same amount,
+ * and the fetch_sub it sees must never have dropped below the start.
+ * @param shared the counters every worker hits
+ * @param id which worker this is
+ */
+static void atomic_worker(struct atomic_shared *shared, int id)
+{
+	uint64_t start;
+	int i;
+
+	atomic_inc(&shared->started);
+	while (atomic_load(&shared->started, ATOMIC_ACQUIRE) < ATOMIC_WORKERS) {
+		rt_yield();
+	}
+
+	start = rdtsc();
+	for (i = 0; i < ATOMIC_ITERATIONS; i++) {
+		uint64_t old;
+
+		atomic_inc(&shared->count32);
+		atomic_add(&shared->count64, 1u);
+
+		atomic_add(&shared->balance, 0x100000001ULL);
+		if (atomic_fetch_sub(&shared->balance, 0x100000001ULL,
+				ATOMIC_SEQ_CST) < 0x100000001ULL) {
+			rt_fail("balance underflow", __FILE__, __LINE__);
+			rt_exit(1);
+		}
+		atomic_sub(&shared->count64, 1ul);
+		atomic_add(&shared->count64, 2u);
+
+		do {
+			old = atomic_load(&shared->cmpxchg, ATOMIC_RELAXED);
+		} while (atomic_cmpxchg(&shared->cmpxchg, old, old + 0x100000000ULL,
+				ATOMIC_SEQ_CST) != old);
+	}
+	shared->cycles[id] = rdtsc() - start;
+}
+
+static void atomic_contention(void)
+{
+	struct atomic_shared *shared = rt_map(sizeof(*shared));
+	const uint64_t ops = (uint64_t)ATOMIC_WORKERS * ATOMIC_ITERATIONS;
+	uint64_t cycles = 0;
+	int i;
+
+	shared->balance = 0x100000001ULL;
+	for (i = 0; i < ATOMIC_WORKERS; i++) {
+		int pid = rt_fork();
+
+		if (pid < 0) {
+			printk("error: unable to fork worker %d\n", i);
+			rt_exit(1);
+		}
+		if (!pid) {
+			atomic_worker(shared, i);
+			rt_exit(rt_failures);
+		}
+	}
+
+	for (i = 0; i < ATOMIC_WORKERS; i++) {
+		CHECK(rt_wait() == 0);
+	}
+	for (i = 0; i < ATOMIC_WORKERS; i++) {
+		if (shared->cycles[i] > cycles) {
+			cycles = shared->cycles[i];
+		}
+	}
+
+	CHECK(shared->count32 == ops);
+	CHECK(shared->count64 == 2 * ops);
+	CHECK(shared->balance == 0x100000001ULL);
+	CHECK(shared->cmpxchg == ops << 32);
+
+	/* Seven locked operations per iteration, the cmpxchg loop as one */
+	printk("atomic: %d workers, %u operations per million cycles\n",
+		ATOMIC_WORKERS, rt_rate(7 * ops, cycles));
+}
+
+int main(void)
+{
+	atomic_check8();
+	atomic_check16();
+	atomic_check32();
+	atomic_check64();
+	atomic_check_widening();
+	atomic_contention();
+
+	printk("atomic: %s\n", rt_failures ? "FAILED" : "ok");
+	return rt_failures;
+}
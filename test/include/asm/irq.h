@@ -0,0 +1,27 @@
+#ifndef _ASM_IRQ_H
+#define _ASM_IRQ_H
+
+/*
+ * Host stand-ins for <asm/irq.h>.  User space may not touch the interrupt
+ * flag, and a harness process is never interrupted by anything the code
+ * under test needs keeping out.
+ */
+
+#ifndef __ASSEMBLY__
+
+static inline unsigned long irq_save(void)
+{
+	return 0;
+}
+
+static inline void irq_restore(unsigned long flags)
+{
+}
+
+static inline void irq_window(void)
+{
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_IRQ_H */
@@ -0,0 +1,23 @@
+#ifndef _ASM_SMP_H
+#define _ASM_SMP_H
+
+/*
+ * Host stand-in for <asm/smp.h>.  There is no %gs based per-CPU data in
+ * user space, a harness picks which CPU the code under test thinks it is
+ * running on through rt_cpu instead.
+ */
+
+#include <asm/config.h>
+
+#ifndef __ASSEMBLY__
+
+extern int rt_cpu;
+
+static inline int cpu_id(void)
+{
+	return rt_cpu;
+}
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_SMP_H */
@@ -0,0 +1,11 @@
+#ifndef _TEST_STDLIB_H
+#define _TEST_STDLIB_H
+
+/* The parts of <stdlib.h> the kernel uses, provided by test/rt.c */
+
+#include <stddef.h>
+
+long strtol(const char *nptr, char **endptr, int base);
+unsigned long strtoul(const char *nptr, char **endptr, int base);
+
+#endif /* _TEST_STDLIB_H */
@@ -0,0 +1,17 @@
+#ifndef _TEST_STRING_H
+#define _TEST_STRING_H
+
+/* The parts of <string.h> the kernel uses, provided by test/rt.c */
+
+#include <stddef.h>
+
+void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
+void *memset(void *s, int c, size_t n);
+int memcmp(const void *s1, const void *s2, size_t n);
+size_t strlen(const char *s);
+int strcmp(const char *s1, const char *s2);
+int strncmp(const char *s1, const char *s2, size_t n);
+char *strchr(const char *s, int c);
+
+#endif /* _TEST_STRING_H */
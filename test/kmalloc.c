@@ -0,0 +1,208 @@
+/* kmalloc.c - Host side benchmark of kmalloc() and kfree() */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Puts kmalloc() through a seeded random workload for each of a few
+ * allocation size distributions, reporting operations per second and how
+ * much memory the heap took from the page allocator for what was asked of
+ * it.  Every allocation is tagged so any overlap shows up, and every cache
+ * has to be empty again at the end.
+ */
+#include <string.h>
+#include "arena.h"
+
+#include "../src/slab.c"
+
+#define KMALLOC_ARENA	32768	/* pages, 128MB */
+#define KMALLOC_SLOTS	8192	/* most allocations live at once */
+#define KMALLOC_STEPS	1048576
+#define KMALLOC_SAMPLE	4096	/* steps between overhead samples */
+
+struct kmalloc_dist {
+	const char	*name;
+	size_t		(*size)(uint32_t r);
+};
+
+static size_t kmalloc_tiny(uint32_t r)
+{
+	return 8 + r % 57;
+}
+
+static size_t kmalloc_pow2(uint32_t r)
+{
+	return 16 << r % 7;
+}
+
+static size_t kmalloc_uniform(uint32_t r)
+{
+	return 1 + r % KMALLOC_MAX;
+}
+
+/* Mostly small headers with the odd buffer, some beyond KMALLOC_MAX */
+static size_t kmalloc_mixed(uint32_t r)
+{
+	if (r % 10) {
+		return 16 + (r >> 4) % 49;
+	}
+	return 256 + (r >> 4) % 3841;
+}
+
+static size_t kmalloc_large_only(uint32_t r)
+{
+	return KMALLOC_MAX + 1 + r % (4 * PAGE_SIZE);
+}
+
+static const struct kmalloc_dist kmalloc_dists[] = {
+	{ "8-64", kmalloc_tiny },
+	{ "powers of 2 16-1024", kmalloc_pow2 },
+	{ "1-1024", kmalloc_uniform },
+	{ "90% 16-64, 10% 256-4096", kmalloc_mixed },
+	{ "1025-17408", kmalloc_large_only },
+};
+
+struct kmalloc_slot {
+	uint32_t	*ptr;
+	size_t		size;
+};
+
+static struct kmalloc_slot kmalloc_slot[KMALLOC_SLOTS];
+
+/* @return bytes currently taken from the page allocator */
+static unsigned long kmalloc_pages_used(unsigned long free_at_start)
+{
+	struct page_stats stats;
+	struct page_cache_stats cache;
+
+	page_stats(&stats);
+	page_cache_stats(0, &cache);
+
+	return (free_at_start - stats.free_pages - cache.cached) * PAGE_SIZE;
+}
+
+/* @return how much more than live bytes the heap is holding, in percent */
+static uint32_t kmalloc_overhead(unsigned long free_at_start,
+		unsigned long live, unsigned long *used)
+{
+	*used = kmalloc_pages_used(free_at_start);
+
+	return live ? (*used - live) * 100ULL / live : 0;
+}
+
+/**
+ * @dist the size distribution to draw from
+ *
+ * Runs in a child of its own so every distribution starts from scratch.
+ * About half the slots are live at any time.  The overhead is sampled every
+ * KMALLOC_SAMPLE steps, outside of the timing, and reported at the end of
+ * the run along with the worst seen.
+ */
+static void kmalloc_workload(const struct kmalloc_dist *dist)
+{
+	struct page_stats stats;
+	unsigned long free_at_start, live = 0, used;
+	uint32_t seed = 1, ops = 0, overhead, worst = 0;
+	uint64_t cycles = 0, usec = 0;
+	int step, index;
+
+	arena_init(arena_map(KMALLOC_ARENA), KMALLOC_ARENA);
+	kmem_init();
+	page_stats(&stats);
+	free_at_start = stats.free_pages;
+
+	for (step = 0; step < KMALLOC_STEPS; step += KMALLOC_SAMPLE) {
+		uint64_t start = rdtsc();
+		uint64_t start_usec = rt_usec();
+		int sample;
+
+		for (sample = 0; sample < KMALLOC_SAMPLE; sample++) {
+			struct kmalloc_slot *slot;
+
+			slot = &kmalloc_slot[rt_random(&seed) % KMALLOC_SLOTS];
+			if (slot->ptr) {
+				if (*slot->ptr != slot - kmalloc_slot) {
+					rt_fail("allocation overwritten",
+							__FILE__, __LINE__);
+				}
+				kfree(slot->ptr);
+				live -= slot->size;
+				slot->ptr = NULL;
+				ops++;
+				continue;
+			}
+
+			slot->size = dist->size(rt_random(&seed));
+			slot->ptr = kmalloc(slot->size);
+			if (!slot->ptr) {
+				rt_fail("kmalloc() failed", __FILE__, __LINE__);
+				rt_exit(1);
+			}
+			*slot->ptr = slot - kmalloc_slot;
+			live += slot->size;
+			ops++;
+		}
+		cycles += rdtsc() - start;
+		usec += rt_usec() - start_usec;
+
+		overhead = kmalloc_overhead(free_at_start, live, &used);
+		if (overhead > worst) {
+			worst = overhead;
+		}
+	}
+
+	printk("kmalloc %s: %u ops/sec, %u cycles/op, %u live bytes in %u, "
+		"%u%% overhead, worst %u%%\n", dist->name,
+		rt_rate(ops, usec), (uint32_t)(cycles / ops), live, used,
+		overhead, worst);
+
+	for (index = 0; index < KMALLOC_SLOTS; index++) {
+		if (kmalloc_slot[index].ptr) {
+			CHECK(*kmalloc_slot[index].ptr == index);
+			kfree(kmalloc_slot[index].ptr);
+		}
+	}
+
+	for (index = 0; index < KMALLOC_CLASSES; index++) {
+		struct kmem_cache_stats cache;
+
+		kmem_cache_stats(&kmalloc_caches[index], &cache);
+		CHECK(cache.inuse == 0);
+	}
+	CHECK(kmalloc_large_pages == 0 && kmalloc_large_bytes == 0);
+}
+
+int main(void)
+{
+	unsigned index;
+
+	for (index = 0; index < sizeof(kmalloc_dists) /
+			sizeof(kmalloc_dists[0]); index++) {
+		int pid = rt_fork();
+
+		if (!pid) {
+			kmalloc_workload(&kmalloc_dists[index]);
+			rt_exit(rt_failures);
+		}
+		CHECK(pid > 0 && rt_wait() == 0);
+	}
+
+	printk("kmalloc: %s\n", rt_failures ? "FAILED" : "ok");
+	return rt_failures;
+}
@@ -0,0 +1,399 @@
+/* page.c - Host side benchmark of the page allocator */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Runs one seeded random workload of allocations and frees against the
+ * B+tree page allocator and, for comparison, against a sorted first-fit list
+ * of free runs, which is the obvious thing to have written instead.  Each
+ * allocator reports allocations per second and how fragmented the free
+ * memory it is left with is, then has to take every page back.
+ */
+#include <string.h>
+#include "arena.h"
+
+#define PAGE_ARENA	131072	/* pages, 512MB */
+#define PAGE_SLOTS	12288	/* most allocations live at once */
+#define PAGE_STEPS	400000
+#define PAGE_RUN_MAX	128	/* longest run page_order_bench() frees */
+#define PAGE_ORDER_TOP	10	/* largest order page_order_bench() tries */
+
+struct page_allocator {
+	const char	*name;
+	void		(*init)(unsigned long first, unsigned long count);
+	unsigned long	(*alloc)(size_t count);
+	void		(*free)(unsigned long page, size_t count);
+	void		(*stats)(struct page_stats *stats);
+};
+
+/* The bare tree, without the per-CPU caches in front */
+static unsigned long tree_alloc(size_t count)
+{
+	unsigned long page;
+	struct mcs_node node;
+
+	mcs_lock(&page_lock, &node);
+	page = page_tree_alloc(count);
+	mcs_unlock(&page_lock, &node);
+
+	return page;
+}
+
+static void tree_free(unsigned long page, size_t count)
+{
+	struct mcs_node node;
+
+	mcs_lock(&page_lock, &node);
+	page_tree_free(page, count);
+	mcs_unlock(&page_lock, &node);
+}
+
+/* The cached pages are free as far as this harness is concerned */
+static void tree_stats(struct page_stats *stats)
+{
+	struct page_cache_stats cache;
+
+	page_stats(stats);
+	page_cache_stats(0, &cache);
+	stats->free_pages += cache.cached;
+}
+
+/* The baseline, a list of free runs sorted by address */
+struct list_run {
+	uint32_t	start;
+	uint32_t	end;
+	struct list_run	*next;
+};
+
+static struct list_run list_runs[PAGE_SLOTS + 2];
+static struct list_run *list_head;
+static struct list_run *list_spare;
+
+static void list_init(unsigned long first, unsigned long count)
+{
+	int index;
+
+	for (index = 1; index < PAGE_SLOTS + 2; index++) {
+		list_runs[index].next = list_spare;
+		list_spare = &list_runs[index];
+	}
+
+	list_head = &list_runs[0];
+	list_head->start = first;
+	list_head->end = first + count - 1;
+	list_head->next = NULL;
+}
+
+static unsigned long list_alloc(size_t count)
+{
+	struct list_run **link, *run;
+
+	for (link = &list_head; (run = *link); link = &run->next) {
+		uint32_t start = run->start;
+
+		if (run->end - start + 1 < count) {
+			continue;
+		}
+
+		if (run->end - start + 1 == count) {
+			*link = run->next;
+			run->next = list_spare;
+			list_spare = run;
+		} else {
+			run->start += count;
+		}
+		return start;
+	}
+
+	return 0;
+}
+
+static void list_free(unsigned long page, size_t count)
+{
+	struct list_run **link, *run, *prev = NULL;
+	uint32_t end = page + count - 1;
+
+	for (link = &list_head; (run = *link); link = &run->next) {
+		if (run->start > page) {
+			break;
+		}
+		prev = run;
+	}
+
+	if (prev && prev->end + 1 == page) {
+		prev->end = end;
+		if (run && run->start == end + 1) {
+			prev->end = run->end;
+			prev->next = run->next;
+			run->next = list_spare;
+			list_spare = run;
+		}
+		return;
+	}
+
+	if (run && run->start == end + 1) {
+		run->start = page;
+		return;
+	}
+
+	run = list_spare;
+	list_spare = run->next;
+	run->start = page;
+	run->end = end;
+	run->next = *link;
+	*link = run;
+}
+
+static void list_stats(struct page_stats *stats)
+{
+	struct list_run *run;
+
+	memset(stats, 0, sizeof(*stats));
+	for (run = list_head; run; run = run->next) {
+		unsigned long len = run->end - run->start + 1;
+
+		stats->free_pages += len;
+		stats->free_ranges++;
+		if (len > stats->largest_range) {
+			stats->largest_range = len;
+		}
+	}
+}
+
+static const struct page_allocator page_allocators[] = {
+	{ "first-fit list", list_init, list_alloc, list_free, list_stats },
+	{ "B+tree", arena_init, tree_alloc, tree_free, tree_stats },
+	{ "B+tree + cache", arena_init, page_alloc, page_free, tree_stats },
+};
+
+struct page_slot {
+	uint32_t	page;
+	uint32_t	count;
+};
+
+static struct page_slot page_slot[PAGE_SLOTS];
+static uint32_t page_block[PAGE_ARENA / 2];
+
+/* Half single pages, a quarter 2-8 and a quarter 9-64 */
+static size_t page_size(uint32_t *seed)
+{
+	uint32_t r = rt_random(seed);
+
+	switch (r & 3) {
+	case 0:
+		return 2 + (r >> 2) % 7;
+	case 1:
+		return 9 + (r >> 2) % 56;
+	default:
+		return 1;
+	}
+}
+
+/**
+ * @allocator the allocator to put through the workload
+ * @first the first page of the arena it manages
+ * @pages size of the arena, at most PAGE_ARENA
+ * @slots allocations to spread the workload over, at most PAGE_SLOTS
+ *
+ * Runs in a child of its own so every allocator starts from scratch.  About
+ * half the slots are live at any time, holding around half of the arena
+ * at an average of 11 pages each.
+ */
+static void page_workload(const struct page_allocator *allocator,
+		unsigned long first, unsigned long pages, int slots)
+{
+	struct page_stats stats;
+	uint32_t seed = 1;
+	uint32_t allocs = 0, failed = 0;
+	uint64_t start, usec;
+	int step, index;
+
+	allocator->init(first, pages);
+
+	start = rt_usec();
+	for (step = 0; step < PAGE_STEPS; step++) {
+		struct page_slot *slot;
+
+		slot = &page_slot[rt_random(&seed) % slots];
+		if (slot->count) {
+			allocator->free(slot->page, slot->count);
+			slot->count = 0;
+			continue;
+		}
+
+		slot->count = page_size(&seed);
+		slot->page = allocator->alloc(slot->count);
+		if (slot->page) {
+			allocs++;
+		} else {
+			slot->count = 0;
+			failed++;
+		}
+	}
+	usec = rt_usec() - start;
+
+	allocator->stats(&stats);
+	printk("%s, %u pages: %u allocs/sec, %u failed, %u free pages in %u runs, "
+		"largest %u, %u%% fragmented\n", allocator->name,
+		pages, rt_rate(allocs, usec), failed, stats.free_pages,
+		stats.free_ranges, stats.largest_range,
+		100 - (uint32_t)((uint64_t)stats.largest_range * 100 /
+			stats.free_pages));
+
+	for (index = 0; index < slots; index++) {
+		if (page_slot[index].count) {
+			allocator->free(page_slot[index].page,
+					page_slot[index].count);
+		}
+	}
+
+	/* Every page is free again, bar those holding the tree's nodes */
+	allocator->stats(&stats);
+	CHECK(stats.free_pages + stats.nodes_pages == pages);
+	CHECK(failed < PAGE_STEPS / 100);
+}
+
+/* @return aligned blocks of 1 << order pages the free runs could supply */
+static unsigned long page_order_blocks(int order)
+{
+	const uint32_t size = 1UL << order;
+	struct page_node *leaf;
+	unsigned long blocks = 0;
+	int index;
+
+	for (leaf = page_head; leaf; leaf = leaf->next) {
+		for (index = 0; index < leaf->count; index++) {
+			uint32_t page = (leaf->key[index] + size - 1) & ~(size - 1);
+
+			if (page >= leaf->key[index] &&
+			    page + size - 1 <= leaf->end[index]) {
+				blocks += (leaf->end[index] - page + 1) >> order;
+			}
+		}
+	}
+
+	return blocks;
+}
+
+/**
+ * @first the first page of the arena
+ * @pages size of the arena, at most PAGE_ARENA
+ *
+ * Fragments the tree by taking every page and giving back random runs of
+ * up to PAGE_RUN_MAX pages, about half of the arena in all.  Then, for each
+ * order, takes naturally aligned blocks with page_alloc_order() until it
+ * fails and frees them all again, reporting what each allocation and the
+ * failing one cost.  Every block the free runs could supply must be found.
+ */
+static void page_order_bench(unsigned long first, unsigned long pages)
+{
+	struct page_stats before, after;
+	uint32_t seed = 1;
+	unsigned long page;
+	int order;
+
+	arena_init(first, pages);
+	while (tree_alloc(1)) {
+	}
+
+	for (page = first + 1; page < first + pages; ) {
+		uint32_t r = rt_random(&seed);
+		unsigned long len = 1 + (r >> 1) % PAGE_RUN_MAX;
+
+		if (len > first + pages - page) {
+			len = first + pages - page;
+		}
+		if (r & 1) {
+			tree_free(page, len);
+		}
+		page += len;
+	}
+
+	page_stats(&before);
+	printk("page_alloc_order: %u free pages in %u runs, largest %u\n",
+		before.free_pages, before.free_ranges, before.largest_range);
+
+	for (order = 1; order <= PAGE_ORDER_TOP; order++) {
+		unsigned long blocks = page_order_blocks(order);
+		unsigned long count = 0, index;
+		uint64_t start, cycles, failed;
+
+		start = rdtsc();
+		while ((page = page_alloc_order(order, 0))) {
+			page_block[count++] = page;
+		}
+		failed = rdtsc();
+		cycles = failed - start;
+
+		/* The failing call walked every run, time it on its own */
+		start = rdtsc();
+		CHECK(!page_alloc_order(order, 0));
+		failed = rdtsc() - start;
+
+		for (index = 0; index < count; index++) {
+			CHECK(!(page_block[index] & ((1UL << order) - 1)));
+			page_free_order(page_block[index], order);
+		}
+
+		printk("page_alloc_order(%d): %u of %u blocks, %u cycles each, "
+			"%u cycles to fail\n", order, count, blocks,
+			(uint32_t)(count ? cycles / count : 0), (uint32_t)failed);
+
+		/* Carving may need a fresh node page, which costs one block */
+		CHECK(count + 1 >= blocks && count <= blocks);
+	}
+
+	page_stats(&after);
+	CHECK(after.free_pages + after.nodes_pages ==
+			before.free_pages + before.nodes_pages);
+}
+
+int main(void)
+{
+	unsigned long arena;
+	unsigned index;
+	int scale;
+
+	arena = arena_map(PAGE_ARENA);
+
+	/* A quarter of the arena and slots first, then all of them */
+	for (scale = 4; scale >= 1; scale -= 3) {
+		for (index = 0; index < sizeof(page_allocators) /
+				sizeof(page_allocators[0]); index++) {
+			int pid = rt_fork();
+
+			if (!pid) {
+				page_workload(&page_allocators[index], arena,
+					PAGE_ARENA / scale, PAGE_SLOTS / scale);
+				rt_exit(rt_failures);
+			}
+			CHECK(pid > 0 && rt_wait() == 0);
+		}
+	}
+
+	if (!rt_fork()) {
+		page_order_bench(arena, PAGE_ARENA);
+		rt_exit(rt_failures);
+	}
+	CHECK(rt_wait() == 0);
+
+	printk("page: %s\n", rt_failures ? "FAILED" : "ok");
+	return rt_failures;
+}
@@ -0,0 +1,370 @@
+/* pmap.c - Host side check and timing of the pmap build */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Hands mb_init() synthetic boot information with thousands of random,
+ * overlapping memory map entries, a couple of hundred modules and a few
+ * bootmem runs, times pmap_fill() turning them into the pmap and checks the
+ * result page by page against a model built the slow way.  Multiboot2
+ * always, with other tags between the modules, and Multiboot1 as well when
+ * it is configured in, with entries of varying size to walk.
+ *
+ * Everything lies in the bottom PMAP_PAGES pages of the address space, bar
+ * the boot information itself, which the harness can not place there.
+ */
+#include <fmios/fmios.h>
+#include <fmios/malloc.h>
+#include <multiboot.h>
+#include <string.h>
+#include "rt.h"
+
+#include "../src/spinlock.c"
+#include "../src/multiboot.c"
+#include "../src/malloc.c"
+
+#define PMAP_PAGES	65536	/* modelled address space, 256MB */
+#define PMAP_REGION_MAX	(256 * PAGE_SIZE)
+#define PMAP_MODULES	200
+#define PMAP_MOD_GAP	16	/* modules between unrelated tags */
+#define PMAP_USED	4
+#define PMAP_ENTRIES	16000	/* most mmap entries any run uses */
+
+struct pmap_region {
+	uint32_t	start;
+	uint32_t	end;	/* one past the last byte */
+	uint32_t	type;
+};
+
+static struct pmap_region pmap_mmap[PMAP_ENTRIES];
+static struct pmap_region pmap_module[PMAP_MODULES];
+static struct bootmem_range pmap_used[PMAP_USED];
+
+/* The answer, per page: the type, 0 for none, and who is using it */
+static uint8_t model_type[PMAP_PAGES];
+static uint8_t model_flags[PMAP_PAGES];
+
+unsigned long kernel_start, kernel_end;
+
+int bootmem_used_ranges(const struct bootmem_range **ranges)
+{
+	*ranges = pmap_used;
+	return PMAP_USED;
+}
+
+/* Only init_malloc() wants these, and it is never called */
+unsigned long bootmem_alloc(size_t count, unsigned long align) { return 0; }
+void bootmem_retire(void) { }
+
+/* Byte granular so that partial pages get exercised */
+static void pmap_random_region(struct pmap_region *region, uint32_t *seed,
+		uint32_t max)
+{
+	region->start = rt_random(seed) % (PMAP_PAGES * PAGE_SIZE - 1);
+	region->end = region->start + 1 + rt_random(seed) % max;
+	if (region->end > PMAP_PAGES * PAGE_SIZE) {
+		region->end = PMAP_PAGES * PAGE_SIZE;
+	}
+}
+
+static void pmap_generate(int count, uint32_t seed)
+{
+	int index;
+
+	for (index = 0; index < count; index++) {
+		uint32_t r = rt_random(&seed);
+
+		pmap_random_region(&pmap_mmap[index], &seed, PMAP_REGION_MAX);
+		if (r % 50 == 0) {
+			pmap_mmap[index].type = 7;	/* unknown */
+		} else if (r % 5 < 3) {
+			pmap_mmap[index].type = MULTIBOOT_MEMORY_AVAILABLE;
+		} else {
+			pmap_mmap[index].type = 2 + (r >> 8) % 4;
+		}
+	}
+
+	for (index = 0; index < PMAP_MODULES; index++) {
+		pmap_random_region(&pmap_module[index], &seed, 64 * 1024);
+	}
+
+	for (index = 0; index < PMAP_USED; index++) {
+		pmap_used[index].start = rt_random(&seed) % (PMAP_PAGES - 64);
+		pmap_used[index].end = pmap_used[index].start +
+			rt_random(&seed) % 64;
+	}
+
+	kernel_start = 0x100000;
+	kernel_end = 0x100000 + 3 * 1024 * 1024 + 123;
+}
+
+static void model_mark(uint32_t first, uint32_t last, int flag)
+{
+	for (; first <= last && first < PMAP_PAGES; first++) {
+		model_flags[first] |= flag;
+	}
+}
+
+static void pmap_model(int count)
+{
+	int index;
+	uint32_t page;
+
+	memset(model_type, 0, sizeof(model_type));
+	memset(model_flags, 0, sizeof(model_flags));
+
+	for (index = 0; index < count; index++) {
+		struct pmap_region *region = &pmap_mmap[index];
+		uint32_t type = region->type > MULTIBOOT_MEMORY_BADRAM ?
+			MULTIBOOT_MEMORY_RESERVED : region->type;
+		uint32_t first = region->start / PAGE_SIZE;
+		uint32_t last = (region->end - 1) / PAGE_SIZE;
+
+		/* Available memory only counts in whole pages */
+		if (type == MULTIBOOT_MEMORY_AVAILABLE) {
+			first = (region->start + PAGE_SIZE - 1) / PAGE_SIZE;
+			last = region->end / PAGE_SIZE;
+			if (!last) {
+				continue;
+			}
+			last--;
+		}
+
+		for (page = first; page <= last; page++) {
+			if (type > model_type[page]) {
+				model_type[page] = type;
+			}
+		}
+	}
+
+	model_mark(kernel_start / PAGE_SIZE, (kernel_end - 1) / PAGE_SIZE,
+			MEMORY_PMAP_KERNEL);
+	for (index = 0; index < PMAP_USED; index++) {
+		model_mark(pmap_used[index].start, pmap_used[index].end,
+				MEMORY_PMAP_KERNEL);
+	}
+	for (index = 0; index < PMAP_MODULES; index++) {
+		model_mark(pmap_module[index].start / PAGE_SIZE,
+				(pmap_module[index].end - 1) / PAGE_SIZE,
+				MEMORY_PMAP_MODULE);
+	}
+
+	/* Only available memory is ever in use, the kernel taking precedence */
+	for (page = 0; page < PMAP_PAGES; page++) {
+		if (model_type[page] != MULTIBOOT_MEMORY_AVAILABLE) {
+			model_flags[page] = MEMORY_PMAP_UNUSED;
+		} else if (model_flags[page] & MEMORY_PMAP_KERNEL) {
+			model_flags[page] = MEMORY_PMAP_KERNEL;
+		}
+	}
+}
+
+static void pmap_check(struct pmap_table *pmap)
+{
+	unsigned long pages = 0, expect = 0;
+	uint32_t page;
+	int index;
+
+	for (index = 0; index < pmap->count; index++) {
+		struct pmap_entry *entry = &pmap->entry[index];
+
+		CHECK(entry->start <= entry->end && entry->end < PMAP_PAGES);
+		if (index) {
+			struct pmap_entry *prev = entry - 1;
+
+			CHECK(prev->end < entry->start);
+			CHECK(prev->end + 1 != entry->start ||
+				prev->type != entry->type ||
+				prev->flags != entry->flags);
+		}
+
+		for (page = entry->start; page <= entry->end &&
+				page < PMAP_PAGES; page++) {
+			if (model_type[page] != entry->type ||
+			    model_flags[page] != entry->flags) {
+				printk("FAIL: page 0x%x is %u/%u, pmap has %u/%u\n",
+					page, model_type[page],
+					model_flags[page], entry->type,
+					entry->flags);
+				rt_failures++;
+				return;
+			}
+			pages++;
+		}
+	}
+	CHECK(pmap->entry[pmap->count].flags == MEMORY_PMAP_END);
+
+	for (page = 0; page < PMAP_PAGES; page++) {
+		if (model_type[page]) {
+			expect++;
+		}
+	}
+	CHECK(pages == expect);
+}
+
+/* The accessors hand back what was put in, in any order */
+static void pmap_check_mmap(int count)
+{
+	int index;
+
+	CHECK(mb_mmap_count() == count);
+	for (index = count - 1; index >= 0; index -= 97) {
+		CHECK(mb_mmap_start(index) == pmap_mmap[index].start);
+		CHECK(mb_mmap_end(index) == pmap_mmap[index].end);
+		CHECK(mb_mmap_type(index) == pmap_mmap[index].type);
+	}
+}
+
+/**
+ * @magic which flavour of boot information the MBI is
+ * @mbi the boot information describing the generated regions
+ * @count number of mmap entries in it
+ *
+ * Sizes the pmap as init_malloc() does and times building it.
+ */
+static void pmap_build(const char *name, unsigned long magic, void *mbi,
+		int count)
+{
+	struct pmap_table *pmap;
+	const struct bootmem_range *used;
+	size_t max = 2, size;
+	uint64_t start, cycles;
+	int entries;
+
+	CHECK(mb_init((unsigned long)mbi, magic));
+	pmap_check_mmap(count);
+
+	max += mb_mmap_count() + mb_mod_count();
+	max += bootmem_used_ranges(&used) + 1;
+	max *= 2;
+	size = sizeof(struct pmap_table) +
+		(max + 1) * sizeof(struct pmap_entry) +
+		max * sizeof(struct pmap_event);
+	pmap = rt_map(size);
+
+	start = rdtsc();
+	entries = pmap_fill(pmap, (struct pmap_event *)&pmap->entry[max + 1],
+			max);
+	cycles = rdtsc() - start;
+
+	printk("pmap %s: %d mmap entries, %d modules: %d pmap entries in "
+		"%u cycles\n", name, count, mb_mod_count(), entries,
+		(uint32_t)cycles);
+
+	CHECK(entries > 0);
+	pmap_model(count);
+	pmap_check(pmap);
+}
+
+static void pmap_multiboot2(int count)
+{
+	size_t size = 8 + sizeof(struct multiboot_tag_mmap) +
+		count * sizeof(struct multiboot_mmap_entry) +
+		PMAP_MODULES * 24 + (PMAP_MODULES / PMAP_MOD_GAP) *
+		sizeof(struct multiboot_tag) + sizeof(struct multiboot_tag);
+	uint8_t *mbi = rt_map((size + 7) & ~7);
+	struct multiboot_tag_mmap *mmap = (void *)(mbi + 8);
+	struct multiboot_tag *tag;
+	int index;
+
+	mmap->type = MULTIBOOT_TAG_TYPE_MMAP;
+	mmap->size = sizeof(*mmap) + count * sizeof(struct multiboot_mmap_entry);
+	mmap->entry_size = sizeof(struct multiboot_mmap_entry);
+	for (index = 0; index < count; index++) {
+		mmap->entries[index].addr = pmap_mmap[index].start;
+		mmap->entries[index].len = pmap_mmap[index].end -
+			pmap_mmap[index].start;
+		mmap->entries[index].type = pmap_mmap[index].type;
+	}
+
+	tag = (void *)((uint8_t *)mmap + ((mmap->size + 7) & ~7));
+	for (index = 0; index < PMAP_MODULES; index++) {
+		struct multiboot_tag_module *module = (void *)tag;
+
+		module->type = MULTIBOOT_TAG_TYPE_MODULE;
+		module->size = sizeof(*module) + 1;
+		module->mod_start = pmap_module[index].start;
+		module->mod_end = pmap_module[index].end;
+		tag = (void *)((uint8_t *)tag + 24);
+
+		if (index % PMAP_MOD_GAP == PMAP_MOD_GAP - 1) {
+			tag->type = MULTIBOOT_TAG_TYPE_NETWORK;
+			tag->size = sizeof(*tag);
+			tag = (void *)((uint8_t *)tag + tag->size);
+		}
+	}
+	tag->type = MULTIBOOT_TAG_TYPE_END;
+	tag->size = sizeof(*tag);
+	*(uint32_t *)mbi = (uint8_t *)tag + tag->size - mbi;
+
+	pmap_build("multiboot2", MULTIBOOT2_BOOTLOADER_MAGIC, mbi, count);
+}
+
+#ifdef CONFIG_ENABLE_MULTIBOOT1
+static void pmap_multiboot1(int count)
+{
+	multiboot1_info_t *mbi = rt_map(sizeof(*mbi));
+	multiboot1_module_t *module;
+	uint8_t *entry;
+	int index;
+
+	/* Every other entry is padded, as the format allows */
+	entry = rt_map(count * (sizeof(multiboot1_memory_map_t) + 8));
+	mbi->flags = MULTIBOOT1_INFO_MEM_MAP | MULTIBOOT1_INFO_MODS;
+	mbi->mmap_addr = (uint32_t)entry;
+	for (index = 0; index < count; index++) {
+		multiboot1_memory_map_t *mmap = (void *)entry;
+
+		mmap->size = sizeof(*mmap) - sizeof(mmap->size) +
+			(index & 1 ? 8 : 0);
+		mmap->addr = pmap_mmap[index].start;
+		mmap->len = pmap_mmap[index].end - pmap_mmap[index].start;
+		mmap->type = pmap_mmap[index].type;
+		entry += mmap->size + sizeof(mmap->size);
+	}
+	mbi->mmap_length = (uint32_t)entry - mbi->mmap_addr;
+
+	module = rt_map(PMAP_MODULES * sizeof(*module));
+	mbi->mods_addr = (uint32_t)module;
+	mbi->mods_count = PMAP_MODULES;
+	for (index = 0; index < PMAP_MODULES; index++) {
+		module[index].mod_start = pmap_module[index].start;
+		module[index].mod_end = pmap_module[index].end;
+	}
+
+	pmap_build("multiboot1", MULTIBOOT1_BOOTLOADER_MAGIC, mbi, count);
+}
+#endif
+
+int main(void)
+{
+	int count;
+
+	for (count = 1000; count <= PMAP_ENTRIES; count *= 4) {
+		pmap_generate(count, count);
+		pmap_multiboot2(count);
+#ifdef CONFIG_ENABLE_MULTIBOOT1
+		pmap_multiboot1(count);
+#endif
+	}
+
+	printk("pmap: %s\n", rt_failures ? "FAILED" : "ok");
+	return rt_failures;
+}
@@ -0,0 +1,393 @@
+/* rt.c - Freestanding runtime for the host side test harnesses */
+/* Copyright (C) 2012 Mark Ferrell
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL ANY
+ * DEVELOPER OR DISTRIBUTOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Just enough of a C library for the kernel sources the harnesses include,
+ * plus the handful of Linux system calls the harnesses use themselves.
+ */
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include "rt.h"
+
+#define SYS_exit	1
+#define SYS_fork	2
+#define SYS_write	4
+#define SYS_waitpid	7
+#define SYS_sched_yield	158
+#define SYS_mmap2	192
+#define SYS_clock_gettime	265
+
+#define CLOCK_MONOTONIC	1
+
+#define PROT_READ	0x1
+#define PROT_WRITE	0x2
+#define MAP_SHARED	0x01
+#define MAP_ANONYMOUS	0x20
+
+int rt_failures;
+int rt_cpu;
+
+__asm__(".globl _start\n"
+	"_start:\n\t"
+	"xorl %ebp, %ebp\n\t"
+	"call rt_start\n\t"
+	"hlt");
+
+static long rt_syscall(long nr, long a, long b, long c)
+{
+	long ret;
+
+	__asm__ __volatile__("int $0x80"
+		: "=a" (ret)
+		: "0" (nr), "b" (a), "c" (b), "d" (c)
+		: "memory");
+
+	return ret;
+}
+
+void rt_start(void)
+{
+	int status = main();
+
+	rt_exit(status || rt_failures);
+}
+
+void rt_exit(int status)
+{
+	for (;;) {
+		rt_syscall(SYS_exit, status, 0, 0);
+	}
+}
+
+int rt_fork(void)
+{
+	return rt_syscall(SYS_fork, 0, 0, 0);
+}
+
+int rt_wait(void)
+{
+	int status;
+
+	if (rt_syscall(SYS_waitpid, -1, (long)&status, 0) < 0) {
+		return -1;
+	}
+
+	/* Anything killed by a signal counts as a failure */
+	return (status & 0x7f) ? 1 : (status >> 8) & 0xff;
+}
+
+void rt_yield(void)
+{
+	rt_syscall(SYS_sched_yield, 0, 0, 0);
+}
+
+void *rt_map(size_t size)
+{
+	long ret;
+
+	/* Six arguments, so the offset goes in %ebp */
+	__asm__ __volatile__(
+		"pushl %%ebp\n\t"
+		"xorl %%ebp, %%ebp\n\t"
+		"int $0x80\n\t"
+		"popl %%ebp"
+		: "=a" (ret)
+		: "0" (SYS_mmap2), "b" (0), "c" (size),
+		  "d" (PROT_READ | PROT_WRITE), "S" (MAP_SHARED | MAP_ANONYMOUS),
+		  "D" (-1)
+		: "memory");
+
+	if ((unsigned long)ret > -4096UL) {
+		printk("error: unable to map %u bytes\n", size);
+		rt_exit(1);
+	}
+
+	return (void *)ret;
+}
+
+uint64_t rt_usec(void)
+{
+	struct {
+		long	sec;
+		long	nsec;
+	} now;
+
+	rt_syscall(SYS_clock_gettime, CLOCK_MONOTONIC, (long)&now, 0);
+
+	return (uint64_t)now.sec * 1000000 + now.nsec / 1000;
+}
+
+uint32_t rt_random(uint32_t *seed)
+{
+	/* xorshift32, the seed must never be 0 */
+	uint32_t x = *seed ? *seed : 2463534242U;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *seed = x;
+}
+
+uint32_t rt_rate(uint64_t count, uint64_t time)
+{
+	return time ? count * 1000000 / time : 0;
+}
+
+void rt_fail(const char *expr, const char *file, int line)
+{
+	printk("FAIL: %s:%d: %s\n", file, line, expr);
+	rt_failures++;
+}
+
+static char *rt_number(char *p, unsigned long val, int base, int negative)
+{
+	char digits[12];
+	int len = 0;
+
+	do {
+		digits[len++] = "0123456789abcdef"[val % base];
+		val /= base;
+	} while (val);
+
+	if (negative) {
+		*p++ = '-';
+	}
+	while (len) {
+		*p++ = digits[--len];
+	}
+
+	return p;
+}
+
+/* The same conversions as the kernel's printk */
+void printk(const char *format, ...)
+{
+	char buf[256];
+	char *p = buf;
+	va_list args;
+
+	va_start(args, format);
+	for (; *format && p < buf + sizeof(buf) - 16; format++) {
+		const char *s;
+		int val;
+
+		if (*format != '%') {
+			*p++ = *format;
+			continue;
+		}
+
+		switch (*++format) {
+		case 'd':
+			val = va_arg(args, int);
+			p = rt_number(p, val < 0 ? -(unsigned long)val : val,
+				10, val < 0);
+			break;
+		case 'u':
+			p = rt_number(p, va_arg(args, unsigned int), 10, 0);
+			break;
+		case 'x':
+			p = rt_number(p, va_arg(args, unsigned int), 16, 0);
+			break;
+		case 'c':
+			*p++ = va_arg(args, int);
+			break;
+		case 's':
+			s = va_arg(args, const char *);
+			while (*s && p < buf + sizeof(buf) - 16) {
+				*p++ = *s++;
+			}
+			break;
+		case '\0':
+			format--;
+			break;
+		default:
+			*p++ = *format;
+			break;
+		}
+	}
+	va_end(args);
+
+	rt_syscall(SYS_write, 1, (long)buf, p - buf);
+}
+
+void *memcpy(void *dest, const void *src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+
+	while (n--) {
+		*d++ = *s++;
+	}
+
+	return dest;
+}
+
+void *memmove(void *dest, const void *src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+
+	if (d <= s) {
+		return memcpy(dest, src, n);
+	}
+	while (n--) {
+		d[n] = s[n];
+	}
+
+	return dest;
+}
+
+void *memset(void *s, int c, size_t n)
+{
+	char *p = s;
+
+	while (n--) {
+		*p++ = c;
+	}
+
+	return s;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+	const unsigned char *a = s1, *b = s2;
+
+	for (; n; n--, a++, b++) {
+		if (*a != *b) {
+			return *a - *b;
+		}
+	}
+
+	return 0;
+}
+
+size_t strlen(const char *s)
+{
+	size_t len = 0;
+
+	while (s[len]) {
+		len++;
+	}
+
+	return len;
+}
+
+int strncmp(const char *s1, const char *s2, size_t n)
+{
+	for (; n; n--, s1++, s2++) {
+		if (*s1 != *s2 || !*s1) {
+			return (unsigned char)*s1 - (unsigned char)*s2;
+		}
+	}
+
+	return 0;
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+	return strncmp(s1, s2, (size_t)-1);
+}
+
+char *strchr(const char *s, int c)
+{
+	for (; *s != (char)c; s++) {
+		if (!*s) {
+			return NULL;
+		}
+	}
+
+	return (char *)s;
+}
+
+/* 64-bit division, there need not be a 32-bit libgcc on the host */
+uint64_t __udivdi3(uint64_t n, uint64_t d)
+{
+	uint64_t q = 0;
+	int shift = 0;
+
+	if (!d) {
+		return 0;
+	}
+	while (!(d >> 63) && (d << 1) <= n) {
+		d <<= 1;
+		shift++;
+	}
+	for (; shift >= 0; shift--, d >>= 1) {
+		q <<= 1;
+		if (n >= d) {
+			n -= d;
+			q |= 1;
+		}
+	}
+
+	return q;
+}
+
+uint64_t __umoddi3(uint64_t n, uint64_t d)
+{
+	return n - __udivdi3(n, d) * d;
+}
+
+unsigned long strtoul(const char *nptr, char **endptr, int base)
+{
+	unsigned long val = 0;
+
+	if ((!base || base == 16) && nptr[0] == '0' &&
+	    (nptr[1] == 'x' || nptr[1] == 'X')) {
+		nptr += 2;
+		base = 16;
+	} else if (!base) {
+		base = nptr[0] == '0' ? 8 : 10;
+	}
+
+	for (;; nptr++) {
+		int digit;
+
+		if (*nptr >= '0' && *nptr <= '9') {
+			digit = *nptr - '0';
+		} else if ((*nptr | 0x20) >= 'a' && (*nptr | 0x20) <= 'z') {
+			digit = (*nptr | 0x20) - 'a' + 10;
+		} else {
+			break;
+		}
+		if (digit >= base) {
+			break;
+		}
+		val = val * base + digit;
+	}
+
+	if (endptr) {
+		*endptr = (char *)nptr;
+	}
+
+	return val;
+}
+
+long strtol(const char *nptr, char **endptr, int base)
+{
+	if (*nptr == '-') {
+		return -(long)strtoul(nptr + 1, endptr, base);
+	}
+
+	return strtoul(nptr, endptr, base);
+}
@@ -0,0 +1,51 @@
+#ifndef _TEST_RT_H
+#define _TEST_RT_H
+
+/*
+ * The little the host side harnesses need from the host, talking straight
+ * to an i386 Linux kernel so that they build with nothing more than the
+ * compiler, just like the kernel itself.  The kernel sources under test are
+ * included directly, and printk() writes to standard output.
+ */
+
+#include <fmios/types.h>
+#include <asm/processor.h>
+
+int main(void);
+
+void printk(const char *format, ...);
+void rt_exit(int status) __attribute__((noreturn));
+
+/* @return 0 in the child, the child's pid in the parent, or -1 */
+int rt_fork(void);
+
+/* @return the exit status of the next child to finish, or -1 if none are left */
+int rt_wait(void);
+
+void rt_yield(void);
+
+/* @return size bytes of zeroed memory shared with any children forked later */
+void *rt_map(size_t size);
+
+/* @return microseconds on the host's monotonic clock */
+uint64_t rt_usec(void);
+
+/* @return the next value from a cheap generator seeded through *seed */
+uint32_t rt_random(uint32_t *seed);
+
+/* @return count events over time, per million units of time: per million
+ * tsc cycles for rdtsc() deltas, per second for rt_usec() deltas */
+uint32_t rt_rate(uint64_t count, uint64_t time);
+
+void rt_fail(const char *expr, const char *file, int line);
+extern int rt_failures;
+extern int rt_cpu;	/* what cpu_id() returns, see include/asm/smp.h */
+
+#define CHECK(expr)							\
+do {									\
+	if (!(expr)) {							\
+		rt_fail(#expr, __FILE__, __LINE__);			\
+	}								\
+} while (0)
+
+#endif /* _TEST_RT_H */